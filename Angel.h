@@ -64,14 +64,14 @@ namespace Angel {
 GLuint InitShader( const char* vertexShaderFile,
 		   const char* fragmentShaderFile );
 
-//  Defined constant for when numbers are too small to be used in the
-//    denominator of a division operation.  This is only used if the
-//    DEBUG macro is defined.
-const GLfloat  DivideByZeroTolerance = GLfloat(1.0e-07);
-
-//  Degrees-to-radians constant 
-const GLfloat  DegreesToRadians = M_PI / 180.0;
+//  Same, with defines (e.g. "#define NUM_LIGHTS 4\n") inserted after
+//  each shader's #version line
+GLuint InitShader( const char* vertexShaderFile,
+		   const char* fragmentShaderFile,
+		   const char* defines );
 
 }  // namespace Angel
 
+using namespace Angel;
+
 #endif // __ANGEL_H__
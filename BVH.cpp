@@ -0,0 +1,156 @@
+#include "BVH.h"
+#include <algorithm>
+#include <cmath>
+
+void AABB::Extend( const vec3& p )
+{
+    lo.x = std::min( lo.x, p.x );  hi.x = std::max( hi.x, p.x );
+    lo.y = std::min( lo.y, p.y );  hi.y = std::max( hi.y, p.y );
+    lo.z = std::min( lo.z, p.z );  hi.z = std::max( hi.z, p.z );
+}
+
+void AABB::Extend( const AABB& b )
+{
+    if (b.Empty()) return;
+    Extend( b.lo );
+    Extend( b.hi );
+}
+
+AABB AABB::Transformed( const affine& m ) const
+{
+    if (Empty()) return *this;
+
+    // Center moves with the transform; each new half extent is the
+    // extents projected onto |row| (Arvo)
+    vec3 c = Center(), e = Extents(), nc, ne;
+    for (int i = 0; i < 3; ++i) {
+	const vec4& r = m[i];
+	nc[i] = r.x*c.x + r.y*c.y + r.z*c.z + r.w;
+	ne[i] = std::fabs( r.x )*e.x + std::fabs( r.y )*e.y + std::fabs( r.z )*e.z;
+    }
+    return AABB( nc - ne, nc + ne );
+}
+
+ViewFrustum::ViewFrustum( const mat4& m )
+{
+    // Gribb & Hartmann: w' -/+ x', y', z' >= 0 inside
+    for (int i = 0; i < 3; ++i) {
+	plane[2*i]   = m[3] + m[i];
+	plane[2*i+1] = m[3] - m[i];
+    }
+}
+
+ViewFrustum::Side ViewFrustum::Classify( const AABB& b ) const
+{
+    vec3 c = b.Center(), e = b.Extents();
+    Side side = Inside;
+
+    for (int i = 0; i < 6; ++i) {
+	const vec4& p = plane[i];
+	float d = p.x*c.x + p.y*c.y + p.z*c.z + p.w;
+	float r = std::fabs( p.x )*e.x + std::fabs( p.y )*e.y + std::fabs( p.z )*e.z;
+	if (d + r < 0.0f) return Outside;
+	if (d - r < 0.0f) side = Intersects;
+    }
+    return side;
+}
+
+void BVH::Build( const std::vector<AABB>& boxes )
+{
+    nodes.clear();
+    items.resize( boxes.size() );
+    for (size_t i = 0; i < items.size(); ++i) items[i] = int(i);
+
+    if (!items.empty()) {
+	nodes.reserve( 2 * items.size() / LeafItems + 1 );
+	Split( boxes, 0, int(items.size()) );
+    }
+
+    leaf_boxes.resize( items.size() );
+    for (size_t i = 0; i < items.size(); ++i) leaf_boxes[i] = boxes[items[i]];
+}
+
+int BVH::Split( const std::vector<AABB>& boxes, int first, int count )
+{
+    int index = int(nodes.size());
+    nodes.push_back( Node() );
+
+    AABB box, centers;
+    for (int i = first; i < first + count; ++i) {
+	box.Extend( boxes[items[i]] );
+	centers.Extend( boxes[items[i]].Center() );
+    }
+    nodes[index].box = box;
+    nodes[index].first = first;
+    nodes[index].count = count;
+    nodes[index].right = -1;
+
+    if (count <= LeafItems) return index;
+
+    vec3 size = centers.hi - centers.lo;
+    int axis = 0;
+    if (size.y > size[axis]) axis = 1;
+    if (size.z > size[axis]) axis = 2;
+
+    int mid = first + count/2;
+    std::nth_element( items.begin() + first, items.begin() + mid, items.begin() + first + count,
+		      [&]( int a, int b ) { return boxes[a].Center()[axis] < boxes[b].Center()[axis]; } );
+
+    Split( boxes, first, mid - first );
+    int right = Split( boxes, mid, first + count - mid );
+    nodes[index].right = right;  // nodes may have reallocated
+    return index;
+}
+
+void BVH::Refit( const std::vector<AABB>& boxes )
+{
+    for (size_t i = 0; i < items.size(); ++i) leaf_boxes[i] = boxes[items[i]];
+
+    // Children always follow their parent, so a backwards pass sees them first
+    for (int n = int(nodes.size()) - 1; n >= 0; --n) {
+	Node& node = nodes[n];
+	AABB box;
+	if (node.right < 0) {
+	    for (int i = node.first; i < node.first + node.count; ++i)
+		box.Extend( leaf_boxes[i] );
+	} else {
+	    box = nodes[n + 1].box;
+	    box.Extend( nodes[node.right].box );
+	}
+	node.box = box;
+    }
+}
+
+int BVH::Cull( const ViewFrustum& f, std::vector<unsigned char>& visible ) const
+{
+    visible.assign( items.size(), 0 );
+    if (nodes.empty()) return 0;
+
+    int drawn = 0;
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+	int n = stack[--top];
+	const Node& node = nodes[n];
+
+	ViewFrustum::Side side = f.Classify( node.box );
+	if (side == ViewFrustum::Outside) continue;
+
+	if (side == ViewFrustum::Inside || node.right < 0) {
+	    // A leaf that only intersects still tests its items one by one
+	    for (int i = node.first; i < node.first + node.count; ++i) {
+		if (side == ViewFrustum::Intersects && node.count > 1 &&
+		    f.Classify( leaf_boxes[i] ) == ViewFrustum::Outside) continue;
+		visible[items[i]] = 1;
+		++drawn;
+	    }
+	    continue;
+	}
+
+	stack[top++] = node.right;
+	stack[top++] = n + 1;
+    }
+    return drawn;
+}
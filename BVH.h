@@ -0,0 +1,90 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include "Angel.h"
+#include <vector>
+
+//----------------------------------------------------------------------------
+//
+//  AABB - axis-aligned bounding box
+//
+
+struct AABB {
+    vec3  lo, hi;
+
+    AABB() : lo( 1e30f ), hi( -1e30f ) {}  // empty: grows to the first point
+    AABB( const vec3& lo, const vec3& hi ) : lo(lo), hi(hi) {}
+
+    bool Empty() const { return lo.x > hi.x; }
+
+    vec3 Center() const  { return 0.5f * (lo + hi); }
+    vec3 Extents() const { return 0.5f * (hi - lo); }  // half size
+
+    void Extend( const vec3& p );
+    void Extend( const AABB& b );
+
+    //  Box around this one after transforming it by m
+    AABB Transformed( const affine& m ) const;
+};
+
+//----------------------------------------------------------------------------
+//
+//  ViewFrustum - the six clip planes of a projection * view matrix
+//
+//    Planes are extracted straight from the rows of the combined matrix,
+//    so any Perspective()/Ortho()/Frustum() projection works, and they
+//    point inwards in world space.
+//
+
+class ViewFrustum {
+public:
+    enum Side { Outside, Intersects, Inside };
+
+    explicit ViewFrustum( const mat4& projection_view );
+
+    Side Classify( const AABB& b ) const;
+
+private:
+    vec4  plane[6];  // (n, d): n.p + d >= 0 inside
+};
+
+//----------------------------------------------------------------------------
+//
+//  BVH - bounding volume hierarchy over a set of boxes
+//
+//    Built top-down by splitting at the median centroid along the longest
+//    axis, and stored flat in depth-first order: a node's left child is
+//    the next node and its items are one contiguous range, so a subtree
+//    that is wholly inside the frustum is accepted without visiting it.
+//
+//    Refit() recomputes the boxes bottom-up for items that moved while
+//    keeping the tree; rebuild when the item set changes.
+//
+
+class BVH {
+public:
+    enum { LeafItems = 4 };
+
+    void Build( const std::vector<AABB>& boxes );
+    void Refit( const std::vector<AABB>& boxes );
+
+    //  visible[i] = item i's box touches the frustum; returns how many do
+    int  Cull( const ViewFrustum& f, std::vector<unsigned char>& visible ) const;
+
+    int  Nodes() const { return int(nodes.size()); }
+
+private:
+    struct Node {
+	AABB box;
+	int  first, count;  // items[first, first + count)
+	int  right;         // right child, -1 for a leaf
+    };
+
+    int  Split( const std::vector<AABB>& boxes, int first, int count );
+
+    std::vector<Node>  nodes;
+    std::vector<int>   items;       // item ids in leaf order
+    std::vector<AABB>  leaf_boxes;  // their boxes, same order
+};
+
+#endif // __BVH_H__
@@ -4,7 +4,7 @@
 #include <stdio.h>
 #include <GL/gl.h>
 
-void CheckError()
+inline void CheckError()
 {
     GLenum errCode;
     const GLubyte *errString;
@@ -0,0 +1,145 @@
+#include "EntityStore.h"
+
+Entity EntityStore::Create( int type )
+{
+    unsigned slot;
+    if (!free_slots.empty()) {
+	slot = free_slots.back();
+	free_slots.pop_back();
+    } else {
+	slot = unsigned(slot_index.size());
+	slot_index.push_back( 0 );
+	slot_generation.push_back( 0 );
+    }
+
+    slot_index[slot] = unsigned(Size());
+    dense_slot.push_back( slot );
+
+    position.push_back( vec3(0.0) );
+    rotation.push_back( vec3(0.0) );
+    propeller_angle.push_back( 0.0 );
+    propeller_speed.push_back( 0.0 );
+    aux_angle.push_back( 0.0 );
+    aux_state.push_back( 0 );
+    model.push_back( (unsigned char) type );
+    propeller_pose.push_back( 0.0 );
+
+    Entity e = { slot, slot_generation[slot] };
+    return e;
+}
+
+void EntityStore::Destroy( Entity e )
+{
+    int i = Index( e );
+    if (i < 0) return;
+
+    // Move the last entity into the hole so the columns stay dense
+    int last = Size() - 1;
+    position[i] = position[last];
+    rotation[i] = rotation[last];
+    propeller_angle[i] = propeller_angle[last];
+    propeller_speed[i] = propeller_speed[last];
+    aux_angle[i] = aux_angle[last];
+    aux_state[i] = aux_state[last];
+    model[i] = model[last];
+    propeller_pose[i] = propeller_pose[last];
+    dense_slot[i] = dense_slot[last];
+    slot_index[dense_slot[i]] = i;
+
+    position.pop_back();  rotation.pop_back();
+    propeller_angle.pop_back();  propeller_speed.pop_back();
+    aux_angle.pop_back();  aux_state.pop_back();  model.pop_back();
+    propeller_pose.pop_back();
+    dense_slot.pop_back();
+
+    ++slot_generation[e.slot];
+    free_slots.push_back( e.slot );
+}
+
+void EntityStore::Reserve( int n )
+{
+    position.reserve( n );  rotation.reserve( n );
+    propeller_angle.reserve( n );  propeller_speed.reserve( n );
+    aux_angle.reserve( n );  aux_state.reserve( n );  model.reserve( n );
+    propeller_pose.reserve( n );
+    dense_slot.reserve( n );
+    slot_index.reserve( n );  slot_generation.reserve( n );
+}
+
+void EntityStore::Clear()
+{
+    // Bump every generation so outstanding handles go stale
+    free_slots.clear();
+    for (unsigned s = 0; s < slot_generation.size(); ++s) {
+	++slot_generation[s];
+	free_slots.push_back( unsigned(slot_generation.size()) - 1 - s );
+    }
+
+    position.clear();  rotation.clear();
+    propeller_angle.clear();  propeller_speed.clear();
+    aux_angle.clear();  aux_state.clear();  model.clear();
+    propeller_pose.clear();
+    dense_slot.clear();
+}
+
+int EntityStore::Index( Entity e ) const
+{
+    if (e.slot >= slot_generation.size() || slot_generation[e.slot] != e.generation)
+	return -1;
+    return int(slot_index[e.slot]);
+}
+
+Entity EntityStore::Handle( int index ) const
+{
+    unsigned slot = dense_slot[index];
+    Entity e = { slot, slot_generation[slot] };
+    return e;
+}
+
+void EntityStore::SpinPropellers( int begin, int end )
+{
+    if (begin >= end) return;
+    const int n = end;
+    float* __restrict angle = &propeller_angle[0];
+    const float* __restrict speed = &propeller_speed[0];
+    int i = begin;
+
+#if defined(ANGEL_SIMD_SSE)
+    const __m128 full = _mm_set1_ps( 360.0f );
+    for ( ; i + 4 <= n; i += 4) {
+	__m128 a = _mm_add_ps( _mm_loadu_ps( angle + i ), _mm_loadu_ps( speed + i ) );
+	__m128 wrap = _mm_and_ps( _mm_cmpgt_ps( a, full ), full );
+	_mm_storeu_ps( angle + i, _mm_sub_ps( a, wrap ) );
+    }
+#endif
+
+    for ( ; i < n; ++i) {
+	float a = angle[i] + speed[i];
+	angle[i] = a > 360.0f ? a - 360.0f : a;
+    }
+}
+
+void EntityStore::PosePropellers( float alpha, int begin, int end )
+{
+    // The previous step's angle is angle - speed (mod 360), so no history
+    // column is needed; a wrap in between only shifts the pose by 360
+    if (begin >= end) return;
+    const int n = end;
+    const float back = alpha - 1.0f;
+    const float* __restrict angle = &propeller_angle[0];
+    const float* __restrict speed = &propeller_speed[0];
+    float* __restrict pose = &propeller_pose[0];
+    int i = begin;
+
+#if defined(ANGEL_SIMD_SSE)
+    const __m128 b = _mm_set1_ps( back );
+    for ( ; i + 4 <= n; i += 4) {
+	__m128 a = _mm_add_ps( _mm_loadu_ps( angle + i ),
+			       _mm_mul_ps( _mm_loadu_ps( speed + i ), b ) );
+	_mm_storeu_ps( pose + i, a );
+    }
+#endif
+
+    for ( ; i < n; ++i)
+	pose[i] = angle[i] + back*speed[i];
+}
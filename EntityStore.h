@@ -0,0 +1,75 @@
+#ifndef __ENTITYSTORE_H__
+#define __ENTITYSTORE_H__
+
+#include "Angel.h"
+#include <vector>
+
+//----------------------------------------------------------------------------
+//
+//  Entity - stable handle to an aircraft in an EntityStore
+//
+//    Dense indices move when entities are destroyed, so callers keep the
+//    handle and resolve it with EntityStore::Index().  The generation
+//    count makes a handle to a destroyed entity resolve to -1 even after
+//    its slot has been reused.
+//
+
+struct Entity {
+    unsigned  slot;
+    unsigned  generation;
+};
+
+//----------------------------------------------------------------------------
+//
+//  EntityStore - aircraft state in structure-of-arrays layout
+//
+//    Each field of the old ObjectState is its own contiguous column, all
+//    indexed by the same dense index in [0, Size()).  Sweeps that only
+//    touch one or two fields (the propeller update) stream just those
+//    columns and vectorize; destroying an entity moves the last one into
+//    its place so the columns never have holes.
+//
+
+class EntityStore {
+public:
+    //  --- Columns (dense, Size() long) ---
+    std::vector<vec3>           position;
+    std::vector<vec3>           rotation;         // pitch, yaw, roll (x, y, z)
+    std::vector<float>          propeller_angle;
+    std::vector<float>          propeller_speed;
+    std::vector<float>          aux_angle;        // generic aux (e.g. wheels, door)
+    std::vector<unsigned char>  aux_state;        // open/close
+    std::vector<unsigned char>  model;            // aircraft type, 1..8
+
+    //  Render-time state, rewritten every frame by PosePropellers()
+    std::vector<float>          propeller_pose;   // angle between the last two steps
+
+    Entity Create( int model );
+    void   Destroy( Entity e );
+    void   Reserve( int n );
+    void   Clear();
+
+    bool   Alive( Entity e ) const { return Index( e ) >= 0; }
+    int    Index( Entity e ) const;  // dense index, or -1 if destroyed
+    Entity Handle( int index ) const;
+    int    Size() const { return int(model.size()); }
+
+    //  Advance every propeller by its speed, wrapping past 360 degrees.
+    //    The ranged forms touch only [begin, end), for splitting the sweep
+    //    across threads.
+    void   SpinPropellers() { SpinPropellers( 0, Size() ); }
+    void   SpinPropellers( int begin, int end );
+
+    //  propeller_pose = the angle alpha of the way from the previous step
+    //    to the current one (alpha = FrameClock::Alpha())
+    void   PosePropellers( float alpha ) { PosePropellers( alpha, 0, Size() ); }
+    void   PosePropellers( float alpha, int begin, int end );
+
+private:
+    std::vector<unsigned>  slot_index;       // slot -> dense index
+    std::vector<unsigned>  slot_generation;
+    std::vector<unsigned>  free_slots;
+    std::vector<unsigned>  dense_slot;       // dense index -> slot
+};
+
+#endif // __ENTITYSTORE_H__
@@ -0,0 +1,292 @@
+#include "FrameCapture.h"
+#include "GLState.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#if defined(_WIN32)
+#  include <fcntl.h>
+#  include <io.h>
+#  define dup _dup
+#  define dup2 _dup2
+#  define fdopen _fdopen
+#  define fileno _fileno
+#else
+#  include <unistd.h>
+#endif
+
+namespace {
+
+bool EndsWith( const std::string& s, const char* suffix )
+{
+    size_t n = strlen( suffix );
+    return s.size() >= n && s.compare( s.size() - n, n, suffix ) == 0;
+}
+
+//  At most one conversion, and that a %d with an optional width, so the
+//  name is safe to hand to snprintf
+bool ValidPattern( const std::string& s )
+{
+    int conversions = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+	if (s[i] != '%') continue;
+	size_t j = i + 1;
+	while (j < s.size() && s[j] >= '0' && s[j] <= '9') ++j;
+	if (j == s.size() || s[j] != 'd' || ++conversions > 1) return false;
+	i = j;
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//
+//  PNG, truecolor 8 bits a channel, deflate with stored blocks
+//
+
+unsigned Crc32( const unsigned char* p, size_t n, unsigned crc = 0 )
+{
+    static unsigned table[256];
+    if (!table[1]) {
+	for (unsigned i = 0; i < 256; ++i) {
+	    unsigned c = i;
+	    for (int k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+	    table[i] = c;
+	}
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i) crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+void PutBig( std::vector<unsigned char>& out, unsigned v )
+{
+    for (int s = 24; s >= 0; s -= 8) out.push_back( (unsigned char)(v >> s) );
+}
+
+void PutChunk( FILE* f, const char* type, const std::vector<unsigned char>& data )
+{
+    std::vector<unsigned char> chunk;
+    PutBig( chunk, unsigned(data.size()) );
+    chunk.insert( chunk.end(), type, type + 4 );
+    chunk.insert( chunk.end(), data.begin(), data.end() );
+    PutBig( chunk, Crc32( &chunk[4], chunk.size() - 4 ) );
+    fwrite( &chunk[0], 1, chunk.size(), f );
+}
+
+bool WritePng( const char* path, const unsigned char* rgb, int width, int height )
+{
+    FILE* f = fopen( path, "wb" );
+    if (!f) return false;
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    fwrite( signature, 1, 8, f );
+
+    std::vector<unsigned char> header;
+    PutBig( header, width );
+    PutBig( header, height );
+    const unsigned char format[5] = { 8, 2, 0, 0, 0 };  // depth, RGB, deflate, no filter, no interlace
+    header.insert( header.end(), format, format + 5 );
+    PutChunk( f, "IHDR", header );
+
+    // Each row is a filter byte (none) and its pixels; the zlib stream is
+    // those bytes in stored blocks of up to 64 KB
+    const size_t row = 1 + 3*size_t(width), total = row * height;
+    std::vector<unsigned char> raw( total );
+    for (int y = 0; y < height; ++y) {
+	raw[y*row] = 0;
+	memcpy( &raw[y*row + 1], rgb + y*(row - 1), row - 1 );
+    }
+
+    std::vector<unsigned char> z;
+    z.reserve( total + total / 65535 * 5 + 16 );
+    z.push_back( 0x78 );
+    z.push_back( 0x01 );
+    unsigned a = 1, b = 0;  // Adler-32
+    for (size_t pos = 0; pos < total; ) {
+	size_t n = std::min( total - pos, size_t(65535) );
+	z.push_back( pos + n == total ? 1 : 0 );
+	z.push_back( (unsigned char)n );
+	z.push_back( (unsigned char)(n >> 8) );
+	z.push_back( (unsigned char)~n );
+	z.push_back( (unsigned char)(~n >> 8) );
+	z.insert( z.end(), raw.begin() + pos, raw.begin() + pos + n );
+	for (size_t i = pos; i < pos + n; ++i) {
+	    a = (a + raw[i]) % 65521;
+	    b = (b + a) % 65521;
+	}
+	pos += n;
+    }
+    PutBig( z, (b << 16) | a );
+    PutChunk( f, "IDAT", z );
+    PutChunk( f, "IEND", std::vector<unsigned char>() );
+
+    bool ok = !ferror( f );
+    return fclose( f ) == 0 && ok;
+}
+
+bool WritePpm( const char* path, const unsigned char* rgb, int width, int height )
+{
+    FILE* f = fopen( path, "wb" );
+    if (!f) return false;
+    fprintf( f, "P6\n%d %d\n255\n", width, height );
+    bool ok = fwrite( rgb, 3, size_t(width)*height, f ) == size_t(width)*height;
+    return fclose( f ) == 0 && ok;
+}
+
+}  // namespace
+
+FrameCapture::FrameCapture() :
+    format(Raw), stream(NULL), width(0), height(0), next(0), written(0), stall_ms(0.0)
+{
+    for (int i = 0; i < Depth; ++i) {
+	slots[i].buffer = 0;
+	slots[i].fence = NULL;
+	slots[i].frame = 0;
+    }
+}
+
+FrameCapture::~FrameCapture()
+{
+    if (stream && stream != stdout) fclose( stream );
+}
+
+bool FrameCapture::Open( const std::string& output )
+{
+    if (stream && stream != stdout) fclose( stream );
+    stream = NULL;
+    if (output == "-" || EndsWith( output, ".rgb" )) format = Raw;
+    else if (EndsWith( output, ".ppm" )) format = Ppm;
+    else if (EndsWith( output, ".png" )) format = Png;
+    else {
+	std::cerr << "FrameCapture: " << output << ": name it - or *.rgb, *.ppm or *.png" << std::endl;
+	return false;
+    }
+    if (format != Raw && !ValidPattern( output )) {
+	std::cerr << "FrameCapture: " << output << ": only a %d for the frame number may follow a %" << std::endl;
+	return false;
+    }
+
+    if (format == Raw && output == "-") {
+	// The frames keep the real stdout; everything else printed goes to stderr
+	fflush( stdout );
+	int fd = dup( fileno( stdout ) );
+	if (fd >= 0) stream = fdopen( fd, "wb" );
+	if (stream) dup2( fileno( stderr ), fileno( stdout ) );
+#if defined(_WIN32)
+	if (stream) _setmode( fd, _O_BINARY );
+#endif
+    } else if (format == Raw) {
+	stream = fopen( output.c_str(), "wb" );
+    }
+    if (format == Raw && !stream) {
+	std::cerr << "FrameCapture: can't write " << output << std::endl;
+	return false;
+    }
+
+    pattern = output;
+    return true;
+}
+
+bool FrameCapture::Init( int w, int h )
+{
+    Release();
+    width = w;
+    height = h;
+    rgb.resize( 3*size_t(w)*h );
+    for (int i = 0; i < Depth; ++i) {
+	glGenBuffers( 1, &slots[i].buffer );
+	GLState::BindBuffer( GL_PIXEL_PACK_BUFFER, slots[i].buffer );
+	glBufferData( GL_PIXEL_PACK_BUFFER, 4*GLsizeiptr(w)*h, NULL, GL_STREAM_READ );
+    }
+    GLState::BindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    next = 0;
+    written = 0;
+    stall_ms = 0.0;
+    return true;
+}
+
+bool FrameCapture::Read( int frame )
+{
+    Slot& s = slots[next];
+    if (s.fence && !Write( s )) return false;
+
+    GLState::BindBuffer( GL_PIXEL_PACK_BUFFER, s.buffer );
+    glReadPixels( 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, BUFFER_OFFSET(0) );
+    GLState::BindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    s.fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+    s.frame = frame;
+    next = (next + 1) % Depth;
+    return true;
+}
+
+bool FrameCapture::Finish()
+{
+    // Oldest first, so a stream keeps frame order
+    bool ok = true;
+    for (int i = 0; i < Depth; ++i) {
+	Slot& s = slots[(next + i) % Depth];
+	if (s.fence && !Write( s )) ok = false;
+    }
+    if (stream) ok = fflush( stream ) == 0 && ok;
+    return ok;
+}
+
+bool FrameCapture::Write( Slot& s )
+{
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    while (glClientWaitSync( s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000 ) == GL_TIMEOUT_EXPIRED) {}
+    glDeleteSync( s.fence );
+    s.fence = NULL;
+    stall_ms += std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - t0 ).count();
+
+    // GL's rows run bottom up; files want them top down and without alpha
+    GLState::BindBuffer( GL_PIXEL_PACK_BUFFER, s.buffer );
+    const unsigned char* p = (const unsigned char*)
+	glMapBufferRange( GL_PIXEL_PACK_BUFFER, 0, 4*GLsizeiptr(width)*height, GL_MAP_READ_BIT );
+    if (p) {
+	for (int y = 0; y < height; ++y) {
+	    const unsigned char* src = p + 4*size_t(width)*(height - 1 - y);
+	    unsigned char* dst = &rgb[3*size_t(width)*y];
+	    for (int x = 0; x < width; ++x, src += 4, dst += 3) {
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+	    }
+	}
+	glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
+    }
+    GLState::BindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    if (!p) {
+	std::cerr << "FrameCapture: couldn't map frame " << s.frame << std::endl;
+	return false;
+    }
+
+    char path[1024];
+    bool ok;
+    if (format == Raw) {
+	ok = fwrite( &rgb[0], 1, rgb.size(), stream ) == rgb.size();
+	snprintf( path, sizeof(path), "%s", pattern.c_str() );
+    } else {
+	snprintf( path, sizeof(path), pattern.c_str(), s.frame );
+	ok = format == Png ? WritePng( path, &rgb[0], width, height )
+			   : WritePpm( path, &rgb[0], width, height );
+    }
+    if (!ok) {
+	std::cerr << "FrameCapture: writing frame " << s.frame << " to " << path << " failed" << std::endl;
+	return false;
+    }
+    ++written;
+    return true;
+}
+
+void FrameCapture::Release()
+{
+    for (int i = 0; i < Depth; ++i) {
+	Slot& s = slots[i];
+	if (s.fence) glDeleteSync( s.fence );
+	if (s.buffer) GLState::DeleteBuffer( s.buffer );
+	s.fence = NULL;
+	s.buffer = 0;
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef __FRAMECAPTURE_H__
+#define __FRAMECAPTURE_H__
+
+#include "Angel.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------------
+//
+//  FrameCapture - frames read back from the framebuffer without waiting
+//    for them, written as images or a raw stream
+//
+//    Read() queues a glReadPixels of the bound framebuffer into one of
+//    Depth pixel pack buffers and fences it, so the copy happens on the
+//    GPU's time while the next frames are drawn.  A buffer is only mapped
+//    when its turn comes round again, Depth frames later, or at Finish();
+//    by then its fence has normally passed.  StallMs() is how long mapping
+//    did wait.
+//
+//    Open() takes where the frames go, before anything GL; Init() makes
+//    the buffers once the context is current.  The name picks the format:
+//
+//	"-" or "*.rgb"    raw RGB24 frames, top row first, back to back
+//			  (ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH -i -)
+//	"*.ppm", "*.png"  a file per frame; a %d in the name (%05d etc.)
+//			  takes the frame number, without one every frame
+//			  writes the same file
+//
+//    Streaming to "-" keeps stdout for the frames alone: from Open() on,
+//    anything else printed to stdout goes to stderr, so open early.  PNGs
+//    hold stored (uncompressed) deflate blocks, so there is no zlib to
+//    link.
+//
+
+class FrameCapture {
+public:
+    enum { Depth = 3 };  // readbacks in flight
+
+    FrameCapture();
+    ~FrameCapture();  // GL objects are left to the context; see Release()
+
+    bool Open( const std::string& output );
+    bool Init( int width, int height );
+    bool Read( int frame );  // false if writing an earlier frame failed
+    bool Finish();           // writes every frame still in flight
+    void Release();          // while the context is current
+
+    int    Written() const  { return written; }
+    double StallMs() const  { return stall_ms; }
+
+private:
+    FrameCapture( const FrameCapture& );
+    FrameCapture& operator = ( const FrameCapture& );
+
+    struct Slot {
+	GLuint  buffer;
+	GLsync  fence;  // NULL when the slot holds no frame
+	int     frame;
+    };
+
+    bool Write( Slot& s );
+
+    enum Format { Raw, Ppm, Png };
+
+    Format        format;
+    std::string   pattern;
+    FILE*         stream;  // Raw only
+    int           width, height;
+    Slot          slots[Depth];
+    int           next;
+    int           written;
+    double        stall_ms;
+    std::vector<unsigned char> rgb;  // one frame, top row first
+};
+
+#endif // __FRAMECAPTURE_H__
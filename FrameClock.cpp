@@ -0,0 +1,47 @@
+#include "FrameClock.h"
+
+FrameClock::FrameClock( double step_ms ) :
+    step_ms(step_ms), accumulator(0.0), last_ms(-1), steps(0) {}
+
+void FrameClock::Reset( int now_ms )
+{
+    last_ms = now_ms;
+    accumulator = 0.0;
+}
+
+int FrameClock::Advance( int now_ms )
+{
+    if (last_ms < 0) Reset( now_ms );
+
+    accumulator += now_ms - last_ms;
+    last_ms = now_ms;
+
+    int n = int(accumulator / step_ms);
+    accumulator -= n * step_ms;
+    if (n > MaxSteps) n = MaxSteps;  // drop the backlog
+
+    steps += n;
+    return n;
+}
+
+FrameStats::FrameStats( int window_ms ) :
+    window_ms(window_ms), start_ms(-1), frames(0), gpu_samples(0),
+    update_ms(0.0), render_ms(0.0), gpu_ms(0.0) {}
+
+bool FrameStats::Report( int now_ms, double* fps, double* update_avg, double* render_avg,
+			 double* gpu_avg )
+{
+    if (start_ms < 0) start_ms = now_ms;
+    int elapsed = now_ms - start_ms;
+    if (elapsed < window_ms || frames == 0) return false;
+
+    *fps = 1000.0 * frames / elapsed;
+    *update_avg = update_ms / frames;
+    *render_avg = render_ms / frames;
+    *gpu_avg = gpu_samples ? gpu_ms / gpu_samples : 0.0;
+
+    start_ms = now_ms;
+    frames = gpu_samples = 0;
+    update_ms = render_ms = gpu_ms = 0.0;
+    return true;
+}
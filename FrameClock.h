@@ -0,0 +1,66 @@
+#ifndef __FRAMECLOCK_H__
+#define __FRAMECLOCK_H__
+
+//----------------------------------------------------------------------------
+//
+//  FrameClock - fixed-timestep simulation clock
+//
+//    The simulation always advances in steps of the same length, however
+//    fast frames are drawn: each frame Advance() banks the elapsed wall
+//    time and returns how many whole steps are due.  The leftover fraction
+//    of a step, Alpha(), is what rendering interpolates by, so motion is
+//    smooth at any frame rate and the same speed at every frame rate.
+//
+//    After a long stall (window drag, breakpoint) at most MaxSteps are run
+//    and the rest of the backlog is dropped rather than catching up.
+//
+
+class FrameClock {
+public:
+    enum { MaxSteps = 5 };
+
+    explicit FrameClock( double step_ms = 1000.0/60.0 );
+
+    void   Reset( int now_ms );
+    int    Advance( int now_ms );        // whole steps due since the last call
+
+    double StepMs() const { return step_ms; }
+    float  Alpha() const  { return float(accumulator / step_ms); }  // in [0, 1)
+    long   Steps() const  { return steps; }  // total steps taken
+
+private:
+    double step_ms;
+    double accumulator;  // wall time not yet simulated
+    int    last_ms;
+    long   steps;
+};
+
+//----------------------------------------------------------------------------
+//
+//  FrameStats - update vs render time averaged over a reporting window
+//
+//    GPU time comes from timer queries read back a few frames late, so it
+//    is averaged over the samples that arrived in the window instead.
+//
+
+class FrameStats {
+public:
+    explicit FrameStats( int window_ms = 1000 );
+
+    void AddUpdate( double ms ) { update_ms += ms; }
+    void AddRender( double ms ) { render_ms += ms; ++frames; }
+    void AddGpu( double ms )    { gpu_ms += ms; ++gpu_samples; }
+
+    //  Once per window: fills the averages and starts a new window;
+    //    gpu_avg is 0 if no GPU time arrived
+    bool Report( int now_ms, double* fps, double* update_avg, double* render_avg,
+		 double* gpu_avg );
+
+private:
+    int    window_ms;
+    int    start_ms;
+    int    frames, gpu_samples;
+    double update_ms, render_ms, gpu_ms;
+};
+
+#endif // __FRAMECLOCK_H__
@@ -0,0 +1,197 @@
+#include "GLState.h"
+#include <cstring>
+#include <map>
+#include <vector>
+
+namespace {
+
+// Buffer targets whose binding is shadowed; others go straight through
+const GLenum Targets[] = {
+    GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_TEXTURE_BUFFER,
+    GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GL_DRAW_INDIRECT_BUFFER, GL_PIXEL_PACK_BUFFER
+};
+const int NumTargets = sizeof(Targets) / sizeof(Targets[0]);
+
+// Last value set at one uniform location, as the function that set it saw it
+struct Slot {
+    enum Kind { None, Int1, Float1, Float2, Int3, Float4, Matrix4, Matrix4Transposed };
+
+    Kind     kind;
+    GLfloat  value[16];  // ints are kept bit for bit
+};
+
+const int Words[] = { 0, 1, 1, 2, 3, 4, 16, 16 };
+
+struct Texture {
+    GLenum  target;
+    GLuint  name;
+};
+
+bool     enabled = true;
+int      issued = 0, skipped = 0;
+
+GLuint   program = 0;
+std::vector<Slot>* slots = NULL;  // uniforms of program
+std::map< GLuint, std::vector<Slot> > uniforms;
+
+GLuint   buffers[NumTargets] = { 0 };
+int      active_unit = 0;
+Texture  textures[GLState::MaxUnits] = { { 0, 0 } };
+
+GLuint* Binding( GLenum target )
+{
+    for (int i = 0; i < NumTargets; ++i)
+	if (Targets[i] == target) return &buffers[i];
+    return NULL;
+}
+
+// Record value at location; true if it was there already and the call can go
+bool Redundant( GLint location, Slot::Kind kind, const void* value )
+{
+    if (!slots || location >= GLState::MaxLocations) {
+	++issued;
+	return false;
+    }
+
+    Slot& s = (*slots)[location];
+    size_t bytes = Words[kind] * sizeof(GLfloat);
+    if (enabled && s.kind == kind && memcmp( s.value, value, bytes ) == 0) {
+	++skipped;
+	return true;
+    }
+    s.kind = kind;
+    memcpy( s.value, value, bytes );
+    ++issued;
+    return false;
+}
+
+}  // namespace
+
+void GLState::UseProgram( GLuint p )
+{
+    if (enabled && p == program) {
+	++skipped;
+	return;
+    }
+    program = p;
+    std::vector<Slot>& s = uniforms[p];
+    if (s.empty()) {
+	Slot none = { Slot::None, { 0 } };
+	s.assign( MaxLocations, none );
+    }
+    slots = &s;
+    glUseProgram( p );
+    ++issued;
+}
+
+void GLState::BindBuffer( GLenum target, GLuint buffer )
+{
+    GLuint* bound = Binding( target );
+    if (enabled && bound && *bound == buffer) {
+	++skipped;
+	return;
+    }
+    if (bound) *bound = buffer;
+    glBindBuffer( target, buffer );
+    ++issued;
+}
+
+void GLState::BindBufferBase( GLenum target, GLuint index, GLuint buffer )
+{
+    // Also binds the target itself; indexed bindings aren't shadowed
+    GLuint* bound = Binding( target );
+    if (bound) *bound = buffer;
+    glBindBufferBase( target, index, buffer );
+    ++issued;
+}
+
+void GLState::BindTexture( int unit, GLenum target, GLuint texture )
+{
+    Texture& t = textures[unit];
+    if (enabled && t.target == target && t.name == texture) {
+	++skipped;
+	return;
+    }
+    if (!enabled || active_unit != unit) {
+	glActiveTexture( GL_TEXTURE0 + unit );
+	active_unit = unit;
+	++issued;
+    }
+    t.target = target;
+    t.name = texture;
+    glBindTexture( target, texture );
+    ++issued;
+}
+
+void GLState::Uniform1i( GLint location, GLint v )
+{
+    if (location < 0 || Redundant( location, Slot::Int1, &v )) return;
+    glUniform1i( location, v );
+}
+
+void GLState::Uniform1f( GLint location, GLfloat v )
+{
+    if (location < 0 || Redundant( location, Slot::Float1, &v )) return;
+    glUniform1f( location, v );
+}
+
+void GLState::Uniform2fv( GLint location, const GLfloat* v )
+{
+    if (location < 0 || Redundant( location, Slot::Float2, v )) return;
+    glUniform2fv( location, 1, v );
+}
+
+void GLState::Uniform3i( GLint location, GLint x, GLint y, GLint z )
+{
+    GLint v[3] = { x, y, z };
+    if (location < 0 || Redundant( location, Slot::Int3, v )) return;
+    glUniform3i( location, x, y, z );
+}
+
+void GLState::Uniform4fv( GLint location, const GLfloat* v )
+{
+    if (location < 0 || Redundant( location, Slot::Float4, v )) return;
+    glUniform4fv( location, 1, v );
+}
+
+void GLState::UniformMatrix4fv( GLint location, GLboolean transpose, const GLfloat* v )
+{
+    Slot::Kind kind = transpose ? Slot::Matrix4Transposed : Slot::Matrix4;
+    if (location < 0 || Redundant( location, kind, v )) return;
+    glUniformMatrix4fv( location, 1, transpose, v );
+}
+
+void GLState::DeleteBuffer( GLuint buffer )
+{
+    for (int i = 0; i < NumTargets; ++i)
+	if (buffers[i] == buffer) buffers[i] = 0;
+    glDeleteBuffers( 1, &buffer );
+    ++issued;
+}
+
+void GLState::DeleteTexture( GLuint texture )
+{
+    for (int u = 0; u < MaxUnits; ++u)
+	if (textures[u].name == texture) textures[u].name = 0;
+    glDeleteTextures( 1, &texture );
+    ++issued;
+}
+
+void GLState::DeleteProgram( GLuint p )
+{
+    // A program in use lives on until the next UseProgram(), but its
+    // values mustn't outlive it in case the name comes back
+    if (p == program) {
+	program = 0;
+	slots = NULL;
+    }
+    uniforms.erase( p );
+    glDeleteProgram( p );
+    ++issued;
+}
+
+void GLState::SetEnabled( bool on ) { enabled = on; }
+bool GLState::Enabled()             { return enabled; }
+void GLState::ResetCounters()       { issued = skipped = 0; }
+int  GLState::Issued()              { return issued; }
+int  GLState::Skipped()             { return skipped; }
@@ -0,0 +1,54 @@
+#ifndef __GLSTATE_H__
+#define __GLSTATE_H__
+
+#include "Angel.h"
+
+//----------------------------------------------------------------------------
+//
+//  GLState - shadow of the GL state the renderer sets, so calls that
+//    wouldn't change anything never reach the driver
+//
+//    GL state belongs to the context and there is one context, so the
+//    shadow is global too: every module binds programs, buffers and
+//    textures and sets uniforms through these functions, and a call that
+//    matches the shadow is skipped.  Uniforms are shadowed per program and
+//    location, as GL keeps them; the element array binding is tracked as
+//    plain state since there is one vertex array object.
+//
+//    Deletes go through here as well (DeleteBuffer(), DeleteTexture(),
+//    DeleteProgram()) so a recycled name doesn't inherit stale values.
+//
+//    Issued() and Skipped() count state calls since ResetCounters();
+//    SetEnabled( false ) passes every call through, to measure what the
+//    skipping saves.
+//
+
+class GLState {
+public:
+    enum { MaxUnits = 8, MaxLocations = 64 };
+
+    static void UseProgram( GLuint program );
+    static void BindBuffer( GLenum target, GLuint buffer );
+    static void BindBufferBase( GLenum target, GLuint index, GLuint buffer );
+    static void BindTexture( int unit, GLenum target, GLuint texture );
+
+    //  Uniforms of the program in use; location -1 is ignored, like GL does
+    static void Uniform1i( GLint location, GLint v );
+    static void Uniform1f( GLint location, GLfloat v );
+    static void Uniform2fv( GLint location, const GLfloat* v );
+    static void Uniform3i( GLint location, GLint x, GLint y, GLint z );
+    static void Uniform4fv( GLint location, const GLfloat* v );
+    static void UniformMatrix4fv( GLint location, GLboolean transpose, const GLfloat* v );
+
+    static void DeleteBuffer( GLuint buffer );
+    static void DeleteTexture( GLuint texture );
+    static void DeleteProgram( GLuint program );
+
+    static void SetEnabled( bool on );
+    static bool Enabled();
+    static void ResetCounters();
+    static int  Issued();   // calls that reached GL
+    static int  Skipped();  // calls the shadow made unnecessary
+};
+
+#endif // __GLSTATE_H__
@@ -1,4 +1,5 @@
 #include "Angel.h"
+#include <cstring>
 #include <fstream> 
 
 namespace Angel {
@@ -28,6 +29,14 @@ readShaderSource(const char* shaderFile)
 // Create a GLSL program object from vertex and fragment shader files
 GLuint
 InitShader(const char* vShaderFile, const char* fShaderFile)
+{
+    return InitShader( vShaderFile, fShaderFile, "" );
+}
+
+// Same, compiling each shader with the defines inserted after its #version
+// line (which has to come first); #line keeps the log's line numbers right
+GLuint
+InitShader(const char* vShaderFile, const char* fShaderFile, const char* defines)
 {
     struct Shader {
 	const char*  filename;
@@ -48,8 +57,17 @@ InitShader(const char* vShaderFile, const char* fShaderFile)
 	    exit( EXIT_FAILURE );
 	}
 
+	const GLchar* body = s.source;
+	if ( strncmp( body, "#version", 8 ) == 0 ) {
+	    const GLchar* eol = strchr( body, '\n' );
+	    body = eol ? eol + 1 : body + strlen( body );
+	}
+	const GLchar* parts[4] = { s.source, defines, "#line 2\n", body };
+	GLint lengths[4] = { GLint(body - s.source), -1, -1, -1 };
+	if ( body == s.source ) parts[2] = "";
+
 	GLuint shader = glCreateShader( s.type );
-	glShaderSource( shader, 1, (const GLchar**) &s.source, NULL );
+	glShaderSource( shader, 4, parts, lengths );
 	glCompileShader( shader );
 
 	GLint  compiled;
@@ -0,0 +1,171 @@
+#include "LightGrid.h"
+#include "GLState.h"
+#include <algorithm>
+#include <cmath>
+
+// Sphere around the part of eye space a light reaches, radius in w; a
+// negative radius means everywhere (directional lights)
+static vec4 Bounds( const GridLight& light )
+{
+    GLfloat range = light.position.w;
+    if (range <= 0.0f) return vec4( 0.0, 0.0, 0.0, -1.0 );
+
+    vec3 apex( light.position );
+    GLfloat c = light.spot.w;
+    if (c <= 0.0f) return vec4( apex, range );  // all round, or a cone past a hemisphere
+
+    // A cone wider than 45 degrees fits in the sphere through the rim of its
+    // cap, a narrower one in the sphere through its apex and rim
+    vec3 axis( light.spot );
+    if (c < 0.70710678f) return vec4( apex + axis * (range * c), range * sqrtf( 1.0f - c*c ) );
+    return vec4( apex + axis * (range / (2.0f * c)), range / (2.0f * c) );
+}
+
+// Tiles [*lo, *hi] along one screen axis covered by [c - r, c + r] on that
+// axis anywhere in the depths [front, back]; false if it is off screen
+static bool TileSpan( GLfloat c, GLfloat r, GLfloat front, GLfloat back,
+		      GLfloat tan_half, int tiles, int* lo, int* hi )
+{
+    // Dividing by depth pulls an edge towards the centre, so each edge
+    // reaches furthest out at the front if it is on its own side, else the back
+    GLfloat lo_ndc = (c - r) / ((c - r < 0.0f ? front : back) * tan_half);
+    GLfloat hi_ndc = (c + r) / ((c + r > 0.0f ? front : back) * tan_half);
+    if (hi_ndc < -1.0f || lo_ndc > 1.0f) return false;
+
+    *lo = std::max( 0, int( floorf( (lo_ndc + 1.0f) * 0.5f * tiles ) ) );
+    *hi = std::min( tiles - 1, int( floorf( (hi_ndc + 1.0f) * 0.5f * tiles ) ) );
+    return true;
+}
+
+LightGrid::LightGrid() :
+    record_buffer(0), index_buffer(0), record_texture(0), index_texture(0),
+    tile_size(1.0), depth_scale(0.0),
+    near_depth(1.0), far_depth(1.0), tan_x(1.0), tan_y(1.0), max_run(0),
+    records(2*Clusters, 0) {}
+
+void LightGrid::Init()
+{
+    Release();
+    glGenBuffers( 1, &record_buffer );
+    glGenBuffers( 1, &index_buffer );
+    glGenTextures( 1, &record_texture );
+    glGenTextures( 1, &index_texture );
+
+    // Empty lists until the first Upload()
+    GLushort none = 0;
+    GLState::BindBuffer( GL_TEXTURE_BUFFER, record_buffer );
+    glBufferData( GL_TEXTURE_BUFFER, records.size()*sizeof(GLuint), &records[0], GL_STREAM_DRAW );
+    GLState::BindBuffer( GL_TEXTURE_BUFFER, index_buffer );
+    glBufferData( GL_TEXTURE_BUFFER, sizeof(none), &none, GL_STREAM_DRAW );
+
+    // Each texture stays on its unit from here on
+    GLState::BindTexture( RecordsUnit, GL_TEXTURE_BUFFER, record_texture );
+    glTexBuffer( GL_TEXTURE_BUFFER, GL_RG32UI, record_buffer );
+    GLState::BindTexture( IndicesUnit, GL_TEXTURE_BUFFER, index_texture );
+    glTexBuffer( GL_TEXTURE_BUFFER, GL_R16UI, index_buffer );
+}
+
+void LightGrid::Release()
+{
+    if (record_texture) GLState::DeleteTexture( record_texture );
+    if (index_texture) GLState::DeleteTexture( index_texture );
+    if (record_buffer) GLState::DeleteBuffer( record_buffer );
+    if (index_buffer) GLState::DeleteBuffer( index_buffer );
+    record_texture = index_texture = record_buffer = index_buffer = 0;
+}
+
+void LightGrid::Build( const GridLight* lights, int count, GLfloat fovy, GLfloat aspect,
+		       GLfloat zNear, GLfloat zFar, int width, int height, TaskPool& pool )
+{
+    near_depth = zNear;
+    far_depth = zFar;
+    tan_y = tanf( 0.5f * fovy * DegreesToRadians );
+    tan_x = tan_y * aspect;
+    tile_size = vec2( GLfloat(width) / TilesX, GLfloat(height) / TilesY );
+    GLfloat scale = Slices / logf( zFar / zNear );
+    depth_scale = vec2( scale, -logf( zNear ) * scale );
+
+    spheres.resize( count );
+    for (int i = 0; i < count; ++i) spheres[i] = Bounds( lights[i] );
+
+    pool.ParallelFor( Slices, [this]( int z, int ) { BuildSlice( z ); } );
+
+    // Runs are laid out slice after slice; each slice then moves its own in
+    GLuint total = 0;
+    max_run = 0;
+    for (int z = 0; z < Slices; ++z) {
+	slices[z].start = total;
+	total += GLuint( slices[z].indices.size() );
+	max_run = std::max( max_run, slices[z].longest );
+    }
+    indices.resize( total );
+
+    pool.ParallelFor( Slices, [this]( int z, int ) {
+	const Slice& s = slices[z];
+	std::copy( s.indices.begin(), s.indices.end(), indices.begin() + s.start );
+	GLuint* r = &records[2*z*TilesX*TilesY];
+	for (int c = 0; c < TilesX*TilesY; ++c) r[2*c] += s.start;
+    } );
+}
+
+void LightGrid::BuildSlice( int z )
+{
+    Slice& s = slices[z];
+    GLfloat front = near_depth * powf( far_depth / near_depth, GLfloat(z) / Slices );
+    GLfloat back = near_depth * powf( far_depth / near_depth, GLfloat(z + 1) / Slices );
+
+    // Screen rectangle of tiles for each light reaching this slice
+    s.rects.clear();
+    for (int i = 0; i < int(spheres.size()); ++i) {
+	const vec4& b = spheres[i];
+	int x0 = 0, x1 = TilesX - 1, y0 = 0, y1 = TilesY - 1;
+	if (b.w >= 0.0f) {
+	    // The eye looks down -z, so depth is -z
+	    GLfloat d0 = std::max( front, -b.z - b.w ), d1 = std::min( back, -b.z + b.w );
+	    if (d0 > d1) continue;
+	    if (!TileSpan( b.x, b.w, d0, d1, tan_x, TilesX, &x0, &x1 ) ||
+		!TileSpan( b.y, b.w, d0, d1, tan_y, TilesY, &y0, &y1 )) continue;
+	}
+	int rect[5] = { i, x0, x1, y0, y1 };
+	s.rects.insert( s.rects.end(), rect, rect + 5 );
+    }
+
+    // Count each cluster's lights, give each its run, then fill the runs in
+    // light order using the run starts as cursors
+    GLuint* r = &records[2*z*TilesX*TilesY];
+    for (int c = 0; c < TilesX*TilesY; ++c) r[2*c + 1] = 0;
+    for (size_t k = 0; k < s.rects.size(); k += 5)
+	for (int y = s.rects[k+3]; y <= s.rects[k+4]; ++y)
+	    for (int x = s.rects[k+1]; x <= s.rects[k+2]; ++x)
+		++r[2*(y*TilesX + x) + 1];
+
+    GLuint start = 0;
+    s.longest = 0;
+    for (int c = 0; c < TilesX*TilesY; ++c) {
+	r[2*c] = start;
+	start += r[2*c + 1];
+	s.longest = std::max( s.longest, int(r[2*c + 1]) );
+    }
+
+    s.indices.resize( start );
+    for (size_t k = 0; k < s.rects.size(); k += 5)
+	for (int y = s.rects[k+3]; y <= s.rects[k+4]; ++y)
+	    for (int x = s.rects[k+1]; x <= s.rects[k+2]; ++x)
+		s.indices[r[2*(y*TilesX + x)]++] = GLushort( s.rects[k] );
+
+    for (int c = 0; c < TilesX*TilesY; ++c) r[2*c] -= r[2*c + 1];
+}
+
+void LightGrid::Upload()
+{
+    // Whole new stores, so the previous frame's draws keep reading theirs
+    GLState::BindBuffer( GL_TEXTURE_BUFFER, record_buffer );
+    glBufferData( GL_TEXTURE_BUFFER, records.size()*sizeof(GLuint), &records[0], GL_STREAM_DRAW );
+    if (!indices.empty()) {
+	GLState::BindBuffer( GL_TEXTURE_BUFFER, index_buffer );
+	glBufferData( GL_TEXTURE_BUFFER, indices.size()*sizeof(GLushort), &indices[0], GL_STREAM_DRAW );
+    }
+
+    GLState::BindTexture( RecordsUnit, GL_TEXTURE_BUFFER, record_texture );
+    GLState::BindTexture( IndicesUnit, GL_TEXTURE_BUFFER, index_texture );
+}
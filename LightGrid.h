@@ -0,0 +1,92 @@
+#ifndef __LIGHTGRID_H__
+#define __LIGHTGRID_H__
+
+#include "Angel.h"
+#include "TaskPool.h"
+#include <vector>
+
+//----------------------------------------------------------------------------
+//
+//  LightGrid - lights sorted into clusters for clustered forward shading
+//
+//    The view frustum is cut into TilesX x TilesY tiles on screen and
+//    Slices slices in depth, spaced exponentially from the near to the far
+//    plane of Perspective() so each cluster ("froxel") is roughly as deep
+//    as it is wide.  Build() lists in every cluster the lights whose range
+//    reaches it, and Upload() hands the lists to the fragment shader as
+//    two texture buffers:
+//
+//	records  RG32UI, per cluster: start of its run in indices, length
+//	indices  R16UI, light numbers, one run per cluster
+//
+//    A fragment finds its cluster from gl_FragCoord and its depth and
+//    shades only the lights in that run, so its cost follows the lights
+//    that can reach it rather than how many the scene has.
+//
+//    Build() is one task per slice on the TaskPool: each tests every
+//    light against its depth range, then counts and fills its own
+//    clusters, so the workers share no list.  A light is bounded by a
+//    sphere (a spot light by the sphere around its cone); a directional
+//    light, range 0, is listed in every cluster.
+//
+
+//  A light as the shaders read it, in eye space (std140)
+struct GridLight {
+    vec4 position;  // xyz and range in w; range 0 is directional, xyz towards it
+    vec4 color;     // scales the material's diffuse and specular
+    vec4 spot;      // cone axis (xyz), cos of its half angle (w); -1 for all round
+};
+
+class LightGrid {
+public:
+    enum { TilesX = 16, TilesY = 9, Slices = 24 };
+    enum { Clusters = TilesX*TilesY*Slices };
+    enum { RecordsUnit = 0, IndicesUnit = 1 };  // texture units Upload() binds
+
+    LightGrid();
+
+    void Init();     // GL objects, while the context is current
+    void Release();
+
+    //  List lights[0, count) in the clusters of a Perspective( fovy, aspect,
+    //    zNear, zFar ) view drawn into a width x height viewport
+    void Build( const GridLight* lights, int count, GLfloat fovy, GLfloat aspect,
+		GLfloat zNear, GLfloat zFar, int width, int height, TaskPool& pool );
+    void Upload();
+
+    //  Finding a fragment's cluster: tile = gl_FragCoord.xy / TileSize(),
+    //    slice = log(depth) * DepthScale().x + DepthScale().y
+    vec2 TileSize() const   { return tile_size; }
+    vec2 DepthScale() const { return depth_scale; }
+
+    int  Entries() const { return int(indices.size()); }  // light-cluster pairs
+    int  MaxRun() const  { return max_run; }              // most lights in one cluster
+
+private:
+    LightGrid( const LightGrid& );
+    LightGrid& operator = ( const LightGrid& );
+
+    //  One slice's share of Build(), before it is placed in indices
+    struct Slice {
+	std::vector<int>       rects;    // light, x0, x1, y0, y1 for each light reaching it
+	std::vector<GLushort>  indices;  // its clusters' runs, in cluster order
+	GLuint                 start;    // where they go in indices
+	int                    longest;  // most lights in one of its clusters
+    };
+
+    void BuildSlice( int z );
+
+    GLuint  record_buffer, index_buffer;
+    GLuint  record_texture, index_texture;
+
+    vec2    tile_size, depth_scale;
+    GLfloat near_depth, far_depth, tan_x, tan_y;
+    int     max_run;
+
+    std::vector<vec4>      spheres;  // bounds of the lights in eye space, radius in w
+    Slice                  slices[Slices];
+    std::vector<GLuint>    records;  // start, length per cluster
+    std::vector<GLushort>  indices;
+};
+
+#endif // __LIGHTGRID_H__
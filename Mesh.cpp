@@ -0,0 +1,294 @@
+#include "Mesh.h"
+#include <algorithm>
+#include <cmath>
+
+GLuint PackNormal( const vec3& n )
+{
+    // Signed normalized 10 bits per axis, w = 0
+    GLuint packed = 0;
+    for (int i = 0; i < 3; ++i) {
+	float c = n[i] < -1.0f ? -1.0f : (n[i] > 1.0f ? 1.0f : n[i]);
+	int v = int( std::floor( c * 511.0f + 0.5f ) );
+	packed |= (GLuint( v ) & 0x3FF) << (10 * i);
+    }
+    return packed;
+}
+
+void MeshBuilder::Begin()
+{
+    range_first = int(indices.size());
+}
+
+MeshRange MeshBuilder::End()
+{
+    MeshRange r = { range_first, int(indices.size()) - range_first };
+    range_first = int(indices.size());
+    return r;
+}
+
+void MeshBuilder::Add( const vec3& p, const vec3& n )
+{
+    MeshVertex v = { p.x, p.y, p.z, PackNormal( n ) };
+    Key key( std::lround( p.x * 1e5f ), std::lround( p.y * 1e5f ), std::lround( p.z * 1e5f ),
+	     v.normal );
+
+    std::map<Key, GLushort>::iterator it = welded.find( key );
+    if (it != welded.end()) {
+	indices.push_back( it->second );
+	return;
+    }
+
+    if (vertices.size() > 0xFFFF) {
+	if (!overflow)
+	    std::cerr << "MeshBuilder: more than 65536 vertices, 16-bit indices can't address them"
+		      << std::endl;
+	overflow = true;
+	return;
+    }
+
+    GLushort index = GLushort( vertices.size() );
+    vertices.push_back( v );
+    welded[key] = index;
+    indices.push_back( index );
+}
+
+CacheStats MeshBuilder::AnalyzeVertexCache( const MeshRange& r, int cache_size ) const
+{
+    std::vector<int> stamp( vertices.size(), -1 );  // time the vertex entered the cache
+    std::vector<char> used( vertices.size(), 0 );
+    int misses = 0, unique = 0;
+
+    for (int i = r.first; i < r.first + r.count; ++i) {
+	GLushort v = indices[i];
+	if (!used[v]) { used[v] = 1;  ++unique; }
+
+	// FIFO: a hit doesn't refresh the entry, so it is in the cache while
+	// fewer than cache_size misses happened since it entered
+	if (stamp[v] < 0 || misses - stamp[v] >= cache_size) {
+	    stamp[v] = misses;
+	    ++misses;
+	}
+    }
+
+    CacheStats stats = { 0.0f, 0.0f };
+    if (r.count > 0) {
+	stats.acmr = float(misses) / (r.count / 3);
+	stats.atvr = float(misses) / unique;
+    }
+    return stats;
+}
+
+//----------------------------------------------------------------------------
+//
+//  Forsyth, "Linear-Speed Vertex Cache Optimisation": repeatedly emit the
+//  triangle whose vertices score highest, where a vertex scores for being
+//  recently used and for having few triangles left (so fans get finished
+//  instead of leaving stragglers that cost a reload later).
+//
+
+namespace {
+
+const int   ScoreCacheSize = 32;
+const float CacheDecayPower = 1.5f;
+const float LastTriScore = 0.75f;
+const float ValenceBoostScale = 2.0f;
+const float ValenceBoostPower = 0.5f;
+
+float VertexScore( int cache_pos, int live_tris )
+{
+    if (live_tris == 0) return -1.0f;  // nothing left to draw with it
+
+    float score = 0.0f;
+    if (cache_pos >= 0) {
+	if (cache_pos < 3) {
+	    score = LastTriScore;  // used by the last triangle, whichever corner
+	} else {
+	    float scaler = 1.0f / (ScoreCacheSize - 3);
+	    score = std::pow( 1.0f - (cache_pos - 3) * scaler, CacheDecayPower );
+	}
+    }
+    return score + ValenceBoostScale * std::pow( float(live_tris), -ValenceBoostPower );
+}
+
+}  // namespace
+
+void MeshBuilder::OptimizeVertexCache( const MeshRange& r )
+{
+    const int tris = r.count / 3;
+    if (tris == 0) return;
+    GLushort* idx = &indices[r.first];
+    const int nv = int(vertices.size());
+
+    // Triangles around each vertex; the live ones are kept at the front
+    std::vector<int> live( nv, 0 ), first( nv + 1, 0 ), adjacent( r.count );
+    for (int i = 0; i < r.count; ++i) ++live[idx[i]];
+    for (int v = 0; v < nv; ++v) first[v + 1] = first[v] + live[v];
+    {
+	std::vector<int> fill( first.begin(), first.end() - 1 );
+	for (int i = 0; i < r.count; ++i) adjacent[fill[idx[i]]++] = i / 3;
+    }
+
+    std::vector<int>   cache_pos( nv, -1 );
+    std::vector<float> score( nv );
+    for (int v = 0; v < nv; ++v) score[v] = VertexScore( -1, live[v] );
+
+    std::vector<char> emitted( tris, 0 );
+    int best = 0;
+    float best_score = -1.0f;
+    for (int t = 0; t < tris; ++t) {
+	float s = score[idx[3*t]] + score[idx[3*t+1]] + score[idx[3*t+2]];
+	if (s > best_score) { best_score = s;  best = t; }
+    }
+
+    std::vector<GLushort> order;
+    order.reserve( r.count );
+    std::vector<int> cache, next;
+    int scan = 0;  // fallback scan position when the cache has nothing left
+
+    for (int done = 0; done < tris; ++done) {
+	if (best < 0) {
+	    while (emitted[scan]) ++scan;
+	    best = scan;
+	}
+
+	emitted[best] = 1;
+	next.clear();
+	for (int k = 0; k < 3; ++k) {
+	    int v = idx[3*best + k];
+	    order.push_back( GLushort( v ) );
+	    next.push_back( v );
+
+	    // Drop the triangle from v's live list
+	    int* a = &adjacent[first[v]];
+	    for (int j = 0; j < live[v]; ++j) {
+		if (a[j] == best) { std::swap( a[j], a[live[v] - 1] );  break; }
+	    }
+	    --live[v];
+	}
+
+	// Emitted vertices move to the front, the rest shift back
+	for (size_t j = 0; j < cache.size(); ++j) {
+	    int v = cache[j];
+	    if (v != next[0] && v != next[1] && v != next[2]) next.push_back( v );
+	}
+	for (size_t j = 0; j < next.size(); ++j) {
+	    int v = next[j];
+	    cache_pos[v] = j < size_t(ScoreCacheSize) ? int(j) : -1;
+	    score[v] = VertexScore( cache_pos[v], live[v] );
+	}
+	if (next.size() > size_t(ScoreCacheSize)) next.resize( ScoreCacheSize );
+	cache.swap( next );
+
+	// Rescore the triangles the cache touches and pick the best of them
+	best = -1;
+	best_score = -1.0f;
+	for (size_t j = 0; j < cache.size(); ++j) {
+	    int v = cache[j];
+	    for (int k = 0; k < live[v]; ++k) {
+		int t = adjacent[first[v] + k];
+		float s = score[idx[3*t]] + score[idx[3*t+1]] + score[idx[3*t+2]];
+		if (s > best_score) { best_score = s;  best = t; }
+	    }
+	}
+    }
+
+    std::copy( order.begin(), order.end(), idx );
+}
+
+void MeshBuilder::OptimizeOverdraw( const MeshRange& r )
+{
+    const int tris = r.count / 3;
+    if (tris == 0) return;
+    GLushort* idx = &indices[r.first];
+
+    // Clusters start where the cache order restarts cold (all three
+    // vertices miss), so moving them around costs almost no locality
+    std::vector<int> stamp( vertices.size(), -1 );
+    std::vector<int> starts;
+    int misses = 0;
+    for (int t = 0; t < tris; ++t) {
+	int tri_misses = 0;
+	for (int k = 0; k < 3; ++k) {
+	    GLushort v = idx[3*t + k];
+	    if (stamp[v] < 0 || misses - stamp[v] >= CacheSize) {
+		stamp[v] = misses;
+		++misses;
+		++tri_misses;
+	    }
+	}
+	if (t == 0 || tri_misses == 3) starts.push_back( t );
+    }
+    starts.push_back( tris );
+
+    // Area-weighted centroid and normal of each cluster
+    const int clusters = int(starts.size()) - 1;
+    std::vector<vec3>  centroid( clusters, vec3( 0.0 ) ), normal( clusters, vec3( 0.0 ) );
+    std::vector<float> area( clusters, 0.0f );
+    vec3  mesh_center( 0.0 );
+    float mesh_area = 0.0f;
+
+    for (int c = 0; c < clusters; ++c) {
+	for (int t = starts[c]; t < starts[c + 1]; ++t) {
+	    const MeshVertex& a = vertices[idx[3*t]];
+	    const MeshVertex& b = vertices[idx[3*t+1]];
+	    const MeshVertex& d = vertices[idx[3*t+2]];
+	    vec3 p0( a.x, a.y, a.z ), p1( b.x, b.y, b.z ), p2( d.x, d.y, d.z );
+	    vec3 n = cross( p1 - p0, p2 - p0 );
+	    float w = length( n ) * 0.5f;
+	    centroid[c] += w * (p0 + p1 + p2) / 3.0f;
+	    normal[c] += n;
+	    area[c] += w;
+	}
+	mesh_center += centroid[c];
+	mesh_area += area[c];
+	if (area[c] > 0.0f) centroid[c] /= area[c];
+    }
+    if (mesh_area > 0.0f) mesh_center /= mesh_area;
+
+    // Clusters facing furthest out from the center are the likeliest
+    // occluders, so they go first
+    std::vector<float> key( clusters, 0.0f );
+    std::vector<int>   order( clusters );
+    for (int c = 0; c < clusters; ++c) {
+	float len = length( normal[c] );
+	if (len > 0.0f) key[c] = dot( centroid[c] - mesh_center, normal[c] / len );
+	order[c] = c;
+    }
+    std::stable_sort( order.begin(), order.end(),
+		      [&]( int a, int b ) { return key[a] > key[b]; } );
+
+    std::vector<GLushort> sorted;
+    sorted.reserve( r.count );
+    for (int c = 0; c < clusters; ++c) {
+	int k = order[c];
+	sorted.insert( sorted.end(), idx + 3*starts[k], idx + 3*starts[k + 1] );
+    }
+    std::copy( sorted.begin(), sorted.end(), idx );
+}
+
+void MeshBuilder::OptimizeVertexFetch()
+{
+    // New numbering in order of first use, unused vertices last
+    const int nv = int(vertices.size());
+    std::vector<int> remap( nv, -1 );
+    std::vector<MeshVertex> reordered;
+    reordered.reserve( nv );
+
+    for (size_t i = 0; i < indices.size(); ++i) {
+	GLushort v = indices[i];
+	if (remap[v] < 0) {
+	    remap[v] = int(reordered.size());
+	    reordered.push_back( vertices[v] );
+	}
+	indices[i] = GLushort( remap[v] );
+    }
+    for (int v = 0; v < nv; ++v) {
+	if (remap[v] >= 0) continue;
+	remap[v] = int(reordered.size());
+	reordered.push_back( vertices[v] );
+    }
+
+    vertices.swap( reordered );
+    for (std::map<Key, GLushort>::iterator it = welded.begin(); it != welded.end(); ++it)
+	it->second = GLushort( remap[it->second] );
+}
@@ -0,0 +1,85 @@
+#ifndef __MESH_H__
+#define __MESH_H__
+
+#include "Angel.h"
+#include <map>
+#include <tuple>
+#include <vector>
+
+//----------------------------------------------------------------------------
+//
+//  MeshVertex - 16 bytes: position without w (the shader's vPosition
+//    defaults it to 1) and the normal packed as GL_INT_2_10_10_10_REV
+//
+
+struct MeshVertex {
+    GLfloat  x, y, z;
+    GLuint   normal;
+};
+
+GLuint PackNormal( const vec3& n );
+
+//  A primitive's slice of the index buffer
+struct MeshRange {
+    int  first;  // first index
+    int  count;  // number of indices (3 per triangle)
+};
+
+//  Post-transform cache behaviour of a range under a FIFO cache
+struct CacheStats {
+    float  acmr;  // vertices transformed per triangle (0.5 is ideal, 3 is none)
+    float  atvr;  // vertices transformed per vertex used (1 is ideal)
+};
+
+//----------------------------------------------------------------------------
+//
+//  MeshBuilder - welds triangle-list corners into an indexed mesh
+//
+//    Generators emit the corners of their triangles with Add() exactly as
+//    they would fill a triangle soup.  Corners with the same position (to
+//    1e-5) and the same packed normal become one vertex, so a smooth
+//    cylinder side shares every vertex between its neighbouring quads and
+//    a cube keeps only its 4 corners per face.  Indices are 16-bit, which
+//    caps the whole buffer at 65536 vertices.
+//
+//    Once every primitive is built the mesh is reordered in three passes:
+//    OptimizeVertexCache() (Forsyth's greedy triangle order) on each range,
+//    then OptimizeOverdraw() on each range, which moves whole clusters of
+//    that order so outward-facing ones come first without breaking their
+//    cache locality, and finally OptimizeVertexFetch() over the whole
+//    buffer, which renumbers vertices in first-use order.
+//
+
+class MeshBuilder {
+public:
+    MeshBuilder() : overflow(false), range_first(0) {}
+
+    void      Begin();  // start a primitive's index range
+    MeshRange End();
+
+    void      Add( const vec3& position, const vec3& normal );
+
+    bool      Ok() const { return !overflow; }
+
+    enum { CacheSize = 16 };  // FIFO entries assumed by the analysis
+
+    CacheStats AnalyzeVertexCache( const MeshRange& r, int cache_size = CacheSize ) const;
+
+    void      OptimizeVertexCache( const MeshRange& r );
+    void      OptimizeOverdraw( const MeshRange& r );
+    void      OptimizeVertexFetch();
+
+    const std::vector<MeshVertex>& Vertices() const { return vertices; }
+    const std::vector<GLushort>&   Indices() const  { return indices; }
+
+private:
+    typedef std::tuple<long, long, long, GLuint>  Key;
+
+    std::vector<MeshVertex>  vertices;
+    std::vector<GLushort>    indices;
+    std::map<Key, GLushort>  welded;
+    bool                     overflow;
+    int                      range_first;
+};
+
+#endif // __MESH_H__
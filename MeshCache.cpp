@@ -0,0 +1,180 @@
+#include "MeshCache.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char Magic[8] = { 'T', 'O', 'Y', 'M', 'E', 'S', 'H', 0 };
+const size_t BlobAlign = 64;
+
+struct Header {
+    char      magic[8];
+    unsigned  version;
+    unsigned  key;
+    unsigned  vertex_count, index_count, range_count;
+    unsigned  vertex_offset, index_offset, range_offset;  // from the start of the file
+    unsigned  checksum;  // of everything after the header
+    unsigned  reserved[5];
+};
+
+static_assert( sizeof(Header) == 64, "mesh cache header must stay 64 bytes" );
+static_assert( sizeof(MeshVertex) == 16 && sizeof(MeshRange) == 8,
+	       "mesh cache blobs are stored as laid out in memory" );
+
+size_t Align( size_t n ) { return (n + BlobAlign - 1) & ~(BlobAlign - 1); }
+
+}  // namespace
+
+unsigned Fnv1a( const void* data, size_t size, unsigned hash )
+{
+    const unsigned char* p = (const unsigned char*) data;
+    for (size_t i = 0; i < size; ++i) {
+	hash ^= p[i];
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+MeshCache::MeshCache() :
+    data(NULL), size(0), file(NULL), mapping(NULL),
+    vertices(NULL), indices(NULL), ranges(NULL),
+    vertex_count(0), index_count(0), range_count(0) {}
+
+bool MeshCache::Open( const char* path, unsigned key )
+{
+    Close();
+
+#if defined(_WIN32)
+    HANDLE f = CreateFileA( path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			    FILE_ATTRIBUTE_NORMAL, NULL );
+    if (f == INVALID_HANDLE_VALUE) return false;
+    file = f;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx( f, &file_size ) || file_size.QuadPart < LONGLONG(sizeof(Header))) {
+	Close();
+	return false;
+    }
+    size = size_t( file_size.QuadPart );
+    mapping = CreateFileMappingA( f, NULL, PAGE_READONLY, 0, 0, NULL );
+    if (mapping) data = (const unsigned char*) MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+#else
+    int fd = open( path, O_RDONLY );
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat( fd, &st ) != 0 || st.st_size < off_t(sizeof(Header))) {
+	close( fd );
+	return false;
+    }
+    size = size_t( st.st_size );
+    void* p = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );  // the mapping keeps the file alive
+    if (p != MAP_FAILED) data = (const unsigned char*) p;
+#endif
+
+    if (!data) {
+	std::cerr << "MeshCache: can't map " << path << std::endl;
+	Close();
+	return false;
+    }
+
+    // Everything must agree before any of the blobs is trusted
+    const Header& h = *(const Header*) data;
+    size_t vertex_end = size_t(h.vertex_offset) + size_t(h.vertex_count) * sizeof(MeshVertex);
+    size_t index_end = size_t(h.index_offset) + size_t(h.index_count) * sizeof(GLushort);
+    size_t range_end = size_t(h.range_offset) + size_t(h.range_count) * sizeof(MeshRange);
+
+    const char* stale = NULL;
+    if (memcmp( h.magic, Magic, sizeof(Magic) ) != 0)   stale = "not a mesh cache";
+    else if (h.version != Version)                      stale = "old format version";
+    else if (h.key != key)                              stale = "generated with other parameters";
+    else if (vertex_end > size || index_end > size || range_end > size ||
+	     h.vertex_offset % BlobAlign || h.index_offset % BlobAlign ||
+	     h.range_offset % BlobAlign)                stale = "truncated";
+    else if (Fnv1a( data + sizeof(Header), size - sizeof(Header) ) != h.checksum)
+							stale = "checksum mismatch";
+    if (stale) {
+	std::cout << "MeshCache: " << path << " ignored (" << stale << ")" << std::endl;
+	Close();
+	return false;
+    }
+
+    vertices = (const MeshVertex*) (data + h.vertex_offset);
+    indices = (const GLushort*) (data + h.index_offset);
+    ranges = (const MeshRange*) (data + h.range_offset);
+    vertex_count = int(h.vertex_count);
+    index_count = int(h.index_count);
+    range_count = int(h.range_count);
+    return true;
+}
+
+void MeshCache::Close()
+{
+#if defined(_WIN32)
+    if (data) UnmapViewOfFile( data );
+    if (mapping) CloseHandle( (HANDLE) mapping );
+    if (file) CloseHandle( (HANDLE) file );
+#else
+    if (data) munmap( (void*) data, size );
+#endif
+    data = NULL;  size = 0;  file = NULL;  mapping = NULL;
+    vertices = NULL;  indices = NULL;  ranges = NULL;
+    vertex_count = index_count = range_count = 0;
+}
+
+bool MeshCache::Write( const char* path, unsigned key,
+		       const std::vector<MeshVertex>& vertex_blob,
+		       const std::vector<GLushort>& index_blob,
+		       const MeshRange* range_blob, int count )
+{
+    Header h;
+    memset( &h, 0, sizeof(h) );
+    memcpy( h.magic, Magic, sizeof(Magic) );
+    h.version = Version;
+    h.key = key;
+    h.vertex_count = unsigned(vertex_blob.size());
+    h.index_count = unsigned(index_blob.size());
+    h.range_count = unsigned(count);
+    h.vertex_offset = unsigned(sizeof(Header));
+    h.index_offset = unsigned(Align( h.vertex_offset + vertex_blob.size() * sizeof(MeshVertex) ));
+    h.range_offset = unsigned(Align( h.index_offset + index_blob.size() * sizeof(GLushort) ));
+
+    // Lay the whole file out in memory so the checksum covers the padding too
+    std::vector<unsigned char> file_data( h.range_offset + count * sizeof(MeshRange), 0 );
+    if (!vertex_blob.empty())
+	memcpy( &file_data[h.vertex_offset], &vertex_blob[0], vertex_blob.size() * sizeof(MeshVertex) );
+    if (!index_blob.empty())
+	memcpy( &file_data[h.index_offset], &index_blob[0], index_blob.size() * sizeof(GLushort) );
+    if (count > 0)
+	memcpy( &file_data[h.range_offset], range_blob, count * sizeof(MeshRange) );
+    h.checksum = Fnv1a( &file_data[sizeof(Header)], file_data.size() - sizeof(Header) );
+    memcpy( &file_data[0], &h, sizeof(Header) );
+
+    // Write beside the target and rename, so a crash never leaves half a file
+    std::string tmp = std::string( path ) + ".tmp";
+    FILE* f = fopen( tmp.c_str(), "wb" );
+    if (!f) {
+	std::cerr << "MeshCache: can't write " << tmp << std::endl;
+	return false;
+    }
+    bool ok = fwrite( &file_data[0], 1, file_data.size(), f ) == file_data.size();
+    ok = (fclose( f ) == 0) && ok;
+#if defined(_WIN32)
+    if (ok) remove( path );  // rename() doesn't replace on Windows
+#endif
+    if (!ok || rename( tmp.c_str(), path ) != 0) {
+	std::cerr << "MeshCache: can't write " << path << std::endl;
+	remove( tmp.c_str() );
+	return false;
+    }
+    return true;
+}
@@ -0,0 +1,62 @@
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+#include "Mesh.h"
+#include <cstddef>
+#include <vector>
+
+//----------------------------------------------------------------------------
+//
+//  MeshCache - generated geometry saved in a memory-mappable file
+//
+//    The file is a 64-byte header followed by the vertex, index and range
+//    blobs, each starting on a 64-byte boundary, so once it is mapped the
+//    blobs go straight to glBufferData without a copy.
+//
+//    The header carries the format version, the caller's key (a hash of
+//    whatever parameters generated the meshes) and a checksum of the
+//    blobs.  Open() refuses a file whose version, key or checksum doesn't
+//    match, and the caller regenerates and writes a new one.
+//
+
+unsigned Fnv1a( const void* data, size_t size, unsigned hash = 2166136261u );
+
+class MeshCache {
+public:
+    enum { Version = 1 };
+
+    MeshCache();
+    ~MeshCache() { Close(); }
+
+    bool Open( const char* path, unsigned key );
+    void Close();
+
+    static bool Write( const char* path, unsigned key,
+		       const std::vector<MeshVertex>& vertices,
+		       const std::vector<GLushort>& indices,
+		       const MeshRange* ranges, int range_count );
+
+    //  Valid between a successful Open() and Close()
+    const MeshVertex* Vertices() const { return vertices; }
+    const GLushort*   Indices() const  { return indices; }
+    const MeshRange*  Ranges() const   { return ranges; }
+    int  VertexCount() const { return vertex_count; }
+    int  IndexCount() const  { return index_count; }
+    int  RangeCount() const  { return range_count; }
+
+private:
+    MeshCache( const MeshCache& );
+    MeshCache& operator = ( const MeshCache& );
+
+    const unsigned char* data;  // the whole mapped file
+    size_t               size;
+    void*                file;     // platform handles
+    void*                mapping;
+
+    const MeshVertex*    vertices;
+    const GLushort*      indices;
+    const MeshRange*     ranges;
+    int                  vertex_count, index_count, range_count;
+};
+
+#endif // __MESHCACHE_H__
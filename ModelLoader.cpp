@@ -0,0 +1,603 @@
+#include "ModelLoader.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+//  Triangle corners before welding, three per triangle
+struct Soup {
+    std::vector<vec3>  positions;
+    std::vector<vec3>  normals;
+};
+
+//  Whole file plus a NUL, so the text parsers can't run off the end
+bool ReadFile( const char* path, std::vector<char>& data )
+{
+    FILE* f = fopen( path, "rb" );
+    if (!f) return false;
+    fseek( f, 0, SEEK_END );
+    long size = ftell( f );
+    fseek( f, 0, SEEK_SET );
+    bool ok = size >= 0;
+    if (ok) {
+	data.resize( size_t(size) + 1 );
+	ok = fread( &data[0], 1, size_t(size), f ) == size_t(size);
+	data[size] = 0;
+    }
+    fclose( f );
+    return ok;
+}
+
+//  Append one triangle; without normals (or with a zero one) the corners
+//  get the face normal.  Zero-area triangles are dropped.
+void AddTriangle( Soup& soup, const vec3* p, const vec3* n )
+{
+    vec3 face = cross( p[1] - p[0], p[2] - p[0] );
+    float area = length( face );
+    if (!(area > 0.0f)) return;
+    face /= area;
+
+    for (int k = 0; k < 3; ++k) {
+	soup.positions.push_back( p[k] );
+	soup.normals.push_back( n && length( n[k] ) > 0.0f ? normalize( n[k] ) : face );
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+//  Wavefront OBJ
+//
+
+bool IsBlank( char c ) { return c == ' ' || c == '\t' || c == '\r'; }
+
+//  n floats from [q, end); strtof would happily skip to the next line
+bool ReadFloats( const char*& q, const char* end, float* out, int n )
+{
+    for (int i = 0; i < n; ++i) {
+	while (q < end && IsBlank( *q )) ++q;
+	char* next;
+	out[i] = strtof( q, &next );
+	if (next == q || next > end) return false;
+	q = next;
+    }
+    return true;
+}
+
+//  1-based OBJ index, or negative from the last one read so far
+bool ObjIndex( long i, size_t count, size_t* out )
+{
+    if (i > 0 && size_t(i) <= count)  { *out = size_t(i) - 1;  return true; }
+    if (i < 0 && size_t(-i) <= count) { *out = count - size_t(-i);  return true; }
+    return false;
+}
+
+bool ParseObj( const char* text, Soup& soup, std::string& error )
+{
+    std::vector<vec3>   v, vn;
+    std::vector<size_t> corner_v, corner_n;  // one polygon; corner_n empty if any is missing
+    char where[32];
+
+    for (int line = 1; *text; ++line) {
+	const char* end = text + strcspn( text, "\n" );
+	const char* q = text;
+	text = *end ? end + 1 : end;
+	snprintf( where, sizeof(where), "line %d: ", line );
+
+	while (q < end && IsBlank( *q )) ++q;
+	if (end - q < 2 || !IsBlank( q[q[0] == 'v' && q[1] == 'n' ? 2 : 1] )) continue;
+
+	if (q[0] == 'v' && q[1] == 'n') {
+	    q += 2;
+	    float n[3];
+	    if (!ReadFloats( q, end, n, 3 )) { error = std::string( where ) + "bad normal";  return false; }
+	    vn.push_back( vec3( n[0], n[1], n[2] ) );
+	} else if (q[0] == 'v') {
+	    q += 1;
+	    float p[3];
+	    if (!ReadFloats( q, end, p, 3 )) { error = std::string( where ) + "bad vertex";  return false; }
+	    v.push_back( vec3( p[0], p[1], p[2] ) );
+	} else if (q[0] == 'f') {
+	    q += 1;
+	    corner_v.clear();
+	    corner_n.clear();
+	    bool normals = true;
+	    for (;;) {
+		while (q < end && IsBlank( *q )) ++q;
+		if (q >= end) break;
+
+		// v, v/vt, v//vn or v/vt/vn
+		char* next;
+		long vi = strtol( q, &next, 10 ), ni = 0;
+		if (next == q) { error = std::string( where ) + "bad face";  return false; }
+		q = next;
+		if (q < end && *q == '/') {
+		    ++q;
+		    if (q < end && *q != '/') { strtol( q, &next, 10 );  q = next; }  // texture coordinate
+		    if (q < end && *q == '/') { ++q;  ni = strtol( q, &next, 10 );  q = next; }
+		}
+
+		size_t i, n;
+		if (!ObjIndex( vi, v.size(), &i )) { error = std::string( where ) + "vertex index out of range";  return false; }
+		corner_v.push_back( i );
+		if (ni && !ObjIndex( ni, vn.size(), &n )) { error = std::string( where ) + "normal index out of range";  return false; }
+		if (!ni) normals = false;
+		else corner_n.push_back( n );
+	    }
+	    if (corner_v.size() < 3) { error = std::string( where ) + "face with fewer than 3 corners";  return false; }
+
+	    // Fan out from the first corner
+	    for (size_t k = 1; k + 1 < corner_v.size(); ++k) {
+		size_t c[3] = { 0, k, k + 1 };
+		vec3 p[3], n[3];
+		for (int j = 0; j < 3; ++j) {
+		    p[j] = v[corner_v[c[j]]];
+		    if (normals) n[j] = vn[corner_n[c[j]]];
+		}
+		AddTriangle( soup, p, normals ? n : NULL );
+	    }
+	}
+	// vt, o, g, s, usemtl, mtllib, l, p: nothing to draw from
+    }
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//
+//  JSON, just enough for a glTF header
+//
+
+struct Json {
+    enum Type { Null, Boolean, Numeric, Text, Array, Object };
+
+    Type                      type;
+    double                    number;  // Numeric; Boolean is 0 or 1
+    std::string               text;    // Text
+    std::vector<Json>         items;   // Array elements or Object values
+    std::vector<std::string>  keys;    // Object keys, same order as items
+
+    Json() : type(Null), number(0.0) {}
+
+    //  Missing keys and indices give a Null, so lookups chain safely
+    const Json& operator [] ( const char* key ) const;
+    const Json& operator [] ( int i ) const;
+
+    int    Size() const { return type == Array ? int(items.size()) : 0; }
+    double Num( double fallback ) const { return type == Numeric ? number : fallback; }
+    int    Int( int fallback ) const { return type == Numeric ? int(number) : fallback; }
+};
+
+const Json& NullJson()
+{
+    static const Json null;
+    return null;
+}
+
+const Json& Json::operator [] ( const char* key ) const
+{
+    if (type == Object)
+	for (size_t i = 0; i < keys.size(); ++i)
+	    if (keys[i] == key) return items[i];
+    return NullJson();
+}
+
+const Json& Json::operator [] ( int i ) const
+{
+    return (type == Array && i >= 0 && i < int(items.size())) ? items[i] : NullJson();
+}
+
+class JsonParser {
+public:
+    JsonParser( const char* begin, const char* end ) : p(begin), end(end) {}
+
+    bool Parse( Json& out ) { return Value( out, 0 ) && (Skip(), p == end); }
+
+private:
+    void Skip() { while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) ++p; }
+
+    bool Literal( const char* word ) {
+	size_t n = strlen( word );
+	if (size_t(end - p) < n || strncmp( p, word, n ) != 0) return false;
+	p += n;
+	return true;
+    }
+
+    bool String( std::string& s );
+    bool Value( Json& v, int depth );
+
+    const char*  p;
+    const char*  end;
+};
+
+bool JsonParser::String( std::string& s )
+{
+    if (p >= end || *p != '"') return false;
+    for (++p; p < end && *p != '"'; ) {
+	char c = *p++;
+	if (c == '\\') {
+	    if (p >= end) return false;
+	    switch (c = *p++) {
+		case 'b': c = '\b'; break;
+		case 'f': c = '\f'; break;
+		case 'n': c = '\n'; break;
+		case 'r': c = '\r'; break;
+		case 't': c = '\t'; break;
+		case 'u':  // glTF's own keys are ASCII
+		    if (end - p < 4) return false;
+		    p += 4;
+		    c = '?';
+		    break;
+	    }
+	}
+	s += c;
+    }
+    if (p >= end) return false;
+    ++p;
+    return true;
+}
+
+bool JsonParser::Value( Json& v, int depth )
+{
+    Skip();
+    if (p >= end || depth > 64) return false;
+
+    switch (*p) {
+	case '{':
+	case '[': {
+	    bool object = *p++ == '{';
+	    char close = object ? '}' : ']';
+	    v.type = object ? Json::Object : Json::Array;
+	    Skip();
+	    if (p < end && *p == close) { ++p;  return true; }
+	    for (;;) {
+		if (object) {
+		    Skip();
+		    v.keys.push_back( std::string() );
+		    if (!String( v.keys.back() )) return false;
+		    Skip();
+		    if (p >= end || *p++ != ':') return false;
+		}
+		v.items.push_back( Json() );
+		if (!Value( v.items.back(), depth + 1 )) return false;
+		Skip();
+		if (p < end && *p == ',') { ++p;  continue; }
+		if (p < end && *p == close) { ++p;  return true; }
+		return false;
+	    }
+	}
+	case '"':
+	    v.type = Json::Text;
+	    return String( v.text );
+	case 't':
+	    v.type = Json::Boolean;  v.number = 1.0;
+	    return Literal( "true" );
+	case 'f':
+	    v.type = Json::Boolean;
+	    return Literal( "false" );
+	case 'n':
+	    return Literal( "null" );
+	default: {
+	    // strtod wants a terminated string and the chunk isn't one
+	    char number[64];
+	    size_t n = 0;
+	    while (p + n < end && n + 1 < sizeof(number) && strchr( "+-0123456789.eE", p[n] )) {
+		number[n] = p[n];
+		++n;
+	    }
+	    number[n] = 0;
+	    char* stop;
+	    v.type = Json::Numeric;
+	    v.number = strtod( number, &stop );
+	    if (n == 0 || stop != number + n) return false;
+	    p += n;
+	    return true;
+	}
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+//  Binary glTF 2.0
+//
+
+enum {
+    GlbMagic = 0x46546C67,  // "glTF"
+    ChunkJson = 0x4E4F534A,
+    ChunkBin = 0x004E4942,
+    ComponentUnsignedByte = 5121,
+    ComponentUnsignedShort = 5123,
+    ComponentUnsignedInt = 5125,
+    ComponentFloat = 5126,
+    ModeTriangles = 4
+};
+
+unsigned U32( const unsigned char* p )
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (unsigned( p[3] ) << 24);
+}
+
+struct Gltf {
+    Json                  json;
+    const unsigned char*  bin;
+    size_t                bin_size;
+};
+
+//  An accessor's elements, checked to lie inside the binary chunk
+struct Accessor {
+    const unsigned char*  data;
+    size_t                stride, count;
+    int                   component, width;
+};
+
+bool GetAccessor( const Gltf& g, int index, Accessor& a, std::string& error )
+{
+    const Json& acc = g.json["accessors"][index];
+    if (acc.type != Json::Object) { error = "missing accessor";  return false; }
+    if (acc["sparse"].type != Json::Null) { error = "sparse accessors are not supported";  return false; }
+
+    const Json& view = g.json["bufferViews"][acc["bufferView"].Int( -1 )];
+    if (view.type != Json::Object) { error = "accessor without a buffer view";  return false; }
+    if (view["buffer"].Int( 0 ) != 0 || !g.bin) {
+	error = "only the .glb's embedded buffer is supported";
+	return false;
+    }
+
+    a.component = acc["componentType"].Int( 0 );
+    const std::string& type = acc["type"].text;
+    a.width = type == "SCALAR" ? 1 : (type == "VEC3" ? 3 : 0);
+    size_t component_size = 0;
+    switch (a.component) {
+	case ComponentUnsignedByte:  component_size = 1; break;
+	case ComponentUnsignedShort: component_size = 2; break;
+	case ComponentUnsignedInt:
+	case ComponentFloat:         component_size = 4; break;
+    }
+    if (!a.width || !component_size) { error = "unsupported accessor type " + type;  return false; }
+
+    size_t element = a.width * component_size;
+    double view_offset = view["byteOffset"].Num( 0.0 ), view_length = view["byteLength"].Num( 0.0 );
+    double offset = acc["byteOffset"].Num( 0.0 ), count = acc["count"].Num( 0.0 );
+    a.stride = size_t( view["byteStride"].Num( 0.0 ) );
+    if (a.stride == 0) a.stride = element;
+
+    // In doubles, so hostile sizes can't wrap around
+    if (view_offset < 0 || view_length < 0 || offset < 0 || count < 0 ||
+	view_offset + view_length > double( g.bin_size ) ||
+	(count > 0 && offset + (count - 1) * a.stride + element > view_length)) {
+	error = "accessor outside the buffer";
+	return false;
+    }
+    a.data = g.bin + size_t( view_offset ) + size_t( offset );
+    a.count = size_t( count );
+    return true;
+}
+
+vec3 ReadVec3( const Accessor& a, size_t i )
+{
+    float f[3];
+    memcpy( f, a.data + i * a.stride, sizeof(f) );
+    return vec3( f[0], f[1], f[2] );
+}
+
+size_t ReadIndex( const Accessor& a, size_t i )
+{
+    const unsigned char* p = a.data + i * a.stride;
+    switch (a.component) {
+	case ComponentUnsignedByte:  return p[0];
+	case ComponentUnsignedShort: return p[0] | (p[1] << 8);
+	default:                     return U32( p );
+    }
+}
+
+//  Node's local transform from its matrix or translation/rotation/scale
+affine NodeTransform( const Json& node )
+{
+    affine m;
+    const Json& matrix = node["matrix"];
+    if (matrix.Size() == 16) {
+	for (int r = 0; r < 3; ++r)
+	    for (int c = 0; c < 4; ++c)
+		m[r][c] = matrix[c*4 + r].Num( 0.0 );  // column-major
+	return m;
+    }
+
+    const Json& t = node["translation"];
+    const Json& q = node["rotation"];
+    const Json& s = node["scale"];
+    float x = q[0].Num( 0.0 ), y = q[1].Num( 0.0 ), z = q[2].Num( 0.0 ), w = q[3].Num( 1.0 );
+    float rotation[3][3] = {
+	{ 1 - 2*(y*y + z*z), 2*(x*y - z*w),     2*(x*z + y*w) },
+	{ 2*(x*y + z*w),     1 - 2*(x*x + z*z), 2*(y*z - x*w) },
+	{ 2*(x*z - y*w),     2*(y*z + x*w),     1 - 2*(x*x + y*y) }
+    };
+    for (int r = 0; r < 3; ++r) {
+	for (int c = 0; c < 3; ++c) m[r][c] = rotation[r][c] * s[c].Num( 1.0 );
+	m[r].w = t[r].Num( 0.0 );
+    }
+    return m;
+}
+
+bool AddPrimitive( const Gltf& g, const Json& prim, const affine& m, Soup& soup, std::string& error )
+{
+    if (prim["mode"].Int( ModeTriangles ) != ModeTriangles) return true;  // points, lines and strips
+
+    const Json& attributes = prim["attributes"];
+    Accessor position, normal, index;
+    if (!GetAccessor( g, attributes["POSITION"].Int( -1 ), position, error )) return false;
+    if (position.component != ComponentFloat || position.width != 3) {
+	error = "POSITION must be float VEC3";
+	return false;
+    }
+
+    bool normals = attributes["NORMAL"].type != Json::Null;
+    if (normals) {
+	if (!GetAccessor( g, attributes["NORMAL"].Int( -1 ), normal, error )) return false;
+	if (normal.component != ComponentFloat || normal.width != 3 || normal.count != position.count) {
+	    error = "NORMAL must be float VEC3, one per POSITION";
+	    return false;
+	}
+    }
+
+    bool indexed = prim["indices"].type != Json::Null;
+    if (indexed) {
+	if (!GetAccessor( g, prim["indices"].Int( -1 ), index, error )) return false;
+	if (index.width != 1 || index.component == ComponentFloat) {
+	    error = "indices must be unsigned integers";
+	    return false;
+	}
+    }
+
+    // Normals transform by the inverse transpose, which is the cofactor
+    // matrix over the determinant; a negative one also flips the winding
+    vec3 r0( m[0].x, m[0].y, m[0].z ), r1( m[1].x, m[1].y, m[1].z ), r2( m[2].x, m[2].y, m[2].z );
+    vec3 c0 = cross( r1, r2 ), c1 = cross( r2, r0 ), c2 = cross( r0, r1 );
+    float det = dot( r0, c0 ), sign = det < 0.0f ? -1.0f : 1.0f;
+
+    size_t corners = indexed ? index.count : position.count;
+    for (size_t t = 0; t + 3 <= corners; t += 3) {
+	vec3 p[3], n[3];
+	for (int k = 0; k < 3; ++k) {
+	    size_t i = indexed ? ReadIndex( index, t + k ) : t + k;
+	    if (i >= position.count) { error = "index out of range";  return false; }
+	    vec4 world = m * vec4( ReadVec3( position, i ), 1.0 );
+	    p[k] = vec3( world.x, world.y, world.z );
+	    if (normals) {
+		vec3 v = ReadVec3( normal, i );
+		n[k] = sign * vec3( dot( c0, v ), dot( c1, v ), dot( c2, v ) );
+	    }
+	}
+	if (det < 0.0f) {
+	    std::swap( p[1], p[2] );
+	    std::swap( n[1], n[2] );
+	}
+	AddTriangle( soup, p, normals ? n : NULL );
+    }
+    return true;
+}
+
+bool AddMesh( const Gltf& g, int index, const affine& m, Soup& soup, std::string& error )
+{
+    const Json& primitives = g.json["meshes"][index]["primitives"];
+    for (int i = 0; i < primitives.Size(); ++i)
+	if (!AddPrimitive( g, primitives[i], m, soup, error )) return false;
+    return true;
+}
+
+bool AddNode( const Gltf& g, int index, const affine& parent, int depth, Soup& soup, std::string& error )
+{
+    const Json& node = g.json["nodes"][index];
+    if (node.type != Json::Object || depth > 64) { error = "bad node hierarchy";  return false; }
+
+    affine m = parent * NodeTransform( node );
+    if (node["mesh"].type != Json::Null && !AddMesh( g, node["mesh"].Int( -1 ), m, soup, error ))
+	return false;
+
+    const Json& children = node["children"];
+    for (int i = 0; i < children.Size(); ++i)
+	if (!AddNode( g, children[i].Int( -1 ), m, depth + 1, soup, error )) return false;
+    return true;
+}
+
+bool ParseGlb( const std::vector<char>& file, Soup& soup, std::string& error )
+{
+    const unsigned char* data = (const unsigned char*) &file[0];
+    size_t size = file.size() - 1;  // without ReadFile's NUL
+    if (size < 12 || U32( data ) != GlbMagic) { error = "not a binary glTF file";  return false; }
+    if (U32( data + 4 ) != 2) { error = "only glTF 2.0 is supported";  return false; }
+    size = std::min( size, size_t( U32( data + 8 ) ) );
+
+    const char* json = NULL;
+    size_t json_size = 0;
+    Gltf g;
+    g.bin = NULL;
+    g.bin_size = 0;
+    for (size_t at = 12; at + 8 <= size; ) {
+	size_t length = U32( data + at );
+	unsigned type = U32( data + at + 4 );
+	if (length > size - at - 8) { error = "truncated chunk";  return false; }
+	if (type == ChunkJson && !json) {
+	    json = (const char*) data + at + 8;
+	    json_size = length;
+	} else if (type == ChunkBin && !g.bin) {
+	    g.bin = data + at + 8;
+	    g.bin_size = length;
+	}
+	at += 8 + ((length + 3) & ~size_t( 3 ));
+    }
+    if (!json) { error = "no JSON chunk";  return false; }
+    if (!JsonParser( json, json + json_size ).Parse( g.json )) { error = "malformed JSON chunk";  return false; }
+
+    // The default scene's node trees, or every mesh as-is if there are no scenes
+    const Json& scenes = g.json["scenes"];
+    if (scenes.Size() == 0) {
+	for (int i = 0; i < g.json["meshes"].Size(); ++i)
+	    if (!AddMesh( g, i, affine(), soup, error )) return false;
+	return true;
+    }
+    const Json& roots = scenes[g.json["scene"].Int( 0 )]["nodes"];
+    for (int i = 0; i < roots.Size(); ++i)
+	if (!AddNode( g, roots[i].Int( -1 ), affine(), 0, soup, error )) return false;
+    return true;
+}
+
+bool HasExtension( const char* path, const char* ext )
+{
+    size_t n = strlen( path ), e = strlen( ext );
+    if (n < e) return false;
+    for (size_t i = 0; i < e; ++i)
+	if (tolower( (unsigned char) path[n - e + i] ) != ext[i]) return false;
+    return true;
+}
+
+}  // namespace
+
+bool LoadModel( const char* path, MeshBuilder& mesh, std::string& error )
+{
+    std::vector<char> file;
+    if (!ReadFile( path, file )) {
+	error = "can't read the file";
+	return false;
+    }
+
+    Soup soup;
+    bool ok;
+    if (HasExtension( path, ".obj" ))      ok = ParseObj( &file[0], soup, error );
+    else if (HasExtension( path, ".glb" )) ok = ParseGlb( file, soup, error );
+    else {
+	error = "unknown format, expected .obj or .glb";
+	return false;
+    }
+    if (!ok) return false;
+    if (soup.positions.empty()) {
+	error = "no triangles";
+	return false;
+    }
+
+    // Into the unit box the built-in primitives use
+    vec3 lo = soup.positions[0], hi = lo;
+    for (size_t i = 1; i < soup.positions.size(); ++i) {
+	const vec3& p = soup.positions[i];
+	lo = vec3( std::min( lo.x, p.x ), std::min( lo.y, p.y ), std::min( lo.z, p.z ) );
+	hi = vec3( std::max( hi.x, p.x ), std::max( hi.y, p.y ), std::max( hi.z, p.z ) );
+    }
+    vec3 center = 0.5f * (lo + hi), extent = hi - lo;
+    float scale = 1.0f / std::max( extent.x, std::max( extent.y, extent.z ) );
+
+    mesh.Begin();
+    for (size_t i = 0; i < soup.positions.size(); ++i)
+	mesh.Add( (soup.positions[i] - center) * scale, soup.normals[i] );
+    MeshRange range = mesh.End();
+    if (!mesh.Ok()) {
+	error = "more than 65536 distinct vertices";
+	return false;
+    }
+
+    mesh.OptimizeVertexCache( range );
+    mesh.OptimizeOverdraw( range );
+    mesh.OptimizeVertexFetch();
+    return true;
+}
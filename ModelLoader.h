@@ -0,0 +1,30 @@
+#ifndef __MODELLOADER_H__
+#define __MODELLOADER_H__
+
+#include "Mesh.h"
+#include <string>
+
+//----------------------------------------------------------------------------
+//
+//  LoadModel - import a Wavefront OBJ or binary glTF (.glb) file
+//
+//    The file's triangles are welded into mesh as one range (Begin/End)
+//    and reordered with the same cache, overdraw and fetch passes as the
+//    built-in primitives.  Positions are recentred and scaled so the
+//    longest side of the model is 1, like the unit cube, cylinder and cone
+//    the Build functions place, so a model is positioned and sized with
+//    the same translate()/scale() as any other part.
+//
+//    OBJ: v, vn and f records (polygons are fanned, indices may be
+//    negative); faces without normals get their face normal.  glTF: every
+//    triangle primitive reachable from the default scene, with its node
+//    transforms applied, reading POSITION, NORMAL and indices from the
+//    embedded buffer.
+//
+//    Only touches mesh, so it may run on any thread.  Returns false with a
+//    message in error when the file can't be used.
+//
+
+bool LoadModel( const char* path, MeshBuilder& mesh, std::string& error );
+
+#endif // __MODELLOADER_H__
@@ -0,0 +1,181 @@
+#include "ModelStream.h"
+#include "GLState.h"
+#include "ModelLoader.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+ModelStream::ModelStream() :
+    vertex_buffer(0), index_buffer(0),
+    vertex_used(0), vertex_size(0), index_used(0), index_size(0),
+    pending(0), uploading(NULL), sent(0), stop(false) {}
+
+ModelStream::~ModelStream()
+{
+    {
+	std::lock_guard<std::mutex> guard( lock );
+	stop = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < loaders.size(); ++i) loaders[i].join();
+
+    for (size_t i = 0; i < queue.size(); ++i) delete queue[i];
+    for (size_t i = 0; i < parsed.size(); ++i) delete parsed[i];
+    delete uploading;
+}
+
+void ModelStream::Init( GLuint vertex_buffer, GLsizeiptr vertex_used, GLsizeiptr vertex_size,
+			GLuint index_buffer, GLsizeiptr index_used, GLsizeiptr index_size,
+			int threads )
+{
+    this->vertex_buffer = vertex_buffer;
+    this->vertex_used = vertex_used;
+    this->vertex_size = vertex_size;
+    this->index_buffer = index_buffer;
+    this->index_used = index_used;
+    this->index_size = index_size;
+
+    staging.Init( GL_COPY_READ_BUFFER, ChunkBytes );
+
+    for (int i = int(loaders.size()); i < std::max( threads, 1 ); ++i)
+	loaders.push_back( std::thread( &ModelStream::LoaderMain, this ) );
+}
+
+void ModelStream::Release()
+{
+    staging.Release();
+}
+
+int ModelStream::Load( const std::string& path )
+{
+    Model m;
+    m.path = path;
+    m.state = Model::Loading;
+    m.range.first = m.range.count = 0;
+    m.base_vertex = 0;
+    m.chunks = 0;
+    models.push_back( m );
+    ++pending;
+
+    Job* job = new Job;
+    job->model = int(models.size()) - 1;
+    job->path = path;
+    job->ms = 0.0;
+    {
+	std::lock_guard<std::mutex> guard( lock );
+	queue.push_back( job );
+    }
+    wake.notify_one();
+    return job->model;
+}
+
+void ModelStream::LoaderMain()
+{
+    for (;;) {
+	Job* job;
+	{
+	    std::unique_lock<std::mutex> guard( lock );
+	    while (!stop && queue.empty()) wake.wait( guard );
+	    if (stop) return;
+	    job = queue.front();
+	    queue.pop_front();
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	MeshBuilder mesh;
+	if (LoadModel( job->path.c_str(), mesh, job->error )) {
+	    job->vertices = mesh.Vertices();
+	    job->indices = mesh.Indices();
+	}
+	job->ms = std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+
+	std::lock_guard<std::mutex> guard( lock );
+	parsed.push_back( job );
+    }
+}
+
+bool ModelStream::Place( const Job& job )
+{
+    Model& m = models[job.model];
+    GLsizeiptr vertex_bytes = job.vertices.size() * sizeof(MeshVertex);
+    GLsizeiptr index_bytes = job.indices.size() * sizeof(GLushort);
+
+    if (!job.error.empty()) {
+	std::cerr << "ModelStream: " << m.path << ": " << job.error << std::endl;
+    } else if (vertex_used + vertex_bytes > vertex_size || index_used + index_bytes > index_size) {
+	std::cerr << "ModelStream: no room for " << m.path << " (" << vertex_bytes << " + "
+		  << index_bytes << " bytes, " << vertex_size - vertex_used << " + "
+		  << index_size - index_used << " left)" << std::endl;
+    } else {
+	m.base_vertex = GLint( vertex_used / sizeof(MeshVertex) );
+	m.range.first = int( index_used / sizeof(GLushort) );
+	m.range.count = int( job.indices.size() );
+	vertex_used += vertex_bytes;
+	index_used += index_bytes;
+	return true;
+    }
+
+    m.state = Model::Failed;
+    --pending;
+    return false;
+}
+
+void ModelStream::Pump()
+{
+    while (!uploading) {
+	{
+	    std::lock_guard<std::mutex> guard( lock );
+	    if (parsed.empty()) return;
+	    uploading = parsed.front();
+	    parsed.pop_front();
+	}
+	sent = 0;
+	if (!Place( *uploading )) {
+	    delete uploading;
+	    uploading = NULL;
+	}
+    }
+
+    Job& job = *uploading;
+    Model& m = models[job.model];
+    GLsizeiptr vertex_bytes = job.vertices.size() * sizeof(MeshVertex);
+    GLsizeiptr index_bytes = job.indices.size() * sizeof(GLushort);
+    GLsizeiptr n = std::min( GLsizeiptr( ChunkBytes ), vertex_bytes + index_bytes - sent );
+
+    // This chunk's share of each blob; it may straddle the two
+    GLsizeiptr from_vertices = sent < vertex_bytes ? std::min( n, vertex_bytes - sent ) : 0;
+    GLsizeiptr from_indices = n - from_vertices;
+    GLsizeiptr index_sent = sent + from_vertices - vertex_bytes;
+
+    staging.BeginFrame();
+    GLintptr offset;
+    char* dst = (char*) staging.Alloc( n, &offset );
+    if (from_vertices) memcpy( dst, (const char*) &job.vertices[0] + sent, from_vertices );
+    if (from_indices) memcpy( dst + from_vertices, (const char*) &job.indices[0] + index_sent, from_indices );
+    staging.Flush();
+
+    GLState::BindBuffer( GL_COPY_READ_BUFFER, staging.Buffer() );
+    if (from_vertices) {
+	GLState::BindBuffer( GL_COPY_WRITE_BUFFER, vertex_buffer );
+	glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset,
+			     m.base_vertex * sizeof(MeshVertex) + sent, from_vertices );
+    }
+    if (from_indices) {
+	GLState::BindBuffer( GL_COPY_WRITE_BUFFER, index_buffer );
+	glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset + from_vertices,
+			     m.range.first * sizeof(GLushort) + index_sent, from_indices );
+    }
+    staging.EndFrame();
+
+    sent += n;
+    ++m.chunks;
+    if (sent < vertex_bytes + index_bytes) return;
+
+    m.state = Model::Ready;
+    --pending;
+    std::cout << "Model: " << m.path << ", " << job.vertices.size() << " vertices, "
+	      << job.indices.size() / 3 << " triangles, parsed in " << job.ms << " ms, uploaded in "
+	      << m.chunks << (m.chunks == 1 ? " frame" : " frames") << std::endl;
+    delete uploading;
+    uploading = NULL;
+}
@@ -0,0 +1,103 @@
+#ifndef __MODELSTREAM_H__
+#define __MODELSTREAM_H__
+
+#include "Mesh.h"
+#include "StreamBuffer.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//----------------------------------------------------------------------------
+//
+//  ModelStream - loads model files in the background and streams them
+//    into the shared vertex and index buffers
+//
+//    Load() queues a file and returns its model id at once.  Loader
+//    threads of its own parse and optimize the file (LoadModel()); the
+//    TaskPool is fork/join and would hold up the frame that called it.
+//
+//    Pump() runs on the GL thread once a frame and moves at most
+//    ChunkBytes of finished geometry: the bytes go into a StreamBuffer
+//    used as a staging ring and glCopyBufferSubData moves them into the
+//    arena, the part of the vertex and index buffers after the built-in
+//    primitives.  A large model therefore arrives over several frames and
+//    no frame waits on a parse or a big upload.
+//
+//    Once Ready(), a model's Range() indexes the shared index buffer like
+//    the primitives' ranges do, with its indices relative to BaseVertex()
+//    (glDraw*BaseVertex), so every model keeps 16-bit indices.
+//
+
+class ModelStream {
+public:
+    enum { ChunkBytes = 256*1024 };  // uploaded per Pump()
+
+    ModelStream();
+    ~ModelStream();
+
+    //  The arena is [vertex_used, vertex_size) of vertex_buffer and
+    //    [index_used, index_size) of index_buffer, in bytes
+    void Init( GLuint vertex_buffer, GLsizeiptr vertex_used, GLsizeiptr vertex_size,
+	       GLuint index_buffer, GLsizeiptr index_used, GLsizeiptr index_size,
+	       int threads = 1 );
+    void Release();  // GL objects, while the context is current
+
+    int  Load( const std::string& path );
+    void Pump();
+
+    int       Models() const  { return int(models.size()); }
+    int       Pending() const { return pending; }  // not yet ready or failed
+    bool      Ready( int model ) const { return models[model].state == Model::Ready; }
+    MeshRange Range( int model ) const { return models[model].range; }
+    GLint     BaseVertex( int model ) const { return models[model].base_vertex; }
+
+private:
+    ModelStream( const ModelStream& );
+    ModelStream& operator = ( const ModelStream& );
+
+    //  One file on its way: filled by a loader thread, then handed to
+    //    Pump() through the parsed queue
+    struct Job {
+	int                      model;
+	std::string              path;
+	std::vector<MeshVertex>  vertices;
+	std::vector<GLushort>    indices;
+	std::string              error;
+	double                   ms;  // to parse and optimize
+    };
+
+    //  GL thread only
+    struct Model {
+	enum State { Loading, Ready, Failed };
+
+	std::string  path;
+	State        state;
+	MeshRange    range;
+	GLint        base_vertex;
+	int          chunks;  // Pump()s its upload took
+    };
+
+    void LoaderMain();
+    bool Place( const Job& job );
+
+    GLuint        vertex_buffer, index_buffer;
+    GLsizeiptr    vertex_used, vertex_size, index_used, index_size;
+    StreamBuffer  staging;
+
+    std::vector<Model>  models;
+    int                 pending;
+    Job*                uploading;  // being copied, or NULL
+    GLsizeiptr          sent;       // bytes of it copied so far, vertices then indices
+
+    std::mutex                lock;  // guards everything below
+    std::condition_variable   wake;
+    std::deque<Job*>          queue;   // waiting for a loader
+    std::deque<Job*>          parsed;  // waiting for Pump()
+    bool                      stop;
+    std::vector<std::thread>  loaders;
+};
+
+#endif // __MODELSTREAM_H__
@@ -0,0 +1,132 @@
+#include "Offscreen.h"
+#include <cstring>
+#include <iostream>
+
+#if defined(__linux__)
+#  include <EGL/egl.h>
+#  include <EGL/eglext.h>
+#  define OFFSCREEN_EGL
+#endif
+
+Offscreen::Offscreen() :
+    display(NULL), context(NULL), surface(NULL),
+    framebuffer(0), color(0), depth(0), width(0), height(0) {}
+
+Offscreen::~Offscreen()
+{
+    Release();
+}
+
+#ifdef OFFSCREEN_EGL
+
+bool Offscreen::Init( int w, int h )
+{
+    Release();
+
+    // The surfaceless platform needs no display server at all
+    EGLDisplay dpy = EGL_NO_DISPLAY;
+    const char* client = eglQueryString( EGL_NO_DISPLAY, EGL_EXTENSIONS );
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+	(PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+    if (client && strstr( client, "EGL_MESA_platform_surfaceless" ) && get_platform_display)
+	dpy = get_platform_display( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
+    if (dpy == EGL_NO_DISPLAY) dpy = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+
+    EGLint major, minor;
+    if (dpy == EGL_NO_DISPLAY || !eglInitialize( dpy, &major, &minor )) {
+	std::cerr << "Offscreen: no EGL display" << std::endl;
+	return false;
+    }
+    display = dpy;
+    if (!eglBindAPI( EGL_OPENGL_API )) {
+	std::cerr << "Offscreen: EGL offers no desktop OpenGL" << std::endl;
+	Release();
+	return false;
+    }
+
+    EGLint pbuffer_config[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLint any_config[] = { EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config;
+    EGLint n = 0;
+    bool pbuffer = eglChooseConfig( dpy, pbuffer_config, &config, 1, &n ) && n > 0;
+    if (!pbuffer && !(eglChooseConfig( dpy, any_config, &config, 1, &n ) && n > 0)) {
+	std::cerr << "Offscreen: no OpenGL config" << std::endl;
+	Release();
+	return false;
+    }
+
+    EGLContext ctx = eglCreateContext( dpy, config, EGL_NO_CONTEXT, NULL );
+    if (ctx == EGL_NO_CONTEXT) {
+	std::cerr << "Offscreen: eglCreateContext failed (0x" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+	Release();
+	return false;
+    }
+    context = ctx;
+
+    EGLSurface surf = EGL_NO_SURFACE;
+    if (pbuffer) {
+	EGLint size[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+	surf = eglCreatePbufferSurface( dpy, config, size );
+    }
+    surface = surf;
+    if (!eglMakeCurrent( dpy, surf, surf, ctx )) {
+	std::cerr << "Offscreen: eglMakeCurrent failed (0x" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+	Release();
+	return false;
+    }
+
+    // A GLEW built for GLX complains there's no X display, but only after
+    // it has loaded the GL entry points
+    glewInit();
+
+    glGenFramebuffers( 1, &framebuffer );
+    glBindFramebuffer( GL_FRAMEBUFFER, framebuffer );
+    glGenRenderbuffers( 1, &color );
+    glBindRenderbuffer( GL_RENDERBUFFER, color );
+    glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, w, h );
+    glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color );
+    glGenRenderbuffers( 1, &depth );
+    glBindRenderbuffer( GL_RENDERBUFFER, depth );
+    glRenderbufferStorage( GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h );
+    glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth );
+    if (glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE) {
+	std::cerr << "Offscreen: framebuffer incomplete at " << w << "x" << h << std::endl;
+	Release();
+	return false;
+    }
+
+    width = w;
+    height = h;
+    std::cout << "Offscreen: " << w << "x" << h << " on " << glGetString( GL_RENDERER )
+	      << (surf == EGL_NO_SURFACE ? ", surfaceless" : "") << std::endl;
+    return true;
+}
+
+void Offscreen::Release()
+{
+    if (!display) return;
+    if (context) {
+	if (framebuffer) glDeleteFramebuffers( 1, &framebuffer );
+	if (color) glDeleteRenderbuffers( 1, &color );
+	if (depth) glDeleteRenderbuffers( 1, &depth );
+	eglMakeCurrent( display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+	eglDestroyContext( display, context );
+    }
+    if (surface) eglDestroySurface( display, surface );
+    eglTerminate( display );
+    display = context = surface = NULL;
+    framebuffer = color = depth = 0;
+    width = height = 0;
+}
+
+#else
+
+bool Offscreen::Init( int, int )
+{
+    std::cerr << "Offscreen: needs EGL, which this platform's build doesn't use" << std::endl;
+    return false;
+}
+
+void Offscreen::Release() {}
+
+#endif
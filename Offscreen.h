@@ -0,0 +1,47 @@
+#ifndef __OFFSCREEN_H__
+#define __OFFSCREEN_H__
+
+#include "Angel.h"
+
+//----------------------------------------------------------------------------
+//
+//  Offscreen - a GL context and framebuffer that need no window, for
+//    rendering on machines without a display (render farm, CI)
+//
+//    The context comes from EGL, on Mesa's surfaceless platform when the
+//    client library has it (llvmpipe then needs neither X nor a GPU),
+//    otherwise on the default display.  A 1x1 pbuffer makes it current
+//    where the config allows one, else no surface at all
+//    (KHR_surfaceless_context): frames go to the framebuffer object made
+//    here, an RGBA8 color and a 24-bit depth renderbuffer of the size
+//    asked for, which Init() leaves bound.
+//
+//    Init() loads the GL entry points itself (glewInit()) between making
+//    the context current and making the framebuffer.  EGL is only used on
+//    Linux; elsewhere Init() says so and fails.
+//
+
+class Offscreen {
+public:
+    Offscreen();
+    ~Offscreen();  // Release()
+
+    bool Init( int width, int height );
+    void Release();
+
+    int    Width() const       { return width; }
+    int    Height() const      { return height; }
+    GLuint Framebuffer() const { return framebuffer; }
+
+private:
+    Offscreen( const Offscreen& );
+    Offscreen& operator = ( const Offscreen& );
+
+    void*   display;  // EGL handles, opaque so users don't need the EGL headers
+    void*   context;
+    void*   surface;
+    GLuint  framebuffer, color, depth;
+    int     width, height;
+};
+
+#endif // __OFFSCREEN_H__
@@ -0,0 +1,342 @@
+#include "Profiler.h"
+#include <cstdio>
+#include <iostream>
+
+#ifdef TOY_PROFILE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+struct Event {
+    const char*  name;
+    long long    begin, end;  // ns since epoch
+    int          depth;
+};
+
+//  One thread's events, the oldest overwritten first.  head counts every
+//  event ever recorded and only the owning thread stores it.
+struct Ring {
+    Event                  events[Profiler::RingSize];
+    std::atomic<unsigned>  head;
+    std::string            label;
+};
+
+const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+long long Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now() - epoch ).count();
+}
+
+std::mutex          rings_lock;  // only to register a ring, on a thread's first event
+std::vector<Ring*>  rings;       // never freed; the threads live as long
+int                 workers = 0;
+thread_local Ring*  ring = NULL;
+thread_local int    depth = 0;
+
+Ring* NewRing( const char* label )
+{
+    Ring* r = new Ring;
+    r->head = 0;
+    std::lock_guard<std::mutex> hold( rings_lock );
+    r->label = label ? label : "worker " + std::to_string( ++workers );
+    rings.push_back( r );
+    return r;
+}
+
+void Record( Ring* r, const char* name, long long begin, long long end, int d )
+{
+    unsigned h = r->head.load( std::memory_order_relaxed );
+    Event& e = r->events[h % Profiler::RingSize];
+    e.name = name;
+    e.begin = begin;
+    e.end = end;
+    e.depth = d;
+    r->head.store( h + 1, std::memory_order_release );
+}
+
+//  Timestamp query pairs of one frame
+struct GpuSpan {
+    const char*  name;
+    GLuint       query[2];
+};
+
+struct GpuFrame {
+    GpuSpan  spans[Profiler::MaxGpuSpans];
+    int      count;
+};
+
+GpuFrame   gpu_frames[Profiler::Latency];
+Ring*      gpu_ring = NULL;
+long long  gpu_offset = 0;  // CPU clock minus GPU clock, ns
+int        open_span = -1;
+
+//  Per-frame milliseconds of each stage, by frame % History
+struct Stage {
+    const char*  name;
+    bool         gpu;
+    float        ms[Profiler::History];
+};
+
+std::vector<Stage> stages;  // coloured in the order they first ran
+float      frame_ms[Profiler::History];
+int        frame = 0;       // frames begun
+long long  frame_begin = 0;
+unsigned   frame_first = 0; // GL thread's ring head at BeginFrame()
+
+bool       overlay = false;
+int        report_ms = 0;
+int        report_frames = 0;
+
+const GLfloat colors[Profiler::MaxStages][3] = {
+    { 0.2f, 0.8f, 0.2f }, { 0.2f, 0.4f, 1.0f }, { 1.0f, 0.6f, 0.1f }, { 0.9f, 0.2f, 0.9f },
+    { 0.1f, 0.9f, 0.9f }, { 1.0f, 1.0f, 0.2f }, { 1.0f, 0.2f, 0.2f }, { 0.9f, 0.9f, 0.9f }
+};
+const char* color_names[Profiler::MaxStages] = {
+    "green", "blue", "orange", "magenta", "cyan", "yellow", "red", "white"
+};
+
+//  NULL once MaxStages are taken; later ones are only in the trace
+Stage* FindStage( const char* name, bool gpu )
+{
+    for (size_t i = 0; i < stages.size(); ++i)
+	if (stages[i].gpu == gpu && (stages[i].name == name || strcmp( stages[i].name, name ) == 0))
+	    return &stages[i];
+    if (stages.size() == Profiler::MaxStages) return NULL;
+
+    Stage s;
+    s.name = name;
+    s.gpu = gpu;
+    for (int i = 0; i < Profiler::History; ++i) s.ms[i] = 0.0f;
+    stages.push_back( s );
+    return &stages.back();
+}
+
+//  The spans of a frame Latency frames back; one the GPU hasn't reached yet
+//  is dropped rather than waited for
+void ResolveGpu( GpuFrame& g, int row )
+{
+    for (int i = 0; i < g.count; ++i) {
+	GpuSpan& s = g.spans[i];
+	GLint available = 0;
+	glGetQueryObjectiv( s.query[1], GL_QUERY_RESULT_AVAILABLE, &available );
+	if (!available) continue;
+
+	GLuint64 t[2];
+	glGetQueryObjectui64v( s.query[0], GL_QUERY_RESULT, &t[0] );
+	glGetQueryObjectui64v( s.query[1], GL_QUERY_RESULT, &t[1] );
+	Record( gpu_ring, s.name, (long long)t[0] + gpu_offset, (long long)t[1] + gpu_offset, 0 );
+	if (Stage* stage = FindStage( s.name, true )) stage->ms[row] += float( (t[1] - t[0]) * 1e-6 );
+    }
+    g.count = 0;
+}
+
+void Rect( int x, int y, int w, int h, const GLfloat* c )
+{
+    if (w <= 0 || h <= 0) return;
+    glScissor( x, y, w, h );
+    glClearColor( c[0], c[1], c[2], 1.0f );
+    glClear( GL_COLOR_BUFFER_BIT );
+}
+
+}  // namespace
+
+Profiler::Scope::Scope( const char* n ) :
+    name(n), begin(Now())
+{
+    ++depth;
+}
+
+Profiler::Scope::~Scope()
+{
+    if (!ring) ring = NewRing( NULL );
+    Record( ring, name, begin, Now(), --depth );
+}
+
+void Profiler::BeginFrame()
+{
+    if (!ring) ring = NewRing( "GL thread" );
+    if (!gpu_ring) {
+	gpu_ring = NewRing( "GPU" );
+	GLint64 gpu_now = 0;
+	glGetInteger64v( GL_TIMESTAMP, &gpu_now );
+	gpu_offset = Now() - gpu_now;
+    }
+
+    ++frame;
+    int row = frame % History;
+    for (size_t i = 0; i < stages.size(); ++i) stages[i].ms[row] = 0.0f;
+    ResolveGpu( gpu_frames[frame % Latency], row );
+
+    frame_first = ring->head.load( std::memory_order_relaxed );
+    frame_begin = Now();
+    ++depth;
+}
+
+void Profiler::EndFrame( int now_ms )
+{
+    long long end = Now();
+    Record( ring, "frame", frame_begin, end, --depth );
+
+    // The frame's stages: the GL thread's scopes directly inside it
+    int row = frame % History;
+    unsigned head = ring->head.load( std::memory_order_relaxed );
+    unsigned first = head - frame_first > RingSize ? head - RingSize : frame_first;
+    for (unsigned i = first; i != head; ++i) {
+	const Event& e = ring->events[i % RingSize];
+	if (e.depth != 1) continue;
+	if (Stage* s = FindStage( e.name, false )) s->ms[row] += float( (e.end - e.begin) * 1e-6 );
+    }
+    frame_ms[row] = float( (end - frame_begin) * 1e-6 );
+
+    ++report_frames;
+    if (!overlay || now_ms - report_ms < 1000) return;
+
+    int n = std::min( report_frames, int(History) );
+    char text[512];
+    double total = 0.0;
+    for (int k = 0; k < n; ++k) total += frame_ms[(frame - k) % History];
+    int length = snprintf( text, sizeof(text), "Profiler: frame %.2f ms", total / n );
+    for (size_t i = 0; i < stages.size() && length > 0 && length < (int)sizeof(text); ++i) {
+	double sum = 0.0;
+	for (int k = 0; k < n; ++k) sum += stages[i].ms[(frame - k) % History];
+	length += snprintf( text + length, sizeof(text) - length, " | %s%s %.2f",
+			    stages[i].gpu ? "gpu " : "", stages[i].name, sum / n );
+    }
+    std::cout << text << std::endl;
+    report_ms = now_ms;
+    report_frames = 0;
+}
+
+void Profiler::GpuBegin( const char* name )
+{
+    GpuFrame& g = gpu_frames[frame % Latency];
+    open_span = g.count < MaxGpuSpans ? g.count++ : -1;
+    if (open_span < 0) return;
+
+    GpuSpan& s = g.spans[open_span];
+    if (!s.query[0]) glGenQueries( 2, s.query );
+    s.name = name;
+    glQueryCounter( s.query[0], GL_TIMESTAMP );
+}
+
+void Profiler::GpuEnd()
+{
+    if (open_span < 0) return;
+    glQueryCounter( gpu_frames[frame % Latency].spans[open_span].query[1], GL_TIMESTAMP );
+    open_span = -1;
+}
+
+void Profiler::SetOverlay( bool on )
+{
+    overlay = on;
+    report_frames = 0;
+    if (!on) {
+	std::cout << "Profiler: overlay off" << std::endl;
+	return;
+    }
+
+    // The overlay has no text, so say here what its colours are
+    std::string legend = "Profiler: overlay on, a column a frame, lines at 16.7 and 33.3 ms;";
+    for (size_t i = 0; i < stages.size(); ++i)
+	legend += std::string( " " ) + (stages[i].gpu ? "gpu " : "") + stages[i].name + " " + color_names[i];
+    std::cout << legend << std::endl;
+}
+
+bool Profiler::Overlay()
+{
+    return overlay;
+}
+
+void Profiler::DrawOverlay( int width, int height )
+{
+    if (!overlay) return;
+
+    GLfloat clear[4];
+    glGetFloatv( GL_COLOR_CLEAR_VALUE, clear );
+    glEnable( GL_SCISSOR_TEST );
+
+    // CPU stages stacked on the left, GPU ones on the right, two 60 Hz
+    // frames tall
+    const int column = 2, margin = 8, panel = History * column;
+    const int tall = std::max( 1, std::min( 200, height / 3 ) );
+    const float scale = tall / 33.3f;
+    const GLfloat back[3] = { 0.1f, 0.1f, 0.1f }, line[3] = { 0.6f, 0.6f, 0.6f };
+    for (int side = 0; side < 2; ++side) {
+	int left = margin + side * (panel + margin);
+	if (left + panel > width) break;
+	Rect( left, margin, panel, tall, back );
+	for (int k = 0; k < History && k < frame; ++k) {
+	    int row = (frame - k) % History;
+	    int x = left + panel - (k + 1) * column, y = margin;
+	    for (size_t i = 0; i < stages.size() && y < margin + tall; ++i) {
+		if (stages[i].gpu != (side == 1)) continue;
+		int h = std::min( int(stages[i].ms[row] * scale + 0.5f), margin + tall - y );
+		Rect( x, y, column, h, colors[i] );
+		y += h;
+	    }
+	}
+	Rect( left, margin + int(16.7f * scale), panel, 1, line );
+	Rect( left, margin + tall - 1, panel, 1, line );
+    }
+
+    glDisable( GL_SCISSOR_TEST );
+    glClearColor( clear[0], clear[1], clear[2], clear[3] );
+}
+
+bool Profiler::WriteTrace( const std::string& path )
+{
+    FILE* f = fopen( path.c_str(), "w" );
+    if (!f) {
+	std::cerr << "Profiler: can't write " << path << std::endl;
+	return false;
+    }
+
+    std::vector<Ring*> all;
+    {
+	std::lock_guard<std::mutex> hold( rings_lock );
+	all = rings;
+    }
+
+    // Chrome's trace event format: a complete ("X") event per scope, times in us
+    fprintf( f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n" );
+    size_t events = 0;
+    for (size_t t = 0; t < all.size(); ++t) {
+	fprintf( f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+		 t ? ",\n" : "", int(t), all[t]->label.c_str() );
+	unsigned head = all[t]->head.load( std::memory_order_acquire );
+	for (unsigned i = head > RingSize ? head - RingSize : 0; i != head; ++i, ++events) {
+	    const Event& e = all[t]->events[i % RingSize];
+	    fprintf( f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+		     e.name, int(t), e.begin * 1e-3, (e.end - e.begin) * 1e-3 );
+	}
+    }
+    fprintf( f, "\n]}\n" );
+    if (fclose( f ) != 0) {
+	std::cerr << "Profiler: can't write " << path << std::endl;
+	return false;
+    }
+    std::cout << "Profiler: wrote " << events << " events to " << path << std::endl;
+    return true;
+}
+
+#else
+
+void Profiler::SetOverlay( bool )
+{
+    std::cout << "Profiler: not built in; compile with -DTOY_PROFILE" << std::endl;
+}
+
+bool Profiler::WriteTrace( const std::string& )
+{
+    std::cerr << "Profiler: not built in; compile with -DTOY_PROFILE" << std::endl;
+    return false;
+}
+
+#endif // TOY_PROFILE
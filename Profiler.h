@@ -0,0 +1,93 @@
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include "Angel.h"
+#include <string>
+
+//----------------------------------------------------------------------------
+//
+//  Profiler - scoped CPU timers and GPU timestamps around the frame's
+//    stages, a rolling graph of them on screen and a Chrome trace of the
+//    last few thousand events of every thread
+//
+//    Compiled in only with -DTOY_PROFILE.  Without it PROFILE_SCOPE and
+//    PROFILE_GPU_* expand to nothing and the functions below are empty
+//    inlines, so a normal build carries no timer code at all.
+//
+//	Profiler::BeginFrame();
+//	{ PROFILE_SCOPE( "update" );  update(); }
+//	PROFILE_GPU_BEGIN( "draw" );  Submit();  PROFILE_GPU_END();
+//	Profiler::EndFrame( now_ms );
+//
+//    A scope adds one event (name, begin, end, depth) to a ring owned by
+//    the thread it ran on; only that thread writes the ring, so recording
+//    takes no lock.  Names must be string literals, as only the pointer is
+//    kept.  Scopes on the GL thread directly inside a frame are its
+//    stages: EndFrame() sums them into a per-frame history that the
+//    overlay stacks as columns, one colour a stage, and while the overlay
+//    is shown the averages go to the console once a second.
+//
+//    GPU spans are a pair of GL_TIMESTAMP queries, read back Latency
+//    frames later when the GPU has long passed them, and moved onto the
+//    CPU clock so they line up in the trace.
+//
+//    WriteTrace() reads every ring, so call it on the GL thread between
+//    frames, when the workers are idle.
+//
+
+#ifdef TOY_PROFILE
+
+class Profiler {
+public:
+    enum { RingSize = 1 << 15, History = 128, Latency = 4, MaxGpuSpans = 8, MaxStages = 8 };
+
+    class Scope {
+    public:
+	explicit Scope( const char* name );
+	~Scope();
+
+    private:
+	Scope( const Scope& );
+	Scope& operator = ( const Scope& );
+
+	const char*  name;
+	long long    begin;
+    };
+
+    static void BeginFrame();
+    static void EndFrame( int now_ms );
+    static void GpuBegin( const char* name );
+    static void GpuEnd();
+
+    static void SetOverlay( bool on );
+    static bool Overlay();
+    static void DrawOverlay( int width, int height );  // scissored clears, no shader
+
+    static bool WriteTrace( const std::string& path );
+};
+
+#  define PROFILE_JOIN2( a, b ) a##b
+#  define PROFILE_JOIN( a, b ) PROFILE_JOIN2( a, b )
+#  define PROFILE_SCOPE( name ) Profiler::Scope PROFILE_JOIN( profile_scope_, __LINE__ )( name )
+#  define PROFILE_GPU_BEGIN( name ) Profiler::GpuBegin( name )
+#  define PROFILE_GPU_END() Profiler::GpuEnd()
+
+#else
+
+class Profiler {
+public:
+    static void BeginFrame() {}
+    static void EndFrame( int ) {}
+    static void SetOverlay( bool );  // says it isn't built in
+    static bool Overlay() { return false; }
+    static void DrawOverlay( int, int ) {}
+    static bool WriteTrace( const std::string& );
+};
+
+#  define PROFILE_SCOPE( name ) ((void)0)
+#  define PROFILE_GPU_BEGIN( name ) ((void)0)
+#  define PROFILE_GPU_END() ((void)0)
+
+#endif // TOY_PROFILE
+
+#endif // __PROFILER_H__
@@ -0,0 +1,58 @@
+#include "RenderQueue.h"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+GLuint64 RenderQueue::Key( int batch, GLuint material, GLfloat depth )
+{
+    const GLuint depth_max = (1u << DepthBits) - 1;
+    GLuint d = GLuint( std::min( std::max( depth, 0.0f ), 1.0f ) * depth_max );
+    assert( batch >= 0 && batch < MaxBatches );  // would alias another batch's draws
+    return (GLuint64( batch ) << (MaterialBits + DepthBits)) |
+	   (GLuint64( material ) << DepthBits) | d;
+}
+
+void RenderQueue::Push( GLuint64 key, GLuint item )
+{
+    Entry e = { key, item };
+    entries.push_back( e );
+}
+
+void RenderQueue::Sort()
+{
+    const size_t n = entries.size();
+    if (n < 2) return;
+
+    memset( counts, 0, sizeof(counts) );
+    for (size_t i = 0; i < n; ++i) {
+	GLuint64 key = entries[i].key;
+	for (int b = 0; b < 8; ++b) ++counts[b][(key >> 8*b) & 0xff];
+    }
+
+    scratch.resize( n );
+    Entry* src = &entries[0];
+    Entry* dst = &scratch[0];
+    for (int b = 0; b < 8; ++b) {
+	GLuint* c = counts[b];
+	if (c[(src[0].key >> 8*b) & 0xff] == n) continue;  // all keys share this byte
+
+	// Counts to the first slot of each digit, then scatter in order
+	GLuint start = 0;
+	for (int d = 0; d < 256; ++d) {
+	    GLuint count = c[d];
+	    c[d] = start;
+	    start += count;
+	}
+	for (size_t i = 0; i < n; ++i) dst[c[(src[i].key >> 8*b) & 0xff]++] = src[i];
+	std::swap( src, dst );
+    }
+    if (src != &entries[0]) entries.swap( scratch );
+}
+
+int RenderQueue::RunEnd( int first ) const
+{
+    int batch = Batch( entries[first].key );
+    int end = first + 1;
+    while (end < Size() && Batch( entries[end].key ) == batch) ++end;
+    return end;
+}
@@ -0,0 +1,61 @@
+#ifndef __RENDERQUEUE_H__
+#define __RENDERQUEUE_H__
+
+#include "Angel.h"
+#include <vector>
+
+//----------------------------------------------------------------------------
+//
+//  RenderQueue - a frame's draws in the order of a 64-bit sort key
+//
+//    A draw is queued as its key and the index of its data in the caller's
+//    arrays.  The key packs, from the top bit down, the batch (the range of
+//    the index buffer it draws, up to 256 of them), a 32-bit material and
+//    the depth.  Sorted, the draws of a batch are consecutive, those of a
+//    material within it too, and each group runs front to back; a run of
+//    one batch can then go to GL as one instanced or multi-draw command.
+//
+//    Sort() is a least significant digit radix sort, a byte per pass.  The
+//    histograms of all eight bytes are gathered in one read, and a byte
+//    every key shares is skipped, so a frame costs a pass per byte that
+//    tells draws apart.  It is stable: draws with equal keys keep the
+//    order they were pushed in.
+//
+
+class RenderQueue {
+public:
+    enum { BatchBits = 8, MaterialBits = 32, DepthBits = 24 };
+    enum { MaxBatches = 1 << BatchBits };
+
+    struct Entry {
+	GLuint64  key;
+	GLuint    item;  // index of the draw's data
+    };
+
+    RenderQueue() {}
+
+    //  Depth is 0 at the eye and 1 at the far plane; outside is clamped.
+    //  The batch must be below MaxBatches.
+    static GLuint64 Key( int batch, GLuint material, GLfloat depth );
+    static int      Batch( GLuint64 key )    { return int(key >> (MaterialBits + DepthBits)); }
+    static GLuint   Material( GLuint64 key ) { return GLuint(key >> DepthBits); }
+
+    void Clear() { entries.clear(); }
+    void Push( GLuint64 key, GLuint item );
+    void Sort();
+
+    int          Size() const { return int(entries.size()); }
+    const Entry& operator [] ( int i ) const { return entries[i]; }
+
+    //  Entry after the run of the same batch that starts at first
+    int RunEnd( int first ) const;
+
+private:
+    RenderQueue( const RenderQueue& );
+    RenderQueue& operator = ( const RenderQueue& );
+
+    std::vector<Entry> entries, scratch;
+    GLuint             counts[8][256];  // per byte of the key
+};
+
+#endif // __RENDERQUEUE_H__
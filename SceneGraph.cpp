@@ -0,0 +1,68 @@
+#include "SceneGraph.h"
+#include <algorithm>
+#include <cstring>
+
+int SceneGraph::AddNode( int parent, const affine& local, int prim, const color4& color )
+{
+    int node = Size();
+    if (parent >= node) {
+	std::cerr << "SceneGraph: parent " << parent << " must be added before its children"
+		  << std::endl;
+	return -1;
+    }
+
+    this->parent.push_back( parent );
+    this->local.push_back( local );
+    this->world.push_back( local );
+    this->prim.push_back( prim );
+    this->color.push_back( color );
+    visible.push_back( 1 );
+    shown.push_back( 1 );
+    dirty.push_back( 1 );
+    return node;
+}
+
+void SceneGraph::Clear()
+{
+    parent.clear();  local.clear();  world.clear();
+    prim.clear();    color.clear();
+    visible.clear(); shown.clear();  dirty.clear();
+    updated = 0;
+}
+
+void SceneGraph::SetLocal( int node, const affine& m )
+{
+    if (memcmp( &local[node], &m, sizeof(affine) ) == 0) return;
+    local[node] = m;
+    dirty[node] = 1;
+}
+
+void SceneGraph::SetVisible( int node, bool on )
+{
+    if (visible[node] == on) return;
+    visible[node] = on;
+    dirty[node] = 1;
+}
+
+int SceneGraph::Update( int first, int last )
+{
+    int count = 0;
+
+    for (int i = first; i < last; ++i) {
+	int p = parent[i];
+	if (p >= 0 && dirty[p]) dirty[i] = 1;  // parent was recomputed above
+	if (!dirty[i]) continue;
+
+	if (p < 0) {
+	    world[i] = local[i];
+	    shown[i] = visible[i];
+	} else {
+	    world[i] = world[p] * local[i];
+	    shown[i] = visible[i] && shown[p];
+	}
+	++count;
+    }
+
+    std::fill( dirty.begin() + first, dirty.begin() + last, 0 );
+    return count;
+}
@@ -0,0 +1,75 @@
+#ifndef __SCENEGRAPH_H__
+#define __SCENEGRAPH_H__
+
+#include "Angel.h"
+#include <vector>
+
+typedef Angel::vec4  color4;
+
+//----------------------------------------------------------------------------
+//
+//  SceneGraph
+//
+//    Retained transform hierarchy.  Every per-node attribute lives in its
+//    own flat array indexed by node id, and nodes are only ever appended
+//    after their parent, so the arrays are in topological order and
+//    Update() is a single linear pass with the parent's world matrix
+//    already computed.
+//
+//    A node's world matrix is recomputed only when its local transform or
+//    visibility changed, or when its parent's world matrix was recomputed
+//    in the same pass; a static wing under a still airframe costs nothing.
+//
+//    A node with a primitive is a drawable part (its local usually ends in
+//    the part's scale); NoPrimitive nodes are pivots and groups.
+//
+
+class SceneGraph {
+public:
+    enum { NoPrimitive = -1 };
+
+    SceneGraph() : updated(0) {}
+
+    int  AddNode( int parent, const affine& local,
+		  int prim = NoPrimitive, const color4& color = color4(1.0) );
+    void Clear();
+
+    //  Both only dirty the node when the value actually changes
+    void SetLocal( int node, const affine& local );
+    void SetVisible( int node, bool visible );
+
+    void Update() { updated = Update( 0, Size() ); }
+
+    //  Update only nodes [first, last), which must be whole subtrees (start
+    //    at a root and end before one).  Disjoint ranges can be updated on
+    //    different threads; returns the number of world matrices recomputed.
+    int  Update( int first, int last );
+
+    int  Size() const { return int(parent.size()); }
+
+    int           Parent( int node ) const    { return parent[node]; }
+    int           Primitive( int node ) const { return prim[node]; }
+    const color4& Color( int node ) const     { return color[node]; }
+    const affine& Local( int node ) const     { return local[node]; }
+    const affine& World( int node ) const     { return world[node]; }
+
+    //  Visible, and so are all of its ancestors
+    bool Shown( int node ) const { return shown[node] != 0; }
+
+    //  World matrices recomputed by the last Update()
+    int  Updated() const { return updated; }
+    void SetUpdated( int n ) { updated = n; }  // total of a ranged update
+
+private:
+    std::vector<int>           parent;   // -1 for roots
+    std::vector<affine>        local;    // relative to the parent
+    std::vector<affine>        world;
+    std::vector<int>           prim;
+    std::vector<color4>        color;
+    std::vector<unsigned char> visible;
+    std::vector<unsigned char> shown;
+    std::vector<unsigned char> dirty;    // needs a world update this pass
+    int  updated;
+};
+
+#endif // __SCENEGRAPH_H__
@@ -0,0 +1,350 @@
+#include "ShaderManager.h"
+#include "GLState.h"
+#include "MeshCache.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// Program binaries need GL 4.1 or ARB_get_program_binary, which the
+// GLUT/legacy headers on Mac OS X don't expose; there every launch compiles.
+#if defined(GL_PROGRAM_BINARY_LENGTH) && !defined(__APPLE__)
+#  define SHADERMANAGER_BINARIES
+#endif
+
+namespace {
+
+const char Magic[8] = { 'T', 'O', 'Y', 'P', 'R', 'O', 'G', 0 };
+
+struct Header {
+    char      magic[8];
+    unsigned  version;
+    unsigned  key;
+    unsigned  format;    // binary format from glGetProgramBinary
+    unsigned  length;    // bytes of binary after the header
+    unsigned  checksum;  // of them
+    unsigned  reserved[9];
+};
+
+static_assert( sizeof(Header) == 64, "shader cache header must stay 64 bytes" );
+
+time_t Modified( const std::string& path )
+{
+    struct stat st;
+    return stat( path.c_str(), &st ) == 0 ? st.st_mtime : 0;
+}
+
+double MsSince( std::chrono::steady_clock::time_point start )
+{
+    return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now() - start ).count();
+}
+
+void PrintLog( GLuint object, bool program )
+{
+    GLint size = 0;
+    if (program) glGetProgramiv( object, GL_INFO_LOG_LENGTH, &size );
+    else         glGetShaderiv( object, GL_INFO_LOG_LENGTH, &size );
+    if (size <= 1) return;
+
+    std::vector<char> log( size );
+    if (program) glGetProgramInfoLog( object, size, NULL, &log[0] );
+    else         glGetShaderInfoLog( object, size, NULL, &log[0] );
+    std::cerr << &log[0] << std::endl;
+}
+
+}  // namespace
+
+ShaderManager::ShaderManager() :
+    driver(0), binaries(false), last_poll_ms(0) {}
+
+ShaderManager::~ShaderManager()
+{
+    // GL objects are left to the context; Release() must run while it is current
+}
+
+int ShaderManager::Add( const std::string& vertex_file, const std::string& fragment_file,
+			const std::string& defines, const std::string& name )
+{
+    Variant v;
+    v.files[0] = vertex_file;
+    v.files[1] = fragment_file;
+    v.defines = defines;
+    v.name = name;
+    v.program = 0;
+    v.modified[0] = v.modified[1] = 0;
+    v.key = 0;
+    v.shaders[0] = v.shaders[1] = 0;
+    v.linking = 0;
+    variants.push_back( v );
+    return int(variants.size()) - 1;
+}
+
+bool ShaderManager::Build()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    if (!driver) {
+	const GLenum strings[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	driver = 2166136261u;
+	for (int i = 0; i < 3; ++i) {
+	    const char* s = (const char*) glGetString( strings[i] );
+	    if (s) driver = Fnv1a( s, strlen( s ) + 1, driver );
+	}
+
+#ifdef SHADERMANAGER_BINARIES
+	GLint formats = 0;
+	glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formats );
+	binaries = formats > 0;
+#endif
+#if !defined(__APPLE__) && defined(GL_KHR_parallel_shader_compile)
+	// Let the driver use as many compiler threads as it likes
+	if (GLEW_KHR_parallel_shader_compile) glMaxShaderCompilerThreadsKHR( 0xFFFFFFFFu );
+#endif
+    }
+
+    std::vector<int> missing;
+    for (int i = 0; i < Variants(); ++i)
+	if (!variants[i].program) missing.push_back( i );
+
+    int replaced = 0, cached = 0;
+    bool ok = Rebuild( missing, &replaced, &cached );
+    std::cout << "Shaders: " << missing.size() << " variants, " << cached << " from the cache, "
+	      << replaced - cached << " compiled in " << MsSince( start ) << " ms" << std::endl;
+    return ok;
+}
+
+bool ShaderManager::Poll( int now_ms )
+{
+    if (now_ms - last_poll_ms < PollMs) return false;
+    last_poll_ms = now_ms;
+
+    std::vector<int> changed;
+    for (int i = 0; i < Variants(); ++i) {
+	const Variant& v = variants[i];
+	if (Modified( v.files[0] ) != v.modified[0] || Modified( v.files[1] ) != v.modified[1])
+	    changed.push_back( i );
+    }
+    if (changed.empty()) return false;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int replaced = 0, cached = 0;
+    bool ok = Rebuild( changed, &replaced, &cached );
+    std::cout << "Shaders: reloaded " << replaced << " of " << changed.size() << " variants in "
+	      << MsSince( start ) << " ms" << (ok ? "" : ", keeping the old programs of the rest")
+	      << std::endl;
+    return replaced > 0;
+}
+
+void ShaderManager::Release()
+{
+    for (size_t i = 0; i < variants.size(); ++i) {
+	if (variants[i].program) GLState::DeleteProgram( variants[i].program );
+	variants[i].program = 0;
+    }
+}
+
+// Read a variant's files and work out its cache key
+bool ShaderManager::Read( Variant& v )
+{
+    v.key = Fnv1a( v.defines.c_str(), v.defines.size() + 1, driver );
+    for (int s = 0; s < 2; ++s) {
+	v.modified[s] = Modified( v.files[s] );
+	std::ifstream in( v.files[s].c_str(), std::ios::binary );
+	if (!in) {
+	    std::cerr << "Shaders: can't read " << v.files[s] << std::endl;
+	    return false;
+	}
+	std::ostringstream text;
+	text << in.rdbuf();
+	v.sources[s] = text.str();
+	v.key = Fnv1a( v.sources[s].c_str(), v.sources[s].size() + 1, v.key );
+    }
+    return true;
+}
+
+// Build the programs of the given variants, loading what the cache holds
+// and compiling the rest together
+bool ShaderManager::Rebuild( const std::vector<int>& which, int* replaced, int* cached )
+{
+    bool ok = true;
+    std::vector<int> compile;
+    for (size_t k = 0; k < which.size(); ++k) {
+	Variant& v = variants[which[k]];
+	if (!Read( v )) {
+	    ok = false;
+	    continue;
+	}
+	GLuint program = binaries ? LoadBinary( v ) : 0;
+	if (program) {
+	    Replace( v, program );
+	    ++*replaced;
+	    ++*cached;
+	} else {
+	    compile.push_back( which[k] );
+	}
+    }
+
+    // Issue every compile and link before reading any status back
+    const GLenum types[2] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    for (size_t k = 0; k < compile.size(); ++k) {
+	Variant& v = variants[compile[k]];
+	for (int s = 0; s < 2; ++s) {
+	    // The defines go after #version, which has to come first
+	    const GLchar* text = v.sources[s].c_str();
+	    const GLchar* body = text;
+	    if (strncmp( body, "#version", 8 ) == 0) {
+		const GLchar* eol = strchr( body, '\n' );
+		body = eol ? eol + 1 : body + strlen( body );
+	    }
+	    const GLchar* parts[4] = { text, v.defines.c_str(), body == text ? "" : "#line 2\n", body };
+	    GLint lengths[4] = { GLint(body - text), -1, -1, -1 };
+
+	    v.shaders[s] = glCreateShader( types[s] );
+	    glShaderSource( v.shaders[s], 4, parts, lengths );
+	    glCompileShader( v.shaders[s] );
+	}
+    }
+    for (size_t k = 0; k < compile.size(); ++k) {
+	Variant& v = variants[compile[k]];
+	v.linking = glCreateProgram();
+	glAttachShader( v.linking, v.shaders[0] );
+	glAttachShader( v.linking, v.shaders[1] );
+#ifdef SHADERMANAGER_BINARIES
+	if (binaries) glProgramParameteri( v.linking, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+#endif
+	glLinkProgram( v.linking );
+    }
+
+    for (size_t k = 0; k < compile.size(); ++k) {
+	Variant& v = variants[compile[k]];
+	GLint linked = GL_FALSE;
+	glGetProgramiv( v.linking, GL_LINK_STATUS, &linked );
+	if (linked) {
+	    if (binaries) SaveBinary( v, v.linking );
+	    Replace( v, v.linking );
+	    ++*replaced;
+	} else {
+	    std::cerr << "Shaders: " << v.name << " (" << v.files[0] << ", " << v.files[1]
+		      << ") failed to build:" << std::endl;
+	    for (int s = 0; s < 2; ++s) {
+		GLint compiled = GL_FALSE;
+		glGetShaderiv( v.shaders[s], GL_COMPILE_STATUS, &compiled );
+		if (!compiled) {
+		    std::cerr << v.files[s] << ":" << std::endl;
+		    PrintLog( v.shaders[s], false );
+		}
+	    }
+	    PrintLog( v.linking, true );
+	    GLState::DeleteProgram( v.linking );
+	    ok = false;
+	}
+
+	// A linked program doesn't need its shaders any more
+	for (int s = 0; s < 2; ++s) {
+	    if (linked) glDetachShader( v.linking, v.shaders[s] );
+	    glDeleteShader( v.shaders[s] );
+	    v.shaders[s] = 0;
+	}
+	v.linking = 0;
+    }
+
+    for (size_t k = 0; k < which.size(); ++k) {
+	Variant& v = variants[which[k]];
+	v.sources[0].clear();
+	v.sources[1].clear();
+    }
+    return ok;
+}
+
+void ShaderManager::Replace( Variant& v, GLuint program )
+{
+    if (v.program) GLState::DeleteProgram( v.program );  // freed once no longer in use
+    v.program = program;
+}
+
+std::string ShaderManager::CachePath( const Variant& v ) const
+{
+    std::string id = v.files[0] + '\n' + v.files[1] + '\n' + v.defines;
+    char name[64];
+    snprintf( name, sizeof(name), "program-%08x.shadercache", Fnv1a( id.c_str(), id.size() ) );
+    return name;
+}
+
+// The cached program for this key, or 0
+GLuint ShaderManager::LoadBinary( const Variant& v )
+{
+#ifdef SHADERMANAGER_BINARIES
+    std::string path = CachePath( v );
+    std::ifstream in( path.c_str(), std::ios::binary );
+    if (!in) return 0;
+
+    Header h;
+    std::vector<char> binary;
+    const char* stale = NULL;
+    if (!in.read( (char*) &h, sizeof(h) ))             stale = "truncated";
+    else if (memcmp( h.magic, Magic, sizeof(Magic) ) != 0) stale = "not a shader cache";
+    else if (h.version != Version)                     stale = "old format version";
+    else if (h.key != v.key)                           stale = "other source or driver";
+    else {
+	binary.resize( h.length );
+	if (h.length == 0 || !in.read( &binary[0], h.length )) stale = "truncated";
+	else if (Fnv1a( &binary[0], h.length ) != h.checksum)   stale = "checksum mismatch";
+    }
+
+    GLuint program = 0;
+    if (!stale) {
+	program = glCreateProgram();
+	glProgramBinary( program, GLenum(h.format), &binary[0], GLsizei(h.length) );
+	GLint linked = GL_FALSE;
+	glGetProgramiv( program, GL_LINK_STATUS, &linked );
+	if (!linked) {
+	    GLState::DeleteProgram( program );
+	    program = 0;
+	    stale = "refused by the driver";
+	}
+    }
+    if (stale) std::cout << "Shaders: " << path << " ignored (" << stale << ")" << std::endl;
+    return program;
+#else
+    return 0;
+#endif
+}
+
+void ShaderManager::SaveBinary( const Variant& v, GLuint program )
+{
+#ifdef SHADERMANAGER_BINARIES
+    GLint length = 0;
+    glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &length );
+    if (length <= 0) return;
+
+    std::vector<char> data( sizeof(Header) + length );
+    GLenum format = 0;
+    glGetProgramBinary( program, length, &length, &format, &data[sizeof(Header)] );
+
+    Header h;
+    memset( &h, 0, sizeof(h) );
+    memcpy( h.magic, Magic, sizeof(Magic) );
+    h.version = Version;
+    h.key = v.key;
+    h.format = unsigned(format);
+    h.length = unsigned(length);
+    h.checksum = Fnv1a( &data[sizeof(Header)], length );
+    memcpy( &data[0], &h, sizeof(h) );
+
+    // Write beside the target and rename, so a crash never leaves half a file
+    std::string path = CachePath( v ), tmp = path + ".tmp";
+    FILE* f = fopen( tmp.c_str(), "wb" );
+    bool ok = f && fwrite( &data[0], 1, sizeof(Header) + length, f ) == sizeof(Header) + length;
+    if (f) ok = (fclose( f ) == 0) && ok;
+#if defined(_WIN32)
+    if (ok) remove( path.c_str() );  // rename() doesn't replace on Windows
+#endif
+    if (!ok || rename( tmp.c_str(), path.c_str() ) != 0) {
+	std::cerr << "Shaders: can't write " << path << std::endl;
+	remove( tmp.c_str() );
+    }
+#endif
+}
@@ -0,0 +1,91 @@
+#ifndef __SHADERMANAGER_H__
+#define __SHADERMANAGER_H__
+
+#include "Angel.h"
+#include <ctime>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------------
+//
+//  ShaderManager - shader program variants, cached on disk and rebuilt
+//    when their source files change
+//
+//    A variant is a vertex and a fragment shader file compiled with a
+//    block of #defines inserted after their #version line (#line keeps
+//    the log's line numbers right).  Add() declares one and Build() makes
+//    the programs of every variant not built yet.
+//
+//    A linked program is saved with glGetProgramBinary into a
+//    .shadercache file per variant.  Its header holds a hash of the two
+//    sources, the defines and the driver (vendor, renderer and version
+//    strings), and later launches load the binary with glProgramBinary
+//    instead of compiling unless the hash differs or the driver rejects
+//    it.
+//
+//    What has to be compiled is issued all at once: every shader is
+//    compiled and every program linked before any status is read, so a
+//    driver with KHR_parallel_shader_compile works on them side by side on
+//    its own threads.  GL calls stay on this thread; the TaskPool's
+//    workers have no context.
+//
+//    Poll() watches the files' modification times and rebuilds the
+//    variants of a file that changed.  A variant that fails prints its log
+//    and keeps its old program, so a typo doesn't end the session.
+//    Programs are replaced, never edited: when Poll() returns true the
+//    caller looks its uniforms up again.
+//
+//    Nothing here exits; Build() returns false when a variant was left
+//    without a program.
+//
+
+class ShaderManager {
+public:
+    enum { Version = 1 };
+    enum { PollMs = 250 };  // between checks of the files
+
+    ShaderManager();
+    ~ShaderManager();  // GL objects are left to the context; see Release()
+
+    int  Add( const std::string& vertex_file, const std::string& fragment_file,
+	      const std::string& defines, const std::string& name );
+    bool Build();
+    bool Poll( int now_ms );  // true if a program was replaced
+    void Release();           // while the context is current
+
+    int    Variants() const { return int(variants.size()); }
+    GLuint Program( int variant ) const { return variants[variant].program; }
+    const std::string& Name( int variant ) const { return variants[variant].name; }
+
+private:
+    ShaderManager( const ShaderManager& );
+    ShaderManager& operator = ( const ShaderManager& );
+
+    struct Variant {
+	std::string  files[2];  // vertex, fragment
+	std::string  defines;
+	std::string  name;
+	GLuint       program;
+	time_t       modified[2];  // of the files when last read
+
+	//  While being rebuilt
+	std::string  sources[2];
+	unsigned     key;        // of the sources, defines and driver
+	GLuint       shaders[2];
+	GLuint       linking;
+    };
+
+    bool   Rebuild( const std::vector<int>& which, int* replaced, int* cached );
+    bool   Read( Variant& v );
+    GLuint LoadBinary( const Variant& v );
+    void   SaveBinary( const Variant& v, GLuint program );
+    void   Replace( Variant& v, GLuint program );
+    std::string CachePath( const Variant& v ) const;
+
+    std::vector<Variant> variants;
+    unsigned  driver;      // hash of the driver's strings, 0 until the first Build()
+    bool      binaries;    // the driver offers a program binary format
+    int       last_poll_ms;
+};
+
+#endif // __SHADERMANAGER_H__
@@ -0,0 +1,140 @@
+#include "StreamBuffer.h"
+#include "GLState.h"
+#include <cstring>
+
+// Persistent mapping needs GL 4.4 or ARB_buffer_storage; the GLUT/legacy
+// headers on Mac OS X don't expose it, so only the orphaning path exists there.
+#if defined(GL_MAP_PERSISTENT_BIT) && !defined(__APPLE__)
+#  define STREAMBUFFER_PERSISTENT
+#endif
+
+StreamBuffer::StreamBuffer() :
+    target(GL_ARRAY_BUFFER), buffer(0), frame_size(0), frame(0),
+    head(0), flushed(0), mapped(NULL), stalls(0)
+{
+    for (int i = 0; i < NumFrames; ++i) fences[i] = 0;
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    // GL objects are left to the context; Release() must run while it is current
+}
+
+bool StreamBuffer::Init( GLenum target, GLsizeiptr frame_size )
+{
+    Release();
+    this->target = target;
+    this->frame_size = frame_size;
+    frame = 0;
+    head = flushed = 0;
+
+    glGenBuffers( 1, &buffer );
+    GLState::BindBuffer( target, buffer );
+
+#ifdef STREAMBUFFER_PERSISTENT
+    if (GLEW_ARB_buffer_storage) {
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glBufferStorage( target, NumFrames*frame_size, NULL, flags );
+	mapped = (char*) glMapBufferRange( target, 0, NumFrames*frame_size, flags );
+	if (mapped) return true;
+
+	// Some drivers advertise the extension but refuse the mapping
+	std::cerr << "StreamBuffer: persistent mapping failed, falling back to orphaning" << std::endl;
+	GLState::DeleteBuffer( buffer );
+	glGenBuffers( 1, &buffer );
+	GLState::BindBuffer( target, buffer );
+    }
+#endif
+
+    glBufferData( target, frame_size, NULL, GL_STREAM_DRAW );
+    shadow.resize( frame_size );
+    return true;
+}
+
+void StreamBuffer::Release()
+{
+    for (int i = 0; i < NumFrames; ++i) {
+	if (fences[i]) glDeleteSync( fences[i] );
+	fences[i] = 0;
+    }
+    if (buffer) {
+	if (mapped) {
+	    GLState::BindBuffer( target, buffer );
+	    glUnmapBuffer( target );
+	}
+	GLState::DeleteBuffer( buffer );
+    }
+    buffer = 0;
+    mapped = NULL;
+    shadow.clear();
+}
+
+bool StreamBuffer::Reserve( GLsizeiptr size )
+{
+    if (size <= frame_size) return true;
+
+    // Grow geometrically so a steadily rising instance count reallocates rarely
+    GLsizeiptr new_size = frame_size ? frame_size : 4096;
+    while (new_size < size) new_size *= 2;
+    return Init( target, new_size );
+}
+
+void StreamBuffer::BeginFrame()
+{
+    head = flushed = 0;
+
+    // Wait until the GPU has finished with the segment from NumFrames ago
+    GLsync& fence = fences[frame];
+    if (fence) {
+	GLenum r = glClientWaitSync( fence, 0, 0 );
+	if (r == GL_TIMEOUT_EXPIRED) {
+	    ++stalls;
+	    do {
+		r = glClientWaitSync( fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 );
+	    } while (r == GL_TIMEOUT_EXPIRED);
+	}
+	glDeleteSync( fence );
+	fence = 0;
+    }
+}
+
+void* StreamBuffer::Alloc( GLsizeiptr size, GLintptr* offset, GLsizeiptr align )
+{
+    GLsizeiptr start = (head + align - 1) / align * align;
+    if (start + size > frame_size) {
+	std::cerr << "StreamBuffer: frame overflow (" << start + size
+		  << " > " << frame_size << " bytes), call Reserve() first" << std::endl;
+	return NULL;
+    }
+    head = start + size;
+
+    if (mapped) {
+	*offset = frame*frame_size + start;
+	return mapped + *offset;
+    }
+    *offset = start;
+    return &shadow[start];
+}
+
+void StreamBuffer::Flush()
+{
+    // The persistent mapping is coherent, so writes are already visible
+    if (mapped || head == flushed) return;
+
+    GLState::BindBuffer( target, buffer );
+    if (flushed == 0) {
+	// Orphan: the driver hands back fresh storage instead of stalling on
+	// draws still reading last frame's contents
+	glBufferData( target, frame_size, NULL, GL_STREAM_DRAW );
+    }
+    glBufferSubData( target, flushed, head - flushed, &shadow[flushed] );
+    flushed = head;
+}
+
+void StreamBuffer::EndFrame()
+{
+    if (mapped) {
+	fences[frame] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	frame = (frame + 1) % NumFrames;
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef __STREAMBUFFER_H__
+#define __STREAMBUFFER_H__
+
+#include "Angel.h"
+#include <vector>
+
+//----------------------------------------------------------------------------
+//
+//  StreamBuffer
+//
+//    Ring buffer for data rewritten every frame (instance transforms and
+//    colors).  The buffer holds NumFrames segments; each frame appends
+//    into its own segment while the GPU may still be reading the previous
+//    ones, and a fence per segment stops the CPU from lapping the GPU.
+//
+//    With ARB_buffer_storage the whole ring is mapped once, persistently
+//    and coherently, so Alloc() returns pointers straight into memory the
+//    GPU reads and a draw's data costs one memcpy.  Without it Alloc()
+//    writes into a CPU shadow and Flush() orphans the buffer and uploads
+//    the used range in a single glBufferSubData.
+//
+//    Typical frame:
+//
+//	ring.Reserve( bytes );     // grows the segments if needed
+//	ring.BeginFrame();
+//	p = ring.Alloc( n, &offset );  memcpy( p, data, n );  ...
+//	ring.Flush();
+//	... draws sourcing ring.Buffer() at offset ...
+//	ring.EndFrame();
+//
+
+class StreamBuffer {
+public:
+    enum { NumFrames = 3 };
+
+    StreamBuffer();
+    ~StreamBuffer();
+
+    bool Init( GLenum target, GLsizeiptr frame_size );
+    void Release();
+
+    //  Make sure each segment holds at least size bytes.  Only valid
+    //    outside BeginFrame()/EndFrame().
+    bool Reserve( GLsizeiptr size );
+
+    void  BeginFrame();
+    void* Alloc( GLsizeiptr size, GLintptr* offset, GLsizeiptr align = 16 );
+    void  Flush();
+    void  EndFrame();
+
+    GLuint     Buffer() const     { return buffer; }
+    bool       Persistent() const { return mapped != NULL; }
+    GLsizeiptr FrameSize() const  { return frame_size; }
+    GLsizeiptr Used() const       { return head; }
+    int        Stalls() const     { return stalls; }  // fence waits that blocked
+
+private:
+    StreamBuffer( const StreamBuffer& );
+    StreamBuffer& operator = ( const StreamBuffer& );
+
+    GLenum     target;
+    GLuint     buffer;
+    GLsizeiptr frame_size;
+    int        frame;      // segment being written
+    GLsizeiptr head;       // bytes allocated in the current segment
+    GLsizeiptr flushed;    // bytes already uploaded (orphaning path)
+    char*      mapped;     // persistent mapping of all segments, or NULL
+    GLsync     fences[NumFrames];
+    int        stalls;
+    std::vector<char> shadow;  // CPU copy of the segment (orphaning path)
+};
+
+#endif // __STREAMBUFFER_H__
@@ -0,0 +1,102 @@
+#include "TaskPool.h"
+
+TaskPool::TaskPool( int threads ) :
+    job(0), stop(false), remaining(0)
+{
+    if (threads <= 0) threads = int(std::thread::hardware_concurrency());
+    if (threads <= 0) threads = 1;
+
+    for (int i = 0; i < threads; ++i) queues.push_back( new Queue );
+    for (int i = 1; i < threads; ++i)
+	workers.push_back( std::thread( &TaskPool::WorkerMain, this, i ) );
+}
+
+TaskPool::~TaskPool()
+{
+    {
+	std::lock_guard<std::mutex> guard( lock );
+	stop = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+    for (size_t i = 0; i < queues.size(); ++i) delete queues[i];
+}
+
+void TaskPool::ParallelFor( int tasks, const Body& f )
+{
+    if (tasks <= 0) return;
+
+    // Nothing to share: skip the queues entirely
+    if (Threads() == 1 || tasks == 1) {
+	for (int t = 0; t < tasks; ++t) f( t, 0 );
+	return;
+    }
+
+    {
+	std::lock_guard<std::mutex> guard( lock );
+	body = f;
+	remaining = tasks;
+	for (int t = 0; t < tasks; ++t) {
+	    Queue& q = *queues[t % Threads()];
+	    std::lock_guard<std::mutex> qguard( q.lock );
+	    q.tasks.push_back( t );
+	}
+	++job;
+    }
+    wake.notify_all();
+
+    Work( 0 );
+
+    // Others may still be finishing tasks they took
+    while (remaining.load( std::memory_order_acquire ) > 0)
+	std::this_thread::yield();
+}
+
+bool TaskPool::Take( int worker, int* task )
+{
+    // Own deque first, newest task (still warm in this core's cache)
+    {
+	Queue& q = *queues[worker];
+	std::lock_guard<std::mutex> guard( q.lock );
+	if (!q.tasks.empty()) {
+	    *task = q.tasks.back();
+	    q.tasks.pop_back();
+	    return true;
+	}
+    }
+
+    // Then steal the oldest task from the others
+    for (int i = 1; i < Threads(); ++i) {
+	Queue& q = *queues[(worker + i) % Threads()];
+	std::lock_guard<std::mutex> guard( q.lock );
+	if (!q.tasks.empty()) {
+	    *task = q.tasks.front();
+	    q.tasks.pop_front();
+	    return true;
+	}
+    }
+    return false;
+}
+
+void TaskPool::Work( int worker )
+{
+    int task;
+    while (Take( worker, &task )) {
+	body( task, worker );
+	remaining.fetch_sub( 1, std::memory_order_release );
+    }
+}
+
+void TaskPool::WorkerMain( int worker )
+{
+    unsigned seen = 0;
+    for (;;) {
+	{
+	    std::unique_lock<std::mutex> guard( lock );
+	    while (!stop && job == seen) wake.wait( guard );
+	    if (stop) return;
+	    seen = job;
+	}
+	Work( worker );
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef __TASKPOOL_H__
+#define __TASKPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//----------------------------------------------------------------------------
+//
+//  TaskPool - fork/join pool with work stealing
+//
+//    ParallelFor() deals the task indices round-robin onto one deque per
+//    worker.  Each worker pops from the back of its own deque and, once
+//    that is empty, steals from the front of the others, so a few
+//    expensive tasks (a chunk of helicopters) don't leave the rest of the
+//    pool idle.  The calling thread works as worker 0 and returns only
+//    once every task has finished.
+//
+//    Tasks must not call ParallelFor() themselves, and GL calls stay on
+//    the caller: workers have no context.
+//
+
+class TaskPool {
+public:
+    typedef std::function<void( int task, int worker )>  Body;
+
+    explicit TaskPool( int threads = 0 );  // 0 = one per hardware thread
+    ~TaskPool();
+
+    int  Threads() const { return int(queues.size()); }  // including the caller
+
+    void ParallelFor( int tasks, const Body& body );
+
+private:
+    TaskPool( const TaskPool& );
+    TaskPool& operator = ( const TaskPool& );
+
+    struct Queue {
+	std::mutex       lock;
+	std::deque<int>  tasks;
+    };
+
+    bool Take( int worker, int* task );
+    void Work( int worker );
+    void WorkerMain( int worker );
+
+    std::vector<Queue*>       queues;
+    std::vector<std::thread>  workers;
+
+    std::mutex               lock;       // guards job and stop
+    std::condition_variable  wake;
+    unsigned                 job;        // bumped for every ParallelFor
+    bool                     stop;
+    Body                     body;
+    std::atomic<int>         remaining;  // tasks not yet finished
+};
+
+#endif // __TASKPOOL_H__
@@ -0,0 +1,95 @@
+#include "Timeline.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+bool Timeline::Load( const char* path, std::string& error )
+{
+    FILE* f = fopen( path, "r" );
+    if (!f) {
+	error = "can't open the file";
+	return false;
+    }
+
+    Clear();
+
+    char text[512], where[32];
+    bool ok = true;
+    for (int line = 1; ok && fgets( text, sizeof(text), f ); ++line) {
+	snprintf( where, sizeof(where), "line %d: ", line );
+	if (char* hash = strchr( text, '#' )) *hash = 0;
+
+	double time;
+	char name[16];
+	int used = 0;
+	if (sscanf( text, " %lf %15s %n", &time, name, &used ) < 2) {
+	    if (sscanf( text, " %15s", name ) == 1) {
+		error = std::string( where ) + "expected a time and a track";
+		ok = false;
+	    }
+	    continue;  // blank
+	}
+
+	int track = -1, more = 0;
+	if (strcmp( name, "camera" ) == 0) track = Camera;
+	else if (strcmp( name, "plane" ) == 0 && sscanf( text + used, "%d %n", &track, &more ) == 1) {
+	    used += more;
+	    if (track < 1 || track >= Tracks) track = -1;
+	}
+	if (track < 0) {
+	    error = std::string( where ) + "the track is camera or plane 1 to 8";
+	    ok = false;
+	    continue;
+	}
+
+	vec3 a, b;
+	char tail[2];
+	if (sscanf( text + used, "%f %f %f %f %f %f %1s", &a.x, &a.y, &a.z,
+		    &b.x, &b.y, &b.z, tail ) != 6) {
+	    error = std::string( where ) + "expected six numbers";
+	    ok = false;
+	    continue;
+	}
+	Add( track, time, a, b );
+    }
+    fclose( f );
+    return ok;
+}
+
+void Timeline::Add( int track, double seconds, const vec3& a, const vec3& b )
+{
+    // Keys may come in any order; equal times keep the order they came in
+    Key key = { seconds, a, b };
+    std::vector<Key>& keys = tracks[track];
+    keys.insert( std::upper_bound( keys.begin(), keys.end(), key,
+				   []( const Key& x, const Key& y ) { return x.time < y.time; } ), key );
+}
+
+void Timeline::Clear()
+{
+    for (int t = 0; t < Tracks; ++t) tracks[t].clear();
+}
+
+void Timeline::Sample( int track, double seconds, vec3* a, vec3* b ) const
+{
+    const std::vector<Key>& keys = tracks[track];
+    size_t i = 0;
+    while (i < keys.size() && keys[i].time <= seconds) ++i;
+
+    if (i == 0) { *a = keys[0].a;  *b = keys[0].b;  return; }
+    if (i == keys.size()) { *a = keys[i-1].a;  *b = keys[i-1].b;  return; }
+
+    const Key& k0 = keys[i-1];
+    const Key& k1 = keys[i];
+    GLfloat s = GLfloat( (seconds - k0.time) / (k1.time - k0.time) );
+    *a = k0.a + (k1.a - k0.a) * s;
+    *b = k0.b + (k1.b - k0.b) * s;
+}
+
+double Timeline::Length() const
+{
+    double length = 0.0;
+    for (int t = 0; t < Tracks; ++t)
+	if (!tracks[t].empty()) length = std::max( length, tracks[t].back().time );
+    return length;
+}
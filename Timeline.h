@@ -0,0 +1,48 @@
+#ifndef __TIMELINE_H__
+#define __TIMELINE_H__
+
+#include "Angel.h"
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------------
+//
+//  Timeline - scripted keys for the camera and the shop floor aircraft
+//
+//    A text file, one key per line, # starting a comment:
+//
+//	# seconds  track    values
+//	0          camera   0 10 20   0 0 2      eye, then the point looked at
+//	4.5        camera   12 4 8    0 0 0
+//	0          plane 3  -4.5 0 0  0 0 0      position, then rotation (degrees)
+//	2          plane 3  -4.5 3 0  -20 0 0
+//
+//    Keys can also be added in code with Add().  Track 0 is the camera and
+//    track n the aircraft selected with key n, so planes are numbered 1
+//    to 8.  Sample() interpolates linearly between the keys of a track
+//    that Has() any and holds the first and last ones beyond them.
+//
+
+class Timeline {
+public:
+    enum { Camera = 0, Tracks = 9 };
+
+    Timeline() {}
+
+    bool   Load( const char* path, std::string& error );
+    void   Add( int track, double seconds, const vec3& a, const vec3& b );
+    void   Clear();
+    bool   Has( int track ) const { return !tracks[track].empty(); }
+    void   Sample( int track, double seconds, vec3* a, vec3* b ) const;
+    double Length() const;  // seconds to the last key of any track
+
+private:
+    struct Key {
+	double  time;
+	vec3    a, b;
+    };
+
+    std::vector<Key> tracks[Tracks];
+};
+
+#endif // __TIMELINE_H__
@@ -0,0 +1,490 @@
+// bench_math: microbenchmarks and checks for the Angel math (vec.h, mat.h)
+// on their own, with no window or GL context; the GL headers only supply
+// GLfloat. Build it next to the shop:
+//
+//     g++ -std=c++17 -O2 bench_math.cpp -o bench_math
+//
+// Usage: bench_math [--test] [--filter TEXT] [--min-time SECONDS]
+//
+// The checks run first; if any fails the program exits 1 without timing
+// anything, and --test stops after them. Each benchmark whose name contains
+// --filter is timed the Google Benchmark way: the iteration count grows
+// until one run lasts --min-time (default 0.1 s), then the best of five
+// such runs is reported in ns per operation. Operands cycle through a few
+// hundred random values so nothing folds into a constant.
+
+#include "Angel.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+// GCC's GNU dialects (the default -std=gnu++) contract the scalar kernels
+// into FMAs when FMA is enabled, and then they only match within rounding
+#if defined(__FMA__) && !defined(__STRICT_ANSI__) && !defined(_MSC_VER)
+#  define BENCH_MATH_CONTRACTED
+#endif
+
+//----------------------------------------------------------------------------
+// Harness
+
+std::string filter;
+double      min_time = 0.1;
+
+// Make the compiler produce value even though nothing reads it
+template <class T>
+inline void Keep(const T& value) {
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile char sink;
+    sink = *(const volatile char*)&value;
+#endif
+}
+
+double RunNs(const std::function<void(long long)>& body, long long n) {
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    body(n);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Time body(n), n operations, per operation; 'per' divides further, for
+// benchmarks where one operation is a batch
+void Bench(const char* name, const std::function<void(long long)>& body, int per = 1) {
+    if (!filter.empty() && !strstr(name, filter.c_str())) return;
+
+    long long n = 1;
+    double ns = RunNs(body, n);
+    while (ns < min_time * 1e9 && n < (1LL << 32)) {
+        double grow = ns > 0.0 ? 1.4 * min_time * 1e9 / ns : 10.0;
+        n = (long long)(n * std::max(2.0, std::min(10.0, grow)));
+        ns = RunNs(body, n);
+    }
+    double best = ns;
+    for (int run = 1; run < 5; ++run) best = std::min(best, RunNs(body, n));
+    printf("%-32s %10.2f ns %14lld\n", name, best / n / per, n);
+}
+
+//----------------------------------------------------------------------------
+// Inputs
+
+const int inputs = 256; // a power of two, see Pick()
+
+std::vector<mat4>   mats;
+std::vector<affine> affines;
+std::vector<vec4>   vec4s;
+std::vector<vec3>   vec3s;
+std::vector<float>  angles;
+
+inline int Pick(long long i) { return int(i & (inputs - 1)); }
+
+unsigned seed = 12345;
+
+float Random(float lo, float hi) {
+    seed = seed * 1664525u + 1013904223u;
+    return lo + (hi - lo) * float(seed >> 8) / float(1 << 24);
+}
+
+void MakeInputs() {
+    for (int i = 0; i < inputs; ++i) {
+        vec3 p(Random(-50, 50), Random(-5, 5), Random(-50, 50));
+        affine a = affine().translate(p).rotateY(Random(0, 360)).rotateX(Random(-30, 30)).scale(Random(0.5, 2), Random(0.5, 2), Random(0.5, 2));
+        affines.push_back(a);
+        mat4 m;
+        for (int r = 0; r < 4; ++r)
+            m[r] = vec4(Random(-2, 2), Random(-2, 2), Random(-2, 2), Random(-2, 2));
+        mats.push_back(m);
+        vec4s.push_back(vec4(Random(-10, 10), Random(-10, 10), Random(-10, 10), 1.0));
+        vec3s.push_back(vec3(Random(-10, 10), Random(-10, 10), Random(-10, 10)));
+        angles.push_back(Random(0, 360));
+    }
+}
+
+//----------------------------------------------------------------------------
+// Rig chains
+// The same work as main.cpp's UpdateChunk() and SceneGraph::Update() for
+// one jet (BuildJet) and one drone (BuildDrone): pose the root from the
+// entity, spin the pivots, then each node's world = parent world * local.
+
+affine RootPose(const vec3& position, const vec3& rotation) {
+    affine root = affine().translate(position);
+    root.rotateY(rotation.y);
+    root.rotateX(rotation.x);
+    root.rotateZ(rotation.z);
+    return root;
+}
+
+const int jet_nodes = 11, drone_nodes = 12;
+
+struct JetRig {
+    affine body, wings, tail, engine_base[2], engine, gear_leg, wheel;
+
+    JetRig() :
+        body(affine().scale(1.0, 1.0, 3.0)),
+        wings(affine().scale(4.0, 0.1, 1.0)),
+        tail(affine().translate(0, 0.5, 1.2).rotateX(-45).scale(1.5, 0.1, 0.8)),
+        engine(affine().scale(0.3, 0.3, 1.0)),
+        gear_leg(affine().translate(0, -0.8, -1.0).scale(0.1, 0.5, 0.1)),
+        wheel(affine().translate(0, -1.0, -1.0).rotateY(90).scale(0.3, 0.3, 0.1)) {
+        engine_base[0] = affine().translate(-1.0, -0.2, 0.5);
+        engine_base[1] = affine().translate(1.0, -0.2, 0.5);
+    }
+
+    void Pose(const vec3& position, const vec3& rotation, float spin, affine* world) const {
+        world[0] = RootPose(position, rotation);
+        world[1] = world[0] * body;
+        world[2] = world[0] * wings;
+        world[3] = world[0] * tail;
+        for (int e = 0; e < 2; ++e) {
+            affine pivot = engine_base[e];
+            pivot.rotateZ(spin);
+            world[4 + 2*e] = world[0] * pivot;
+            world[5 + 2*e] = world[4 + 2*e] * engine;
+        }
+        world[8] = world[0] * affine(); // landing gear toggle
+        world[9] = world[8] * gear_leg;
+        world[10] = world[8] * wheel;
+    }
+};
+
+struct DroneRig {
+    affine body, arm[2], prop_base[4], disc;
+
+    DroneRig() :
+        body(affine().scale(0.5, 0.2, 0.5)),
+        disc(affine().scale(0.4, 0.05, 0.4)) {
+        arm[0] = affine().rotateY(45).scale(2.0, 0.1, 0.1);
+        arm[1] = affine().rotateY(-45).scale(2.0, 0.1, 0.1);
+        float rots[4] = {45, 135, 225, 315};
+        for (int i = 0; i < 4; i++)
+            prop_base[i] = affine().translate(cos(rots[i]*DegreesToRadians), 0.1, sin(rots[i]*DegreesToRadians));
+    }
+
+    void Pose(const vec3& position, const vec3& rotation, float spin, affine* world) const {
+        world[0] = RootPose(position, rotation);
+        world[1] = world[0] * body;
+        world[2] = world[0] * arm[0];
+        world[3] = world[0] * arm[1];
+        for (int i = 0; i < 4; i++) {
+            affine pivot = prop_base[i];
+            pivot.rotateY(i % 2 == 0 ? spin : -spin);
+            world[4 + 2*i] = world[0] * pivot;
+            world[5 + 2*i] = world[4 + 2*i] * disc;
+        }
+    }
+};
+
+//----------------------------------------------------------------------------
+// Checks
+
+int checks = 0, failures = 0;
+
+void Check(bool ok, const char* what) {
+    ++checks;
+    if (!ok) {
+        ++failures;
+        printf("FAIL %s\n", what);
+    }
+}
+
+bool Near(float a, float b, float tolerance = 1e-5f) {
+    return fabs(a - b) <= tolerance * (1.0f + fabs(b));
+}
+
+bool Near(const vec4& a, const vec4& b, float tolerance = 1e-5f) {
+    return Near(a.x, b.x, tolerance) && Near(a.y, b.y, tolerance) &&
+           Near(a.z, b.z, tolerance) && Near(a.w, b.w, tolerance);
+}
+
+bool Near(const mat4& a, const mat4& b, float tolerance = 1e-5f) {
+    for (int r = 0; r < 4; ++r)
+        if (!Near(a[r], b[r], tolerance)) return false;
+    return true;
+}
+
+// The SIMD kernels against the scalar reference ones
+void CheckKernels() {
+    bool near = true, exact = true;
+    for (int i = 0; i < inputs; ++i) {
+        const mat4& a = mats[i];
+        const mat4& b = mats[(i + 1) % inputs];
+        mat4 simd, scalar;
+        Mat4Mul(simd, a, b);
+        Mat4MulScalar(scalar, a, b);
+        near = near && Near(simd, scalar);
+        exact = exact && memcmp(&simd, &scalar, sizeof(mat4)) == 0;
+
+        vec4 v = vec4s[i], sv, rv;
+        Mat4MulVec4(sv, a, v);
+        Mat4MulVec4Scalar(rv, a, v);
+        near = near && Near(sv, rv);
+        exact = exact && memcmp(&sv, &rv, sizeof(vec4)) == 0;
+
+        mat4 product = a * b; // the operator goes through Mat4Mul
+        near = near && Near(product, scalar);
+    }
+    Check(near, "Mat4Mul/Mat4MulVec4 match the scalar kernels");
+
+    // An odd count, so the AVX two-at-a-time loop leaves a tail
+    const int n = 37;
+    std::vector<vec4> out(n), in(vec4s.begin(), vec4s.begin() + n);
+    TransformPoints(mats[0], &in[0], &out[0], n);
+    bool points = true;
+    for (int p = 0; p < n; ++p) points = points && Near(out[p], mats[0] * in[p]);
+    Check(points, "TransformPoints matches mat4 * vec4 per point");
+    TransformPoints(mats[0], &in[0], &in[0], n);
+    Check(memcmp(&in[0], &out[0], n * sizeof(vec4)) == 0, "TransformPoints in place");
+
+#ifdef BENCH_MATH_CONTRACTED
+    printf("kernels (%s): FMA contraction, compared within rounding\n", ANGEL_SIMD_NAME);
+#else
+    Check(exact, "SIMD kernels bit-identical to the scalar kernels");
+#endif
+}
+
+void CheckTransforms() {
+    const vec4 x(1, 0, 0, 0), y(0, 1, 0, 0), z(0, 0, 1, 0), o(0, 0, 0, 1);
+    Check(Near(RotateX(90) * y, z), "RotateX(90) turns y into z");
+    Check(Near(RotateY(90) * z, x), "RotateY(90) turns z into x");
+    Check(Near(RotateZ(90) * x, y), "RotateZ(90) turns x into y");
+    Check(Near(Translate(1, 2, 3) * o, vec4(1, 2, 3, 1)), "Translate moves points");
+    Check(Near(Translate(1, 2, 3) * x, x), "Translate leaves directions");
+    Check(Near(Scale(2, 3, 4) * vec4(1, 1, 1, 1), vec4(2, 3, 4, 1)), "Scale");
+
+    // In-place mutators post-multiply, like the factories would
+    bool mutators = true, affines_ok = true;
+    for (int i = 0; i < inputs; ++i) {
+        const mat4& m = mats[i];
+        float t = angles[i];
+        const vec3& v = vec3s[i];
+        mutators = mutators && Near(mat4(m).rotateX(t), m * RotateX(t)) &&
+                   Near(mat4(m).rotateY(t), m * RotateY(t)) &&
+                   Near(mat4(m).rotateZ(t), m * RotateZ(t)) &&
+                   Near(mat4(m).translate(v), m * Translate(v)) &&
+                   Near(mat4(m).scale(v.x, v.y, v.z), m * Scale(v));
+
+        const affine& a = affines[i];
+        const affine& b = affines[(i + 7) % inputs];
+        affines_ok = affines_ok && Near(mat4(a * b), mat4(a) * mat4(b), 1e-4f) &&
+                     Near(affine(a).rotateZ(t) * vec4s[i], mat4(a) * RotateZ(t) * vec4s[i], 1e-4f);
+    }
+    Check(mutators, "mat4 rotate/translate/scale match the factories");
+    Check(affines_ok, "affine products match mat4 products");
+}
+
+void CheckCamera() {
+    const vec4 eye(3, 10, 20, 1), at(0, 0, 2, 1), up(0, 1, 0, 0);
+    mat4 view = LookAt(eye, at, up);
+    Check(Near(view * eye, vec4(0, 0, 0, 1)), "LookAt puts the eye at the origin");
+    float distance = length(vec3(at.x - eye.x, at.y - eye.y, at.z - eye.z));
+    Check(Near(view * at, vec4(0, 0, -distance, 1), 1e-4f), "LookAt looks down -z");
+    bool orthonormal = true;
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c) {
+            vec3 a(view[r].x, view[r].y, view[r].z), b(view[c].x, view[c].y, view[c].z);
+            orthonormal = orthonormal && Near(dot(a, b), r == c ? 1.0f : 0.0f);
+        }
+    Check(orthonormal, "LookAt rotation is orthonormal");
+
+    const float zNear = 0.5, zFar = 300.0;
+    mat4 projection = Perspective(45.0, 4.0 / 3.0, zNear, zFar);
+    vec4 n = projection * vec4(0, 0, -zNear, 1), f = projection * vec4(0, 0, -zFar, 1);
+    Check(Near(n.z / n.w, -1.0f) && Near(f.z / f.w, 1.0f, 1e-4f), "Perspective maps near/far to -1/+1");
+    vec4 edge = projection * vec4(0, zNear * tan(22.5 * DegreesToRadians), -zNear, 1);
+    Check(Near(edge.y / edge.w, 1.0f), "Perspective fovy reaches the top edge");
+}
+
+void CheckVectors() {
+    bool unit = true, orthogonal = true;
+    for (int i = 0; i < inputs; ++i) {
+        const vec3& a = vec3s[i];
+        const vec3& b = vec3s[(i + 1) % inputs];
+        unit = unit && Near(length(normalize(a)), 1.0f) && Near(length(normalize(vec4s[i])), 1.0f);
+        vec3 c = cross(a, b);
+        orthogonal = orthogonal && fabs(dot(c, a)) <= 1e-3f * length(a) * length(c) + 1e-4f &&
+                     fabs(dot(c, b)) <= 1e-3f * length(b) * length(c) + 1e-4f;
+    }
+    Check(unit, "normalize gives unit length");
+    Check(orthogonal, "cross is orthogonal to both operands");
+    vec3 k = cross(vec3(1, 0, 0), vec3(0, 1, 0));
+    Check(Near(k.x, 0) && Near(k.y, 0) && Near(k.z, 1), "cross is right-handed");
+}
+
+// The rig chains against the same products spelled with mat4 factories
+void CheckRigs() {
+    JetRig jet;
+    DroneRig drone;
+    bool jet_ok = true, drone_ok = true;
+    affine world[drone_nodes];
+    for (int i = 0; i < inputs; ++i) {
+        vec3 position = vec3s[i] * 5.0, rotation(angles[i], angles[(i + 1) % inputs], angles[(i + 2) % inputs]);
+        float spin = angles[(i + 3) % inputs];
+        mat4 root = Translate(position) * RotateY(rotation.y) * RotateX(rotation.x) * RotateZ(rotation.z);
+
+        jet.Pose(position, rotation, spin, world);
+        mat4 engine = root * Translate(1.0, -0.2, 0.5) * RotateZ(spin) * Scale(0.3, 0.3, 1.0);
+        mat4 tail = root * Translate(0, 0.5, 1.2) * RotateX(-45) * Scale(1.5, 0.1, 0.8);
+        jet_ok = jet_ok && Near(mat4(world[7]), engine, 1e-4f) && Near(mat4(world[3]), tail, 1e-4f);
+
+        drone.Pose(position, rotation, spin, world);
+        float x = cos(135 * DegreesToRadians), z = sin(135 * DegreesToRadians);
+        mat4 disc = root * Translate(x, 0.1, z) * RotateY(-spin) * Scale(0.4, 0.05, 0.4);
+        drone_ok = drone_ok && Near(mat4(world[7]), disc, 1e-4f);
+    }
+    Check(jet_ok, "jet chain matches the mat4 product");
+    Check(drone_ok, "drone chain matches the mat4 product");
+}
+
+//----------------------------------------------------------------------------
+
+int main(int argc, char **argv) {
+    bool test_only = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--test") == 0) {
+            test_only = true;
+        } else if (strcmp(argv[i], "--filter") == 0 && i+1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--min-time") == 0 && i+1 < argc) {
+            min_time = std::max(0.001, atof(argv[++i]));
+        } else {
+            fprintf(stderr, "usage: %s [--test] [--filter TEXT] [--min-time SECONDS]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    MakeInputs();
+    CheckKernels();
+    CheckTransforms();
+    CheckCamera();
+    CheckVectors();
+    CheckRigs();
+    printf("%d checks, %d failed\n", checks, failures);
+    if (failures) return 1;
+    if (test_only) return 0;
+
+    printf("\n%-32s %13s %14s\n", "Benchmark", "Time", "Iterations");
+
+    Bench("mat4 * mat4", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(mats[Pick(i)] * mats[Pick(i + 1)]);
+    });
+    Bench("mat4 * vec4", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(mats[Pick(i)] * vec4s[Pick(i)]);
+    });
+    Bench("affine * affine", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(affines[Pick(i)] * affines[Pick(i + 1)]);
+    });
+    Bench("affine * vec4", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(affines[Pick(i)] * vec4s[Pick(i)]);
+    });
+    const int batch = 1024;
+    std::vector<vec4> points(batch), moved(batch);
+    for (int p = 0; p < batch; ++p) points[p] = vec4s[Pick(p)];
+    Bench("TransformPoints (per point)", [&](long long n) {
+        for (long long i = 0; i < n; ++i) {
+            TransformPoints(mats[Pick(i)], &points[0], &moved[0], batch);
+            Keep(moved[0]);
+        }
+    }, batch);
+
+    Bench("LookAt", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(LookAt(vec4s[Pick(i)], vec4s[Pick(i + 1)], vec4(0, 1, 0, 0)));
+    });
+    Bench("Perspective", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(Perspective(30.0 + angles[Pick(i)] / 8, 4.0 / 3.0, 0.5, 300.0));
+    });
+    Bench("Perspective * LookAt", [](long long n) {
+        for (long long i = 0; i < n; ++i)
+            Keep(Perspective(45.0, 4.0 / 3.0, 0.5, 300.0) * LookAt(vec4s[Pick(i)], vec4s[Pick(i + 1)], vec4(0, 1, 0, 0)));
+    });
+    Bench("RotateX", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(RotateX(angles[Pick(i)]));
+    });
+    Bench("RotateY", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(RotateY(angles[Pick(i)]));
+    });
+    Bench("RotateZ", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(RotateZ(angles[Pick(i)]));
+    });
+    Bench("mat4 * RotateY", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(mats[Pick(i)] * RotateY(angles[Pick(i)]));
+    });
+    Bench("mat4.rotateY (in place)", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(mat4(mats[Pick(i)]).rotateY(angles[Pick(i)]));
+    });
+    Bench("affine.rotateY (in place)", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(affine(affines[Pick(i)]).rotateY(angles[Pick(i)]));
+    });
+    Bench("normalize(vec3)", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(normalize(vec3s[Pick(i)]));
+    });
+    Bench("normalize(vec4)", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(normalize(vec4s[Pick(i)]));
+    });
+    Bench("cross", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(cross(vec3s[Pick(i)], vec3s[Pick(i + 1)]));
+    });
+
+    // A part as the old immediate-mode Draw<model> helpers made it: a mat4
+    // chain off the aircraft's matrix, pushed into an instance batch. The
+    // propeller plane has four, two under the spinning propeller.
+    std::vector<mat4> parts;
+    parts.reserve(4);
+    Bench("prop plane chain (per part)", [&](long long n) {
+        for (long long i = 0; i < n; ++i) {
+            const mat4& mt = mats[Pick(i)];
+            parts.clear();
+            parts.push_back(mat4(mt).scale(1, 1, 2.5));
+            mat4 prop = mat4(mt).translate(0, 0, -1.3).rotateZ(angles[Pick(i)]);
+            parts.push_back(mat4(prop).scale(2.0, 0.1, 0.1));
+            parts.push_back(mat4(prop).scale(0.1, 2.0, 0.1));
+            parts.push_back(mat4(mt).translate(0, 0.2, -0.5).scale(3.5, 0.1, 0.8));
+            Keep(parts[3]);
+        }
+    }, 4);
+    Bench("Translate() + push", [&](long long n) {
+        for (long long i = 0; i < n; ++i) {
+            parts.clear();
+            parts.push_back(Translate(vec3s[Pick(i)]));
+            Keep(parts[0]);
+        }
+    });
+    Bench("copy + translate + scale", [](long long n) {
+        for (long long i = 0; i < n; ++i) Keep(mat4(mats[Pick(i)]).translate(vec3s[Pick(i)]).scale(2.0, 0.1, 0.1));
+    });
+    std::vector<mat4> copied;
+    Bench("vector<mat4> copy (per matrix)", [&](long long n) {
+        for (long long i = 0; i < n; ++i) {
+            copied = mats;
+            Keep(copied[0]);
+        }
+    }, inputs);
+
+    Bench("root pose (translate+rotateYXZ)", [](long long n) {
+        for (long long i = 0; i < n; ++i) {
+            vec3 rotation(angles[Pick(i)], angles[Pick(i + 1)], angles[Pick(i + 2)]);
+            Keep(RootPose(vec3s[Pick(i)], rotation));
+        }
+    });
+    JetRig jet;
+    DroneRig drone;
+    Bench("jet rig pose (11 nodes)", [&](long long n) {
+        affine world[jet_nodes];
+        for (long long i = 0; i < n; ++i) {
+            vec3 rotation(0.0, angles[Pick(i)], 0.0);
+            jet.Pose(vec3s[Pick(i)], rotation, angles[Pick(i + 1)], world);
+            Keep(world);
+        }
+    });
+    Bench("drone rig pose (12 nodes)", [&](long long n) {
+        affine world[drone_nodes];
+        for (long long i = 0; i < n; ++i) {
+            vec3 rotation(0.0, angles[Pick(i)], 0.0);
+            drone.Pose(vec3s[Pick(i)], rotation, angles[Pick(i + 1)], world);
+            Keep(world);
+        }
+    });
+    return 0;
+}
@@ -0,0 +1,40 @@
+# Training run for profile-guided optimization: the pgo-train target runs
+# this with PROGRAMS (the toy_shop builds, comma separated), PGO_DIR,
+# COMPILER and, for Clang, LLVM_PROFDATA.
+#
+# Every build runs the --bench scenes headless. One the CPU can't execute
+# (x86-64-v3 on a machine without AVX2) is skipped, and its objects then
+# compile without a profile under TOY_PGO=USE.
+
+string(REPLACE "," ";" PROGRAMS "${PROGRAMS}")
+file(MAKE_DIRECTORY "${PGO_DIR}")
+
+foreach(program IN LISTS PROGRAMS)
+  get_filename_component(name "${program}" NAME_WE)
+  if(COMPILER MATCHES "Clang")
+    file(GLOB stale "${PGO_DIR}/${name}-*.profraw")
+    if(stale)
+      file(REMOVE ${stale})
+    endif()
+    set(ENV{LLVM_PROFILE_FILE} "${PGO_DIR}/${name}-%p.profraw")
+  endif()
+
+  message(STATUS "Training ${name}")
+  execute_process(
+    COMMAND "${program}" --bench --size 640x360 --frames 60
+    RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(WARNING "${name} didn't finish its training run (${result}); it gets no profile")
+    continue()
+  endif()
+
+  if(COMPILER MATCHES "Clang")
+    file(GLOB raw "${PGO_DIR}/${name}-*.profraw")
+    execute_process(
+      COMMAND "${LLVM_PROFDATA}" merge -o "${PGO_DIR}/${name}.profdata" ${raw}
+      RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+      message(FATAL_ERROR "llvm-profdata couldn't merge the profiles of ${name}")
+    endif()
+  endif()
+endforeach()
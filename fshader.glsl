@@ -1,8 +1,82 @@
-#version 120
+#version 330
 
-varying vec4 color;
+// NUM_LIGHTS, the size of the Lights block, is defined by the program
+// that loads this shader (see InitShader's defines)
+
+in vec3 fPosition;
+in vec3 fNormal;
+
+flat in vec4 ambientProduct, diffuseProduct, specularProduct;
+flat in float shininess;
+
+out vec4 fragColor;
+
+// Lights in eye space, rewritten once a frame (LightGrid's GridLight).
+// position.w is the range, 0 for a directional light; color scales the
+// diffuse and specular products; spot is the cone's axis and the cosine of
+// its half angle, -1 for a light shining all round.
+struct Light {
+    vec4 position;
+    vec4 color;
+    vec4 spot;
+};
+
+layout(std140) uniform Lights {
+    Light light[NUM_LIGHTS];
+};
+
+// The view frustum cut into clusters, and the lights that reach each one
+uniform usamplerBuffer ClusterRecords;  // per cluster: start in ClusterLights, count
+uniform usamplerBuffer ClusterLights;   // light numbers
+uniform ivec3 ClusterCount;             // tiles across, tiles down, depth slices
+uniform vec2  ClusterTile;              // tile size in pixels
+uniform vec2  ClusterDepth;             // slice = log(depth) * x + y
 
 void main()
 {
-    gl_FragColor = color;
+    vec3 N = normalize( fNormal );
+    vec3 E = normalize( -fPosition );
+
+    vec4 color = ambientProduct;
+
+    // Only the lights listed for this fragment's cluster
+    ivec3 c = ivec3( vec3( gl_FragCoord.xy / ClusterTile,
+			   log( -fPosition.z ) * ClusterDepth.x + ClusterDepth.y ) );
+    c = clamp( c, ivec3(0), ClusterCount - 1 );
+    uvec2 run = texelFetch( ClusterRecords, (c.z*ClusterCount.y + c.y)*ClusterCount.x + c.x ).xy;
+
+#ifdef SHOW_CLUSTERS
+    // Heat map variant: blue for no lights up to red for 16 or more
+    float heat = min( float(run.y) / 16.0, 1.0 );
+    fragColor = vec4( mix( vec3(0.0, 0.0, 1.0), vec3(1.0, 0.0, 0.0), heat ) * (0.4 + 0.6 * max(dot(N, E), 0.0)), 1.0 );
+    return;
+#endif
+
+    for (uint k = 0u; k < run.y; ++k) {
+	int i = int( texelFetch( ClusterLights, int(run.x + k) ).r );
+	vec4 p = light[i].position;
+	vec3 L = normalize( p.xyz );
+	float attenuation = 1.0;
+
+	if (p.w > 0.0) {
+	    // Fades smoothly to nothing at the range, past which no cluster lists it
+	    vec3 d = p.xyz - fPosition;
+	    float x = min( dot(d, d) / (p.w * p.w), 1.0 );
+	    attenuation = (1.0 - x*x) * (1.0 - x*x);
+	    L = normalize( d );
+
+	    vec4 s = light[i].spot;
+	    if (s.w > -1.0)
+		attenuation *= smoothstep( s.w, mix(s.w, 1.0, 0.25), dot(-L, s.xyz) );
+	}
+	vec3 H = normalize( L + E );
+
+	// Blinn-Phong; no highlight on faces turned away from the light
+	float Kd = max( dot(L, N), 0.0 );
+	float Ks = Kd > 0.0 ? pow( max(dot(N, H), 0.0), shininess ) : 0.0;
+
+	color += attenuation * light[i].color * (Kd * diffuseProduct + Ks * specularProduct);
+    }
+
+    fragColor = vec4( color.rgb, 1.0 );
 }
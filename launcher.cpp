@@ -0,0 +1,78 @@
+// launcher: what CMake builds as toy_shop, bench_math and test_mat on
+// x86-64. The programs themselves are built once per instruction set level (mat.h
+// picks its SIMD kernels at compile time), as NAME-x86-64, NAME-x86-64-v2
+// and NAME-x86-64-v3 next to this one; the launcher runs the highest level
+// the CPU supports with the same arguments. TOY_SHOP_ISA=x86-64, x86-64-v2
+// or x86-64-v3 picks one instead, e.g. to compare them.
+//
+// It prints nothing on success, so `toy_shop --headless --capture -` still
+// streams only frames.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#ifndef LAUNCH_PROGRAM
+#  define LAUNCH_PROGRAM "toy_shop"
+#endif
+
+// Highest level the CPU (and the OS, for the AVX registers) supports. The
+// level is checked as a whole: -march=x86-64-v3 also lets the compiler use
+// F16C, LZCNT and MOVBE, which a VM can hide while it shows AVX2.
+const char* BestLevel() {
+    __builtin_cpu_init();
+#if (defined(__clang__) && __clang_major__ >= 16) || \
+    (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 12)
+    if (__builtin_cpu_supports("x86-64-v3")) return "x86-64-v3";
+    if (__builtin_cpu_supports("x86-64-v2")) return "x86-64-v2";
+#else
+    // Older compilers know only the features; CX16 has no name there
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+        __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2") &&
+        __builtin_cpu_supports("f16c") && __builtin_cpu_supports("lzcnt") &&
+        __builtin_cpu_supports("movbe"))
+        return "x86-64-v3";
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("sse4.1") &&
+        __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("popcnt"))
+        return "x86-64-v2";
+#endif
+    return "x86-64";
+}
+
+// Directory this executable is in, with a trailing slash; empty if unknown,
+// so the variant is looked up on the PATH like the launcher was
+std::string OwnDirectory(const char* argv0) {
+    std::string path;
+#if defined(__linux__)
+    char buffer[4096];
+    ssize_t n = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
+    if (n > 0) path.assign(buffer, n);
+#endif
+    if (path.empty() && strchr(argv0, '/')) path = argv0;
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
+
+int main(int argc, char **argv) {
+    const char* level = getenv("TOY_SHOP_ISA");
+    if (level && *level && strcmp(level, "x86-64") != 0 && strcmp(level, "x86-64-v2") != 0 &&
+        strcmp(level, "x86-64-v3") != 0) {
+        fprintf(stderr, "TOY_SHOP_ISA is x86-64, x86-64-v2 or x86-64-v3, not %s\n", level);
+        return 1;
+    }
+    if (!level || !*level) level = BestLevel();
+
+    // The variant sees its own name as argv[0], so --bench starts its
+    // scene processes from it directly
+    std::string program = OwnDirectory(argv[0]) + LAUNCH_PROGRAM "-" + level;
+    std::vector<char*> args(argv, argv + argc + 1);
+    args[0] = &program[0];
+    execvp(program.c_str(), &args[0]);
+
+    fprintf(stderr, "%s: can't run %s: %s\n", LAUNCH_PROGRAM, program.c_str(), strerror(errno));
+    return 127;
+}
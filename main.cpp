@@ -1,8 +1,40 @@
 #include "Angel.h"
-#include "InitShader.cpp" // Including implementation for single-file compile convenience
-#include <stack>
+#include "BVH.h"
+#include "EntityStore.h"
+#include "FrameCapture.h"
+#include "FrameClock.h"
+#include "GLState.h"
+#include "LightGrid.h"
+#include "Mesh.h"
+#include "MeshCache.h"
+#include "ModelStream.h"
+#include "Offscreen.h"
+#include "Profiler.h"
+#include "RenderQueue.h"
+#include "SceneGraph.h"
+#include "ShaderManager.h"
+#include "StreamBuffer.h"
+#include "TaskPool.h"
+#include "Timeline.h"
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
 #include <vector>
 
+#if defined(_WIN32)
+#  include <GL/wglew.h>
+#  define popen _popen
+#  define pclose _pclose
+#elif !defined(__APPLE__)
+#  include <GL/glxew.h>
+#endif
+
 //----------------------------------------------------------------------------
 // Types and Constants
 //----------------------------------------------------------------------------
@@ -20,17 +52,19 @@ const int NumVerticesCylinder = 360; // Approximate
 // 2. Cylinder (Radius 0.5, Height 1, centered)
 // 3. Cone (Radius 0.5, Height 1)
 
-// Geometry Data
-std::vector<point4> points;
-std::vector<vec3>   normals;
-std::vector<color4> colors; // Optional if we use material uniforms
-
 // Shader Uniform Locations
 GLuint  ModelLoc, ViewLoc, ProjectionLoc;
 GLuint  AmbientProductLoc, DiffuseProductLoc, SpecularProductLoc;
-GLuint  LightPositionLoc, ShininessLoc;
+GLuint  ShininessLoc;
 GLuint  program;
 
+// Shader Variants
+// Programs come from the shader manager (binary cache, rebuilt when the
+// .glsl files change); 'h' switches between the lit shop and a heat map of
+// how many lights each cluster lists
+ShaderManager shaders;
+int lit_variant, heat_variant, shader_variant;
+
 // Viewing Parameters
 GLfloat radius = 10.0;
 GLfloat theta = 0.0;
@@ -45,10 +79,38 @@ vec4 at( 0.0, 0.0, 2.0, 1.0 );
 vec4 up( 0.0, 1.0, 0.0, 0.0 );
 
 // Lighting Parameters
-point4 light_position( 10.0, 10.0, 10.0, 1.0 );
-color4 light_ambient( 0.2, 0.2, 0.2, 1.0 );
-color4 light_diffuse( 1.0, 1.0, 1.0, 1.0 );
-color4 light_specular( 1.0, 1.0, 1.0, 1.0 );
+// Parts are lit per fragment, in a single pass, by the lights of their
+// cluster of the view frustum (LightGrid). There are light_count lights
+// (--lights N): the room's own first, then spots over the shop floor.
+// Positions are in world space with w = 0 for a directional light; each
+// frame they are moved into eye space, sorted into the clusters on the
+// worker threads and uploaded with the cluster lists.
+struct Light {
+    point4  position;
+    color4  color;  // scales the material's diffuse and specular
+    GLfloat range;  // lights nothing farther away; unused for directional lights
+    vec3    axis;   // spot lights: direction the cone opens towards
+    GLfloat cone;   // spot lights: half angle in degrees, 0 for all round
+};
+
+const int   MAX_LIGHTS = 256; // 48 bytes each in the uniform block, GL promises 16 KB
+const int   ROOM_LIGHTS = 8;
+const Light room_lights[ROOM_LIGHTS] = {
+    { point4( 10.0, 10.0, 10.0, 1.0 ),  color4( 0.75, 0.75, 0.75, 1.0 ),  60.0, vec3(), 0.0 }, // key, over the counter
+    { point4( -0.5, 0.6, -0.4, 0.0 ),   color4( 0.1, 0.12, 0.18, 1.0 ),   0.0,  vec3(), 0.0 }, // cool fill from behind
+    { point4( -8.0, 3.0, -6.0, 1.0 ),   color4( 0.15, 0.1, 0.04, 1.0 ),   20.0, vec3(), 0.0 }, // warm, left shelf
+    { point4( 8.0, 3.0, -6.0, 1.0 ),    color4( 0.15, 0.1, 0.04, 1.0 ),   20.0, vec3(), 0.0 }, // warm, right shelf
+    { point4( 0.0, 6.0, 12.0, 1.0 ),    color4( 0.1, 0.1, 0.1, 1.0 ),     40.0, vec3(), 0.0 }, // front
+    { point4( -15.0, 2.0, 5.0, 1.0 ),   color4( 0.05, 0.08, 0.05, 1.0 ),  35.0, vec3(), 0.0 },
+    { point4( 15.0, 2.0, -15.0, 1.0 ),  color4( 0.08, 0.05, 0.05, 1.0 ),  35.0, vec3(), 0.0 },
+    { point4( 0.0, -1.0, 0.0, 0.0 ),    color4( 0.05, 0.05, 0.05, 1.0 ),  0.0,  vec3(), 0.0 }, // floor bounce
+};
+std::vector<Light>     lights;     // light_count of them, see PlaceLights()
+std::vector<GridLight> eye_lights; // this frame's, as the shaders read them
+int       light_count = 4;
+GLuint    light_buffer; // uniform buffer behind the shaders' Lights block
+LightGrid light_grid;
+GLuint    ClusterTileLoc, ClusterDepthLoc;
 
 color4 material_ambient( 1.0, 0.0, 1.0, 1.0 );
 color4 material_diffuse( 1.0, 0.8, 0.0, 1.0 );
@@ -60,39 +122,218 @@ bool light_on = true;
 
 // Control State
 int selected_object = 0; // 0=None, 1-8=Planes
-struct ObjectState {
-    vec3 position; // x, y, z
-    vec3 rotation; // pitch, yaw, roll (x, y, z)
-    float propeller_angle;
-    float propeller_speed;
-    float aux_angle; // generic aux (e.g. wheels, door)
-    bool  aux_state; // open/close
-};
 
-ObjectState planes[9]; // 1-based index (1..8)
+// Aircraft State
+// Every aircraft lives in the SoA store; planes[] holds the handles of the
+// eight on the shop floor, the rest (--fleet N) fill the warehouse.
+EntityStore fleet;
+Entity planes[9]; // 1-based index (1..8)
+int fleet_size = 0;
 
 // Global Time
 float time_of_day = 12.0f; // 0-24
 float rotation_global = 0.0f;
 
-// Matrix Stack for Hierarchy
-std::stack<mat4> mvstack;
-mat4 model_view;
+// Frame Loop
+// The simulation runs in fixed 60 Hz steps; frames are paced by a GLUT
+// timer (frame_cap fps, 0 = uncapped) or by SwapBuffers when vsync is on.
+FrameClock sim_clock;
+FrameStats frame_stats;
+int    frame_cap = 60;
+bool   vsync_on = false;
+double next_frame_ms = 0.0;
+bool   frame_pending = false;
+
+// Headless Capture
+// --headless draws into an offscreen framebuffer instead of a window (EGL,
+// so it runs on llvmpipe with no display), reads every frame back for
+// --capture and runs the simulation on a fixed clock of --capture-fps
+// frames a second, so the same arguments always give the same frames.
+// --timeline moves the camera and the shop floor aircraft along scripted keys.
+bool        headless = false;
+int         headless_width = 1024, headless_height = 768;
+int         capture_frames = 0; // 0 = to the timeline's end, or a single frame
+int         capture_fps = 60;
+std::string capture_path;
+std::string timeline_path;
+Offscreen   offscreen;
+FrameCapture capture;
+Timeline    timeline;
+int         headless_ms = 0;    // the fixed clock, see FrameTimeMs()
+
+// Benchmark
+// --bench runs each scene below in a child process of its own (--bench-scene
+// NAME), headless on the fixed clock, so every scene starts from a fresh
+// fleet, light count and shader set. It prints percentiles of the recorded
+// frames' CPU and GPU time with their draw calls and triangles, and
+// --bench-json FILE writes the same as JSON for regression tracking.
+struct BenchScene {
+    const char* name;
+    int         fleet, lights;
+    vec3        eye[2], at[2]; // camera on the first and the last frame
+};
+
+const BenchScene bench_scenes[] = {
+    { "shop",       0,      4,   { vec3(-6, 10, 20), vec3(6, 10, 20) },       { vec3(0, 0, 2), vec3(0, 0, 2) } },
+    { "fleet-1k",   1000,   4,   { vec3(-40, 10, 6), vec3(40, 10, 6) },       { vec3(-20, -4, -40), vec3(20, -4, -40) } },
+    { "fleet-10k",  10000,  4,   { vec3(-40, 10, 6), vec3(40, 10, 6) },       { vec3(-20, -4, -40), vec3(20, -4, -40) } },
+    { "fleet-100k", 100000, 4,   { vec3(-40, 10, 6), vec3(40, 10, 6) },       { vec3(-20, -4, -40), vec3(20, -4, -40) } },
+    { "lights-256", 0,      256, { vec3(-6, 10, 20), vec3(6, 10, 20) },       { vec3(0, 0, 2), vec3(0, 0, 2) } },
+    // Low along the warehouse rows, so parts keep crossing level switch points
+    { "lod-heavy",  10000,  4,   { vec3(-150, -2, -18), vec3(150, -2, -18) }, { vec3(-130, -4, -40), vec3(170, -4, -40) } },
+};
+const int bench_warmup = 10; // frames run before recording starts
+int         bench_frames = 100;
+bool        bench = false;
+std::string bench_scene, bench_json;
+
+// Per-frame measurements while benchmarking
+struct FrameRecord {
+    double update_ms, render_ms;
+    int    draws, triangles, state_calls;
+};
+int                      record_first = -1; // first recorded frame (gpu_query_frame), -1 when off
+std::vector<FrameRecord> frame_records;
+std::vector<double>      gpu_records;
+
+// GPU Timing
+// GL_TIME_ELAPSED around each frame's draws, read back gpu_query_count
+// frames later so the CPU never waits on the GPU for it
+const int gpu_query_count = 4;
+GLuint    gpu_queries[gpu_query_count];
+int       gpu_query_frame = 0;
+
+// Profiling
+// Built with -DTOY_PROFILE, the frame's stages are timed on the CPU and the
+// draws on the GPU (Profiler.h); 'p' shows them as a graph and 't' writes a
+// Chrome trace to trace_path (--trace FILE), as headless runs also do at exit
+std::string trace_path;
+
+// Camera Matrices
 mat4 projection;
 mat4 view_matrix;
 
-// Primitive Offsets
-int offset_cube = 0;
-int count_cube = 0;
-int offset_cyl = 0;
-int count_cyl = 0;
-int offset_cone = 0;
-int count_cone = 0;
+// Geometry Data
+// The generators feed one welded mesh: interleaved 16-byte vertices and a
+// 16-bit index buffer. Each primitive at each level of detail is a batch,
+// drawn from its own range of the indices.
+enum Primitive { PRIM_CUBE, PRIM_CYLINDER, PRIM_CONE, NUM_PRIMITIVES };
+
+// Levels of Detail
+// Cylinders and cones are generated at 64/32/16/8 segments and each part
+// is drawn at the finest level its height on screen still warrants (the
+// cube has one level). A part only changes level once its size is
+// lod_hysteresis past the switch point, so parts near one don't flicker.
+const int   NUM_LODS = 4;
+const int   NUM_BATCHES = NUM_PRIMITIVES * NUM_LODS;
+const int   lod_segments[NUM_LODS] = { 64, 32, 16, 8 };
+const float lod_pixels[NUM_LODS - 1] = { 240.0, 80.0, 24.0 }; // switch points, in pixels tall
+const float lod_hysteresis = 0.15;
+const int   lod_fixed = 1;       // level drawn when selection is off (the old 32 segments)
+bool        lod_on = true;
+float       lod_scale = 0.0;     // pixels tall per unit of radius/distance, this frame
+int         window_width = 1024, window_height = 768;
+std::vector<unsigned char> node_lod; // level each part was last drawn at
+int         triangles_submitted = 0;
+int         draw_calls = 0;
+
+int Batch(int prim, int lod) {
+    if (prim >= NUM_PRIMITIVES) return NUM_BATCHES + prim - NUM_PRIMITIVES; // a loaded model
+    return prim * NUM_LODS + lod;
+}
+
+MeshBuilder mesh;
+MeshRange   batch_range[NUM_BATCHES];
+
+// Generated geometry is saved here and mapped on later launches; bump
+// geometry_version whenever a generator's code changes
+const char*    mesh_cache_path = "primitives.meshcache";
+const unsigned geometry_version = 2;
+
+// Loaded Models
+// Files named with --model are parsed in the background and streamed into
+// an arena after the primitives in the vertex and index buffers. Model m is
+// primitive NUM_PRIMITIVES + m in the scene and batch NUM_BATCHES + m in the
+// draw lists, and its parts are skipped until it has arrived.
+ModelStream              models;
+std::vector<std::string> model_paths;
+const int                model_arena_vertices = 1 << 18; // 4 MB
+const int                model_arena_indices = 3 << 18;  // 1.5 MB
+
+int BatchCount() { return NUM_BATCHES + models.Models(); }
+
+// Index range of a batch and the vertex its indices count from
+MeshRange BatchRange(int b, GLint* base_vertex) {
+    if (b < NUM_BATCHES) {
+        *base_vertex = 0;
+        return batch_range[b];
+    }
+    *base_vertex = models.BaseVertex(b - NUM_BATCHES);
+    return models.Range(b - NUM_BATCHES);
+}
+
+// Draw Lists and Instanced Rendering
+// Worker threads append one InstanceData per visible part into draw lists,
+// each with a sort key (batch, material, depth). The GL thread queues the
+// keys, radix sorts them and submits the parts in that order, either
+// through the per-frame stream ring as one instanced command per batch
+// (a single glMultiDrawElementsIndirect where supported), or part by part
+// with uniforms when instancing is off.
+
+struct InstanceData {
+    vec4   model[4]; // Rows of the Model matrix
+    color4 color;    // Diffuse color, the other material terms derive from it
+};
+
+// Parts of one scene chunk. Lists are per chunk rather than per thread so
+// the submitted order doesn't depend on which worker stole which chunk.
+struct DrawList {
+    std::vector<InstanceData> items;
+    std::vector<GLuint64>     keys; // one per item, see RenderQueue
+};
+
+// Indirect command as glMultiDrawElementsIndirect reads it
+struct DrawCommand {
+    GLuint count, instance_count, first_index;
+    GLint  base_vertex;
+    GLuint base_instance;
+};
+
+bool instancing_on = true;
+bool multi_draw_on = false; // ARB_multi_draw_indirect and ARB_base_instance
+std::vector<DrawList> draw_lists;
+RenderQueue render_queue;
+std::vector<InstanceData> queued_parts; // the draw lists' items, indexed by the queue
+StreamBuffer instance_ring;
+GLuint iModelAttr[4], iColorAttr;
+GLuint InstancedLoc;
+
+// Threading
+TaskPool* pool = NULL;
+int thread_count = 0; // 0 = one per hardware thread
+
+// Frustum Culling
+// Each root subtree of the scene (the shop, then one per aircraft) is an
+// object; a BVH over their world boxes is culled against the camera before
+// any part of them is put in a draw list.
+std::vector<AABB> primitive_bounds(NUM_PRIMITIVES); // unit primitives from their vertices, then models
+bool culling_on = true;
+int  objects_drawn = 0;
 
 //----------------------------------------------------------------------------
 // Geometry Generation
 //----------------------------------------------------------------------------
 
+// Box around the vertices a primitive's indices use
+AABB VertexBounds(const MeshVertex* vertices, const GLushort* indices, const MeshRange& range) {
+    AABB box;
+    for (int i = range.first; i < range.first + range.count; ++i) {
+        const MeshVertex& v = vertices[indices[i]];
+        box.Extend(vec3(v.x, v.y, v.z));
+    }
+    return box;
+}
+
 // Quad function for Cube
 void quad( int a, int b, int c, int d, const point4* vertices )
 {
@@ -100,17 +341,17 @@ void quad( int a, int b, int c, int d, const point4* vertices )
     vec3 v = vec3(vertices[c]-vertices[b]);
     vec3 normal = normalize( cross(u, v) );
 
-    normals.push_back( normal ); points.push_back( vertices[a] ); colors.push_back(color4(1,0,0,1));
-    normals.push_back( normal ); points.push_back( vertices[b] ); colors.push_back(color4(1,0,0,1));
-    normals.push_back( normal ); points.push_back( vertices[c] ); colors.push_back(color4(1,0,0,1));
-    normals.push_back( normal ); points.push_back( vertices[a] ); colors.push_back(color4(1,0,0,1));
-    normals.push_back( normal ); points.push_back( vertices[c] ); colors.push_back(color4(1,0,0,1));
-    normals.push_back( normal ); points.push_back( vertices[d] ); colors.push_back(color4(1,0,0,1));
+    mesh.Add( vec3(vertices[a]), normal );
+    mesh.Add( vec3(vertices[b]), normal );
+    mesh.Add( vec3(vertices[c]), normal );
+    mesh.Add( vec3(vertices[a]), normal );
+    mesh.Add( vec3(vertices[c]), normal );
+    mesh.Add( vec3(vertices[d]), normal );
 }
 
 void generateCube()
 {
-    offset_cube = points.size();
+    mesh.Begin();
     point4 vertices[8] = {
 	point4( -0.5, -0.5,  0.5, 1.0 ),
 	point4( -0.5,  0.5,  0.5, 1.0 ),
@@ -129,13 +370,14 @@ void generateCube()
     quad( 4, 5, 6, 7, vertices );
     quad( 5, 4, 0, 1, vertices );
 
-    count_cube = points.size() - offset_cube;
+    MeshRange range = mesh.End();
+    for (int lod = 0; lod < NUM_LODS; ++lod) batch_range[Batch(PRIM_CUBE, lod)] = range;
 }
 
-void generateCylinder()
+void generateCylinder( int lod )
 {
-    offset_cyl = points.size();
-    const int segments = 32;
+    mesh.Begin();
+    const int segments = lod_segments[lod];
     float top_y = 0.5;
     float bot_y = -0.5;
     
@@ -161,14 +403,14 @@ void generateCylinder()
         vec3 n2(cos(theta2), 0, sin(theta2));
 
         // Triangle 1
-        points.push_back(p1); normals.push_back(n1); colors.push_back(color4(0,1,0,1));
-        points.push_back(p2); normals.push_back(n1); colors.push_back(color4(0,1,0,1));
-        points.push_back(p4); normals.push_back(n2); colors.push_back(color4(0,1,0,1));
+        mesh.Add(vec3(p1), n1);
+        mesh.Add(vec3(p2), n1);
+        mesh.Add(vec3(p4), n2);
         
         // Triangle 2
-        points.push_back(p2); normals.push_back(n1); colors.push_back(color4(0,1,0,1));
-        points.push_back(p3); normals.push_back(n2); colors.push_back(color4(0,1,0,1));
-        points.push_back(p4); normals.push_back(n2); colors.push_back(color4(0,1,0,1));
+        mesh.Add(vec3(p2), n1);
+        mesh.Add(vec3(p3), n2);
+        mesh.Add(vec3(p4), n2);
     }
     
     // Caps logic omitted for brevity, but can be added if needed. 
@@ -181,17 +423,17 @@ void generateCylinder()
         point4 p1(0.5*cos(theta1), top_y, 0.5*sin(theta1), 1.0);
         point4 p2(0.5*cos(theta2), top_y, 0.5*sin(theta2), 1.0);
         
-        points.push_back(p1); normals.push_back(vec3(0,1,0)); colors.push_back(color4(0,1,0,1));
-        points.push_back(c);  normals.push_back(vec3(0,1,0)); colors.push_back(color4(0,1,0,1));
-        points.push_back(p2); normals.push_back(vec3(0,1,0)); colors.push_back(color4(0,1,0,1));
+        mesh.Add(vec3(p1), vec3(0,1,0));
+        mesh.Add(vec3(c), vec3(0,1,0));
+        mesh.Add(vec3(p2), vec3(0,1,0));
     }
     
-    count_cyl = points.size() - offset_cyl;
+    batch_range[Batch(PRIM_CYLINDER, lod)] = mesh.End();
 }
 
-void generateCone() {
-    offset_cone = points.size();
-    const int segments = 32;
+void generateCone(int lod) {
+    mesh.Begin();
+    const int segments = lod_segments[lod];
     float h = 1.0f;
     float r = 0.5f;
 
@@ -203,22 +445,50 @@ void generateCone() {
         point4 p1(r*cos(theta1), -h/2, r*sin(theta1), 1.0);
         point4 p2(r*cos(theta2), -h/2, r*sin(theta2), 1.0);
 
-        // Normal calculation (simplified)
+        // Normal calculation (simplified), facing out of the side
         vec3 u = vec3(p1 - top);
         vec3 v = vec3(p2 - p1);
-        vec3 n = normalize(cross(u, v));
+        vec3 n = normalize(cross(v, u));
 
-        points.push_back(top); normals.push_back(n); colors.push_back(color4(0,0,1,1));
-        points.push_back(p1);  normals.push_back(n); colors.push_back(color4(0,0,1,1));
-        points.push_back(p2);  normals.push_back(n); colors.push_back(color4(0,0,1,1));
+        mesh.Add(vec3(top), n);
+        mesh.Add(vec3(p1), n);
+        mesh.Add(vec3(p2), n);
 
         // Base cap
         point4 center(0, -h/2, 0, 1.0);
-        points.push_back(p1);    normals.push_back(vec3(0,-1,0)); colors.push_back(color4(0,0,1,1));
-        points.push_back(center); normals.push_back(vec3(0,-1,0)); colors.push_back(color4(0,0,1,1));
-        points.push_back(p2);    normals.push_back(vec3(0,-1,0)); colors.push_back(color4(0,0,1,1));
+        mesh.Add(vec3(p1), vec3(0,-1,0));
+        mesh.Add(vec3(center), vec3(0,-1,0));
+        mesh.Add(vec3(p2), vec3(0,-1,0));
+    }
+    batch_range[Batch(PRIM_CONE, lod)] = mesh.End();
+}
+
+// Reorder the generated triangles for the post-transform cache and for
+// overdraw, then the vertices for fetch, and report the cache before/after
+void OptimizeGeometry() {
+    const char* names[NUM_PRIMITIVES] = { "Cube", "Cylinder", "Cone" };
+    for (int p = 0; p < NUM_PRIMITIVES; ++p) {
+        for (int lod = 0; lod < NUM_LODS; ++lod) {
+            const MeshRange& r = batch_range[Batch(p, lod)];
+            if (lod > 0 && r.first == batch_range[Batch(p, lod - 1)].first) continue; // shared level
+
+            CacheStats before = mesh.AnalyzeVertexCache(r);
+            mesh.OptimizeVertexCache(r);
+            mesh.OptimizeOverdraw(r);
+            CacheStats after = mesh.AnalyzeVertexCache(r);
+            printf("%-8s %3d tris: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", names[p], r.count / 3,
+                   before.acmr, after.acmr, before.atvr, after.atvr);
+        }
     }
-    count_cone = points.size() - offset_cone;
+    mesh.OptimizeVertexFetch();
+}
+
+// Hash of everything the generated geometry depends on
+unsigned GeometryKey() {
+    unsigned key = Fnv1a(&geometry_version, sizeof(geometry_version));
+    int layout[4] = { NUM_PRIMITIVES, NUM_LODS, NUM_BATCHES, MeshBuilder::CacheSize };
+    key = Fnv1a(layout, sizeof(layout), key);
+    return Fnv1a(lod_segments, sizeof(lod_segments), key);
 }
 
 //----------------------------------------------------------------------------
@@ -226,119 +496,316 @@ void generateCone() {
 //----------------------------------------------------------------------------
 
 void SetMaterial(color4 amb, color4 diff, color4 spec, float shin) {
-    glUniform4fv( AmbientProductLoc, 1, amb );
-    glUniform4fv( DiffuseProductLoc, 1, diff );
-    glUniform4fv( SpecularProductLoc, 1, spec );
-    glUniform1f( ShininessLoc, shin );
+    GLState::Uniform4fv( AmbientProductLoc, amb );
+    GLState::Uniform4fv( DiffuseProductLoc, diff );
+    GLState::Uniform4fv( SpecularProductLoc, spec );
+    GLState::Uniform1f( ShininessLoc, shin );
 }
 
-void DrawCube(mat4 transform, color4 color) {
-    SetMaterial(color*0.2, color, vec4(1,1,1,1), 50.0);
-    glUniformMatrix4fv(ModelLoc, 1, GL_TRUE, transform);
-    glDrawArrays(GL_TRIANGLES, offset_cube, count_cube);
+// Material of a part in the sort key: its color at 8 bits a channel
+GLuint MaterialKey(const color4& c) {
+    GLuint key = 0;
+    for (int i = 0; i < 4; ++i)
+        key = key << 8 | GLuint(std::min(std::max(c[i], 0.0f), 1.0f) * 255.0f + 0.5f);
+    return key;
 }
 
-void DrawCylinder(mat4 transform, color4 color) {
-    SetMaterial(color*0.2, color, vec4(1,1,1,1), 50.0);
-    glUniformMatrix4fv(ModelLoc, 1, GL_TRUE, transform);
-    glDrawArrays(GL_TRIANGLES, offset_cyl, count_cyl);
+// Append one part to a draw list. Runs on the worker threads, so no GL here
+void AddInstance(DrawList& list, int batch, const affine& transform, const color4& color) {
+    InstanceData inst;
+    for (int r = 0; r < 3; ++r) inst.model[r] = transform[r];
+    inst.model[3] = vec4(0, 0, 0, 1);
+    inst.color = color;
+    list.items.push_back(inst);
+
+    // Depth of the part's origin along the view direction
+    vec4 origin(transform[0].w, transform[1].w, transform[2].w, 1.0);
+    float depth = -dot(view_matrix[2], origin) / zFar;
+    list.keys.push_back(RenderQueue::Key(batch, MaterialKey(color), depth));
 }
 
-void DrawCone(mat4 transform, color4 color) {
-    SetMaterial(color*0.2, color, vec4(1,1,1,1), 50.0);
-    glUniformMatrix4fv(ModelLoc, 1, GL_TRUE, transform);
-    glDrawArrays(GL_TRIANGLES, offset_cone, count_cone);
+// Point the instance attributes at the InstanceData at offset in the ring
+void SetInstanceAttributes(GLintptr offset) {
+    for (int r = 0; r < 4; ++r) {
+        glVertexAttribPointer( iModelAttr[r], 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                               BUFFER_OFFSET(offset + offsetof(InstanceData, model) + r*sizeof(vec4)) );
+    }
+    glVertexAttribPointer( iColorAttr, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                           BUFFER_OFFSET(offset + offsetof(InstanceData, color)) );
+}
+
+// Copy the parts into the stream ring in queue order and draw each run of
+// one batch (primitive at one level of detail) as one instanced command.
+// With multi-draw indirect the commands follow the parts in the ring and
+// the whole queue is one call.
+void FlushInstances() {
+    const int n = render_queue.Size();
+    if (n == 0) return;
+
+    std::vector<DrawCommand> commands;
+    for (int i = 0; i < n; ) {
+        int end = render_queue.RunEnd(i);
+        GLint base;
+        MeshRange r = BatchRange(RenderQueue::Batch(render_queue[i].key), &base);
+        DrawCommand c = { GLuint(r.count), GLuint(end - i), GLuint(r.first), base, GLuint(i) };
+        commands.push_back(c);
+        i = end;
+    }
+
+    instance_ring.Reserve( n*sizeof(InstanceData) + commands.size()*sizeof(DrawCommand) + 32 ); // + alignment slack
+
+    instance_ring.BeginFrame();
+    GLintptr parts_offset, commands_offset = 0;
+    InstanceData* dst = (InstanceData*) instance_ring.Alloc(n*sizeof(InstanceData), &parts_offset);
+    for (int i = 0; i < n; ++i) dst[i] = queued_parts[render_queue[i].item];
+    if (multi_draw_on) {
+        void* p = instance_ring.Alloc(commands.size()*sizeof(DrawCommand), &commands_offset, 4);
+        memcpy( p, &commands[0], commands.size()*sizeof(DrawCommand) );
+    }
+    instance_ring.Flush();
+
+    GLState::BindBuffer( GL_ARRAY_BUFFER, instance_ring.Buffer() );
+    if (multi_draw_on) {
+        // Each command's base instance picks its parts out of the one range
+        SetInstanceAttributes( parts_offset );
+        GLState::BindBuffer( GL_DRAW_INDIRECT_BUFFER, instance_ring.Buffer() );
+        glMultiDrawElementsIndirect( GL_TRIANGLES, GL_UNSIGNED_SHORT, BUFFER_OFFSET(commands_offset),
+                                     commands.size(), 0 );
+        ++draw_calls;
+    } else {
+        for (size_t k = 0; k < commands.size(); ++k) {
+            const DrawCommand& c = commands[k];
+            SetInstanceAttributes( parts_offset + c.base_instance*sizeof(InstanceData) );
+            glDrawElementsInstancedBaseVertex( GL_TRIANGLES, c.count, GL_UNSIGNED_SHORT,
+                                               BUFFER_OFFSET(c.first_index*sizeof(GLushort)),
+                                               c.instance_count, c.base_vertex );
+            ++draw_calls;
+        }
+    }
+    instance_ring.EndFrame();
+}
+
+// Per-part path: one set of uniforms and one glDrawElements per part, in
+// queue order so parts of one material follow each other
+void DrawParts() {
+    int batch = -1;
+    MeshRange r = { 0, 0 };
+    GLint base = 0;
+    for (int i = 0; i < render_queue.Size(); ++i) {
+        const RenderQueue::Entry& e = render_queue[i];
+        if (RenderQueue::Batch(e.key) != batch) {
+            batch = RenderQueue::Batch(e.key);
+            r = BatchRange(batch, &base);
+        }
+        const InstanceData& inst = queued_parts[e.item];
+        SetMaterial(inst.color*0.2, inst.color, vec4(1,1,1,1), 50.0);
+        GLState::UniformMatrix4fv(ModelLoc, GL_TRUE, &inst.model[0].x);
+        glDrawElementsBaseVertex(GL_TRIANGLES, r.count, GL_UNSIGNED_SHORT, BUFFER_OFFSET(r.first*sizeof(GLushort)), base);
+        ++draw_calls;
+    }
+}
+
+// Submission stage: the only place the frame's parts reach GL. The draw
+// lists are gathered into one queue in chunk order and sorted.
+void SubmitDrawLists() {
+    PROFILE_SCOPE("submit");
+    render_queue.Clear();
+    queued_parts.clear();
+    for (size_t l = 0; l < draw_lists.size(); ++l) {
+        DrawList& list = draw_lists[l];
+        for (size_t k = 0; k < list.keys.size(); ++k)
+            render_queue.Push(list.keys[k], GLuint(queued_parts.size() + k));
+        queued_parts.insert(queued_parts.end(), list.items.begin(), list.items.end());
+        list.items.clear();
+        list.keys.clear();
+    }
+    {
+        PROFILE_SCOPE("sort");
+        render_queue.Sort();
+    }
+
+    triangles_submitted = 0;
+    for (int i = 0; i < render_queue.Size(); ) {
+        int end = render_queue.RunEnd(i);
+        GLint base;
+        triangles_submitted += (end - i) * (BatchRange(RenderQueue::Batch(render_queue[i].key), &base).count / 3);
+        i = end;
+    }
+
+    draw_calls = 0;
+    if (instancing_on) FlushInstances();
+    else DrawParts();
+}
+
+// Switch between per-part uniforms and the instanced path
+void SetInstancing(bool on) {
+    instancing_on = on;
+    GLState::Uniform1i( InstancedLoc, on );
+    for (int r = 0; r < 4; ++r) {
+        if (on) glEnableVertexAttribArray( iModelAttr[r] );
+        else    glDisableVertexAttribArray( iModelAttr[r] );
+    }
+    if (on) glEnableVertexAttribArray( iColorAttr );
+    else    glDisableVertexAttribArray( iColorAttr );
 }
 
 //----------------------------------------------------------------------------
 // Aircraft Hierarchical Models
 //----------------------------------------------------------------------------
+// Each Build function adds one aircraft rig to the scene graph under a root
+// node that follows the plane's position/orientation. Moving parts hang off
+// pivot nodes that are bound to the plane's entity below, so only the
+// pivots (and the parts under them) are recomputed when their angle changes.
+
+SceneGraph scene;
+
+// Root of one aircraft, posed from its entity's position/rotation
+struct Rig {
+    Entity entity;
+    int    root;
+    vec3   posed_position, posed_rotation; // pose the root was last set from
+    int    object;                         // its cullable object
+};
+
+std::vector<Rig> rigs;
+
+// Cullable objects, one per root in node order
+std::vector<int>           object_root;
+std::vector<AABB>          object_local;  // in the root's space, covering every pose
+std::vector<AABB>          object_bounds; // world space
+std::vector<unsigned char> object_visible;
+BVH                        object_bvh;
+std::atomic<bool>          objects_moved(false); // a root moved since the last refit
+
+// Run of whole subtrees (the shop, then consecutive rigs) updated and drawn
+// by one task, with the slices of rigs/spinners/toggles that pose it
+struct SceneChunk {
+    int node_begin, node_end;
+    int object_begin, object_end;
+    int rig_begin, rig_end;
+    int spinner_begin, spinner_end;
+    int toggle_begin, toggle_end;
+};
+
+std::vector<SceneChunk> chunks;
+const int chunk_nodes = 2048; // target scene nodes per task
+
+// Pivot spun about one axis by an entity field: local = base * Rotate(field * rate)
+struct Spinner {
+    int                       node;
+    affine                    base;
+    int                       axis; // 0=X, 1=Y, 2=Z
+    Entity                    entity;
+    const std::vector<float>* column; // fleet.propeller_pose or propeller_speed
+    float                     rate;
+    float                     posed; // angle the pivot was last posed at
+};
+
+// Node shown only while an entity's aux_state equals 'when'
+struct Toggle {
+    int    node;
+    Entity entity;
+    bool   when;
+};
+
+std::vector<Spinner> spinners;
+std::vector<Toggle>  toggles;
+
+int AddPart(int parent, const affine& local, Primitive prim, const color4& color) {
+    return scene.AddNode(parent, local, prim, color);
+}
+
+// A loaded model as a part; like the primitives it fills the unit box
+int AddModel(int parent, const affine& local, int model, const color4& color) {
+    return scene.AddNode(parent, local, NUM_PRIMITIVES + model, color);
+}
+
+int AddSpinner(int parent, const affine& base, int axis, Entity e, const std::vector<float>& column, float rate = 1.0) {
+    Spinner sp = { scene.AddNode(parent, base), base, axis, e, &column, rate, NAN };
+    spinners.push_back(sp);
+    return sp.node;
+}
+
+int AddToggle(int parent, Entity e, bool when) {
+    Toggle t = { scene.AddNode(parent, affine()), e, when };
+    toggles.push_back(t);
+    return t.node;
+}
 
 // 1. Toy Jet
-void DrawJet(mat4 mt, int id) {
-    ObjectState& s = planes[id];
-    
+void BuildJet(int root, Entity e) {
+
     // Body
-    mat4 m_body = mt * Scale(1.0, 1.0, 3.0);
-    DrawCylinder(m_body, color4(0.8, 0.2, 0.2, 1.0));
+    AddPart(root, affine().scale(1.0, 1.0, 3.0), PRIM_CYLINDER, color4(0.8, 0.2, 0.2, 1.0));
 
     // Wings
-    mat4 m_wing = mt * Translate(0, 0, 0) * Scale(4.0, 0.1, 1.0);
-    DrawCube(m_wing, color4(0.6, 0.6, 0.6, 1.0));
+    AddPart(root, affine().scale(4.0, 0.1, 1.0), PRIM_CUBE, color4(0.6, 0.6, 0.6, 1.0));
 
     // Tail
-    mat4 m_tail = mt * Translate(0, 0.5, 1.2) * RotateX(-45) * Scale(1.5, 0.1, 0.8);
-    DrawCube(m_tail, color4(0.6, 0.6, 0.6, 1.0));
+    AddPart(root, affine().translate(0, 0.5, 1.2).rotateX(-45).scale(1.5, 0.1, 0.8), PRIM_CUBE, color4(0.6, 0.6, 0.6, 1.0));
 
     // Engine Turbine (Rotatable)
-    float rot = s.propeller_angle;
-    mat4 m_eng_l = mt * Translate(-1.0, -0.2, 0.5) * RotateZ(rot) * Scale(0.3, 0.3, 1.0);
-    DrawCylinder(m_eng_l, color4(0.2, 0.2, 0.2, 1.0));
-    mat4 m_eng_r = mt * Translate(1.0, -0.2, 0.5) * RotateZ(rot) * Scale(0.3, 0.3, 1.0);
-    DrawCylinder(m_eng_r, color4(0.2, 0.2, 0.2, 1.0));
+    int eng_l = AddSpinner(root, affine().translate(-1.0, -0.2, 0.5), 2, e, fleet.propeller_pose);
+    AddPart(eng_l, affine().scale(0.3, 0.3, 1.0), PRIM_CYLINDER, color4(0.2, 0.2, 0.2, 1.0));
+    int eng_r = AddSpinner(root, affine().translate(1.0, -0.2, 0.5), 2, e, fleet.propeller_pose);
+    AddPart(eng_r, affine().scale(0.3, 0.3, 1.0), PRIM_CYLINDER, color4(0.2, 0.2, 0.2, 1.0));
 
     // Landing Gear (Retractable)
-    if(s.aux_state) { // if open
-        mat4 m_gear_f = mt * Translate(0, -0.8, -1.0) * Scale(0.1, 0.5, 0.1);
-        DrawCube(m_gear_f, color4(0.1, 0.1, 0.1, 1));
-        // Wheel
-        mat4 m_wheel_f = mt * Translate(0, -1.0, -1.0) * RotateY(90) * Scale(0.3, 0.3, 0.1);
-        DrawCylinder(m_wheel_f, color4(0,0,0,1));
-    }
+    int gear = AddToggle(root, e, true);
+    AddPart(gear, affine().translate(0, -0.8, -1.0).scale(0.1, 0.5, 0.1), PRIM_CUBE, color4(0.1, 0.1, 0.1, 1));
+    // Wheel
+    AddPart(gear, affine().translate(0, -1.0, -1.0).rotateY(90).scale(0.3, 0.3, 0.1), PRIM_CYLINDER, color4(0,0,0,1));
 }
 
 // 2. Propeller Plane
-void DrawPropPlane(mat4 mt, int id) {
-    ObjectState& s = planes[id];
-    
+void BuildPropPlane(int root, Entity e) {
+
     // Fuselage
-    DrawCube(mt * Scale(1, 1, 2.5), color4(0.2, 0.8, 0.2, 1));
+    AddPart(root, affine().scale(1, 1, 2.5), PRIM_CUBE, color4(0.2, 0.8, 0.2, 1));
 
     // Propeller
-    mat4 m_prop = mt * Translate(0, 0, -1.3) * RotateZ(s.propeller_angle); // Spinning
-    DrawCube(m_prop * Scale(2.0, 0.1, 0.1), color4(0.1, 0.1, 0.1, 1));
-    DrawCube(m_prop * Scale(0.1, 2.0, 0.1), color4(0.1, 0.1, 0.1, 1));
+    int prop = AddSpinner(root, affine().translate(0, 0, -1.3), 2, e, fleet.propeller_pose); // Spinning
+    AddPart(prop, affine().scale(2.0, 0.1, 0.1), PRIM_CUBE, color4(0.1, 0.1, 0.1, 1));
+    AddPart(prop, affine().scale(0.1, 2.0, 0.1), PRIM_CUBE, color4(0.1, 0.1, 0.1, 1));
 
     // Wings
-    DrawCube(mt * Translate(0, 0.2, -0.5) * Scale(3.5, 0.1, 0.8), color4(1, 1, 0, 1));
+    AddPart(root, affine().translate(0, 0.2, -0.5).scale(3.5, 0.1, 0.8), PRIM_CUBE, color4(1, 1, 0, 1));
 }
 
 // 3. Helicopter
-void DrawHelicopter(mat4 mt, int id) {
-    ObjectState& s = planes[id];
-    
+void BuildHelicopter(int root, Entity e) {
+
     // Bubble cockpit
-    DrawCylinder(mt * Scale(1.2, 1.2, 1.5), color4(0.2, 0.2, 0.8, 1));
-    
+    AddPart(root, affine().scale(1.2, 1.2, 1.5), PRIM_CYLINDER, color4(0.2, 0.2, 0.8, 1));
+
     // Tail boom
-    DrawCube(mt * Translate(0, 0, 1.5) * Scale(0.3, 0.3, 2.0), color4(0.5, 0.5, 0.5, 1));
-    
+    AddPart(root, affine().translate(0, 0, 1.5).scale(0.3, 0.3, 2.0), PRIM_CUBE, color4(0.5, 0.5, 0.5, 1));
+
     // Main Rotor
-    mat4 m_rotor = mt * Translate(0, 0.7, 0) * RotateY(s.propeller_angle);
-    DrawCube(m_rotor * Scale(4.0, 0.05, 0.2), color4(0.1, 0.1, 0.1, 1));
-    DrawCube(m_rotor * RotateY(90) * Scale(4.0, 0.05, 0.2), color4(0.1, 0.1, 0.1, 1));
+    int rotor = AddSpinner(root, affine().translate(0, 0.7, 0), 1, e, fleet.propeller_pose);
+    AddPart(rotor, affine().scale(4.0, 0.05, 0.2), PRIM_CUBE, color4(0.1, 0.1, 0.1, 1));
+    AddPart(rotor, affine().rotateY(90).scale(4.0, 0.05, 0.2), PRIM_CUBE, color4(0.1, 0.1, 0.1, 1));
 
     // Tail Rotor
-    mat4 m_tailrotor = mt * Translate(0.2, 0, 2.5) * RotateX(s.propeller_speed * 10); // Rotate fast
-    DrawCube(m_tailrotor * Scale(0.05, 1.0, 0.1), color4(0.1,0.1,0.1,1));
+    int tailrotor = AddSpinner(root, affine().translate(0.2, 0, 2.5), 0, e, fleet.propeller_speed, 10); // Rotate fast
+    AddPart(tailrotor, affine().scale(0.05, 1.0, 0.1), PRIM_CUBE, color4(0.1,0.1,0.1,1));
 }
 
 // 4. Paper Plane
-void DrawPaperPlane(mat4 mt, int id) {
+void BuildPaperPlane(int root, Entity) {
     // Simple dart shape using scaling
-    DrawCone(mt * RotateX(-90) * Scale(1.0, 2.0, 0.1), color4(1,1,1,1));
+    AddPart(root, affine().rotateX(-90).scale(1.0, 2.0, 0.1), PRIM_CONE, color4(1,1,1,1));
 }
 
 // 5. Drone
-void DrawDrone(mat4 mt, int id) {
-    ObjectState& s = planes[id];
-    
+void BuildDrone(int root, Entity e) {
+
     // Center Body
-    DrawCube(mt * Scale(0.5, 0.2, 0.5), color4(0.1, 0.1, 0.1, 1));
-    
+    AddPart(root, affine().scale(0.5, 0.2, 0.5), PRIM_CUBE, color4(0.1, 0.1, 0.1, 1));
+
     // Arms
-    DrawCube(mt * RotateY(45) * Scale(2.0, 0.1, 0.1), color4(0.3, 0.3, 0.3, 1));
-    DrawCube(mt * RotateY(-45) * Scale(2.0, 0.1, 0.1), color4(0.3, 0.3, 0.3, 1));
+    AddPart(root, affine().rotateY(45).scale(2.0, 0.1, 0.1), PRIM_CUBE, color4(0.3, 0.3, 0.3, 1));
+    AddPart(root, affine().rotateY(-45).scale(2.0, 0.1, 0.1), PRIM_CUBE, color4(0.3, 0.3, 0.3, 1));
 
     // Props
     float rots[4] = {45, 135, 225, 315};
@@ -346,174 +813,766 @@ void DrawDrone(mat4 mt, int id) {
         float r = 1.0;
         float x = r * cos(rots[i]*DegreesToRadians);
         float z = r * sin(rots[i]*DegreesToRadians);
-        mat4 m_p = mt * Translate(x, 0.1, z) * RotateY(s.propeller_angle * (i%2==0?1:-1));
-        DrawCylinder(m_p * Scale(0.4, 0.05, 0.4), color4(0,1,1,1)); // Propeller disc approximation
+        int p = AddSpinner(root, affine().translate(x, 0.1, z), 1, e, fleet.propeller_pose, (i%2==0?1:-1));
+        AddPart(p, affine().scale(0.4, 0.05, 0.4), PRIM_CYLINDER, color4(0,1,1,1)); // Propeller disc approximation
     }
 }
 
 // 6. Rocket
-void DrawRocket(mat4 mt, int id) {
-    DrawCylinder(mt * Scale(0.5, 2.0, 0.5), color4(0.9, 0.9, 0.9, 1)); // Body
-    DrawCone(mt * Translate(0, 1.0, 0) * Scale(0.5, 0.8, 0.5), color4(1, 0, 0, 1)); // Nose
+void BuildRocket(int root, Entity) {
+    AddPart(root, affine().scale(0.5, 2.0, 0.5), PRIM_CYLINDER, color4(0.9, 0.9, 0.9, 1)); // Body
+    AddPart(root, affine().translate(0, 1.0, 0).scale(0.5, 0.8, 0.5), PRIM_CONE, color4(1, 0, 0, 1)); // Nose
     // Fins
-    DrawCube(mt * Translate(0, -0.8, 0) * Scale(1.5, 0.5, 0.1), color4(1,0,0,1));
-    DrawCube(mt * Translate(0, -0.8, 0) * RotateY(90) * Scale(1.5, 0.5, 0.1), color4(1,0,0,1));
+    AddPart(root, affine().translate(0, -0.8, 0).scale(1.5, 0.5, 0.1), PRIM_CUBE, color4(1,0,0,1));
+    AddPart(root, affine().translate(0, -0.8, 0).rotateY(90).scale(1.5, 0.5, 0.1), PRIM_CUBE, color4(1,0,0,1));
 }
 
 // 7. Balloon
-void DrawBalloon(mat4 mt, int id) {
+void BuildBalloon(int root, Entity) {
     // Balloon
-    DrawCylinder(mt * Translate(0, 1.0, 0) * Scale(1.5, 1.8, 1.5), color4(1, 0.5, 0, 1)); // Use cyl as primitive sphere approximation
+    AddPart(root, affine().translate(0, 1.0, 0).scale(1.5, 1.8, 1.5), PRIM_CYLINDER, color4(1, 0.5, 0, 1)); // Use cyl as primitive sphere approximation
     // Basket
-    DrawCube(mt * Translate(0, -0.5, 0) * Scale(0.5, 0.5, 0.5), color4(0.6, 0.4, 0.2, 1));
+    AddPart(root, affine().translate(0, -0.5, 0).scale(0.5, 0.5, 0.5), PRIM_CUBE, color4(0.6, 0.4, 0.2, 1));
 }
 
 // 8. Fighter Jet
-void DrawFighter(mat4 mt, int id) {
-    ObjectState& s = planes[id];
+void BuildFighter(int root, Entity e) {
     // Main Body
-    DrawCube(mt * Scale(0.8, 0.5, 3.0), color4(0.3, 0.3, 0.4, 1));
+    AddPart(root, affine().scale(0.8, 0.5, 3.0), PRIM_CUBE, color4(0.3, 0.3, 0.4, 1));
     // Swept Wings
-    DrawCube(mt * Translate(0,0,0.5) * Scale(3.0, 0.1, 1.5), color4(0.3, 0.3, 0.4, 1));
+    AddPart(root, affine().translate(0,0,0.5).scale(3.0, 0.1, 1.5), PRIM_CUBE, color4(0.3, 0.3, 0.4, 1));
     // Missiles
-    if (s.aux_state) { // Fire! (Simple translation)
-       DrawCylinder(mt * Translate(1.0, -0.2, -1.0) * Scale(0.1, 0.1, 0.8), color4(1,1,1,1));
-    } else {
-       DrawCylinder(mt * Translate(1.0, -0.2, 0.0) * Scale(0.1, 0.1, 0.8), color4(1,1,1,1));
-       DrawCylinder(mt * Translate(-1.0, -0.2, 0.0) * Scale(0.1, 0.1, 0.8), color4(1,1,1,1));
-    }
+    int fired = AddToggle(root, e, true); // Fire! (Simple translation)
+    AddPart(fired, affine().translate(1.0, -0.2, -1.0).scale(0.1, 0.1, 0.8), PRIM_CYLINDER, color4(1,1,1,1));
+    int racked = AddToggle(root, e, false);
+    AddPart(racked, affine().translate(1.0, -0.2, 0.0).scale(0.1, 0.1, 0.8), PRIM_CYLINDER, color4(1,1,1,1));
+    AddPart(racked, affine().translate(-1.0, -0.2, 0.0).scale(0.1, 0.1, 0.8), PRIM_CYLINDER, color4(1,1,1,1));
 }
 
 // Environment
-void DrawShop() {
+void BuildShop() {
+    int root = scene.AddNode(-1, affine());
+
     // Floor
-    mat4 m_floor = Translate(0, -5, 0) * Scale(40, 0.1, 40);
-    DrawCube(m_floor, color4(0.8, 0.7, 0.5, 1));
+    AddPart(root, affine().translate(0, -5, 0).scale(40, 0.1, 40), PRIM_CUBE, color4(0.8, 0.7, 0.5, 1));
 
     // Shelves
     for(int i=-1; i<=1; i++) {
-        mat4 m_shelf = Translate(i*8, -2, -10);
+        int shelf = scene.AddNode(root, affine().translate(i*8, -2, -10));
         // Base
-        DrawCube(m_shelf * Scale(4, 6, 2), color4(0.4, 0.2, 0.0, 1));
+        AddPart(shelf, affine().scale(4, 6, 2), PRIM_CUBE, color4(0.4, 0.2, 0.0, 1));
         // Planks
-        DrawCube(m_shelf * Translate(0, 1, 0) * Scale(4.2, 0.1, 2.1), color4(0.5, 0.25, 0.0, 1));
+        AddPart(shelf, affine().translate(0, 1, 0).scale(4.2, 0.1, 2.1), PRIM_CUBE, color4(0.5, 0.25, 0.0, 1));
     }
 
     // Counter
-    mat4 m_counter = Translate(10, -3.5, 5) * Scale(4, 3, 2);
-    DrawCube(m_counter, color4(0.9, 0.9, 0.9, 1));
+    AddPart(root, affine().translate(10, -3.5, 5).scale(4, 3, 2), PRIM_CUBE, color4(0.9, 0.9, 0.9, 1));
+
+    // Products loaded with --model, on the floor in front of the shelves
+    for (int m = 0; m < models.Models(); ++m) {
+        float x = (m - 0.5*(models.Models() - 1)) * 3.0;
+        AddModel(root, affine().translate(x, -3.95, -6).scale(2, 2, 2), m, color4(0.75, 0.75, 0.8, 1));
+    }
+}
+
+// The room's lights, then n - ROOM_LIGHTS small spots hung over the floor
+// displays, spread evenly however many there are (a sunflower spiral).
+// Each lights a pool a few units across, so more of them cover more of
+// the floor rather than stacking up on the same fragments.
+void PlaceLights(int n) {
+    const color4 tints[4] = { color4(1.0, 0.85, 0.6, 1), color4(0.7, 0.8, 1.0, 1),
+                              color4(1.0, 0.6, 0.7, 1), color4(0.7, 1.0, 0.75, 1) };
+    lights.assign(room_lights, room_lights + std::min(n, ROOM_LIGHTS));
+    int spots = n - int(lights.size());
+    for (int i = 0; i < spots; ++i) {
+        float r = 18.0 * sqrt((i + 0.5) / spots), a = i * 2.39996; // golden angle
+        Light spot = { point4(r * cos(a), -2.0, r * sin(a), 1.0), tints[i % 4] * 0.6,
+                       4.5, vec3(0.0, -1.0, 0.0), 25.0 };
+        lights.push_back(spot);
+    }
+}
+
+// Bounds of the root's subtree [root, end) in the root's space. Parts under
+// a spinner are bounded by the sphere they sweep around its pivot, and
+// toggled parts are always included, so the box holds in every pose
+AABB SubtreeBounds(int root, int end) {
+    std::vector<affine> m(end - root);     // relative to the root
+    std::vector<int>    pivot(end - root, -1); // outermost spinner above, relative
+    size_t sp = 0;
+    while (sp < spinners.size() && spinners[sp].node <= root) ++sp;
+
+    AABB box;
+    for (int n = root + 1; n < end; ++n) {
+        int k = n - root, p = scene.Parent(n) - root;
+        m[k] = m[p] * scene.Local(n);
+        pivot[k] = pivot[p];
+        if (sp < spinners.size() && spinners[sp].node == n) {
+            if (pivot[k] < 0) pivot[k] = k;
+            ++sp;
+        }
+        if (scene.Primitive(n) == SceneGraph::NoPrimitive) continue;
+
+        AABB part = primitive_bounds[scene.Primitive(n)].Transformed(m[k]);
+        if (pivot[k] < 0) {
+            box.Extend(part);
+            continue;
+        }
+        const affine& pm = m[pivot[k]];
+        vec3 c(pm[0].w, pm[1].w, pm[2].w);
+        vec3 lo = part.lo - c, hi = part.hi - c;
+        vec3 corner(std::max(fabs(lo.x), fabs(hi.x)), std::max(fabs(lo.y), fabs(hi.y)),
+                    std::max(fabs(lo.z), fabs(hi.z)));
+        float r = length(corner);
+        box.Extend(AABB(c - vec3(r), c + vec3(r)));
+    }
+    return box;
+}
+
+// One cullable object per root, and the BVH over them
+void BuildObjects() {
+    size_t rig = 0;
+    for (int n = 0; n < scene.Size(); ++n) {
+        if (scene.Parent(n) >= 0) continue;
+        if (rig < rigs.size() && rigs[rig].root == n) rigs[rig++].object = object_root.size();
+        object_root.push_back(n);
+    }
+
+    for (size_t o = 0; o < object_root.size(); ++o) {
+        int end = o + 1 < object_root.size() ? object_root[o + 1] : scene.Size();
+        object_local.push_back(SubtreeBounds(object_root[o], end));
+        object_bounds.push_back(object_local[o].Transformed(scene.Local(object_root[o])));
+    }
+    object_visible.assign(object_root.size(), 1);
+    object_bvh.Build(object_bounds);
+}
+
+// Cut the scene into chunks at root boundaries. Rigs, spinners and toggles
+// were all created in node order, so each chunk's slice of them is a range
+void SplitScene() {
+    chunks.clear();
+    int object = 0, rig = 0, spinner = 0, toggle = 0;
+    int begin = 0;
+    for (int n = 1; n <= scene.Size(); ++n) {
+        bool at_root = (n == scene.Size() || scene.Parent(n) < 0);
+        if (!at_root || (n - begin < chunk_nodes && n < scene.Size())) continue;
+
+        SceneChunk c;
+        c.node_begin = begin;  c.node_end = n;
+        c.object_begin = object;
+        while (object < (int)object_root.size() && object_root[object] < n) ++object;
+        c.object_end = object;
+        c.rig_begin = rig;
+        while (rig < (int)rigs.size() && rigs[rig].root < n) ++rig;
+        c.rig_end = rig;
+        c.spinner_begin = spinner;
+        while (spinner < (int)spinners.size() && spinners[spinner].node < n) ++spinner;
+        c.spinner_end = spinner;
+        c.toggle_begin = toggle;
+        while (toggle < (int)toggles.size() && toggles[toggle].node < n) ++toggle;
+        c.toggle_end = toggle;
+        chunks.push_back(c);
+        begin = n;
+    }
+    draw_lists.resize(chunks.size());
+}
+
+// One rig per aircraft in the store, built by its model type
+void BuildScene() {
+    void (*build[9])(int, Entity) = { NULL, BuildJet, BuildPropPlane, BuildHelicopter, BuildPaperPlane,
+                                      BuildDrone, BuildRocket, BuildBalloon, BuildFighter };
+    BuildShop();
+    for (int i = 0; i < fleet.Size(); ++i) {
+        Rig rig = { fleet.Handle(i), scene.AddNode(-1, affine()), vec3(NAN), vec3(NAN), -1 };
+        build[fleet.model[i]](rig.root, rig.entity);
+        rigs.push_back(rig);
+    }
+    BuildObjects();
+    SplitScene();
+    node_lod.assign(scene.Size(), lod_fixed);
+}
+
+// Push the current entity state into one chunk's rigs and refresh its dirty
+// world matrices; returns how many were recomputed
+int UpdateChunk(const SceneChunk& c) {
+    for (int k = c.rig_begin; k < c.rig_end; ++k) {
+        Rig& rig = rigs[k];
+        int i = fleet.Index(rig.entity);
+        const vec3& position = fleet.position[i];
+        const vec3& rotation = fleet.rotation[i];
+        if (memcmp(&position, &rig.posed_position, sizeof(vec3)) == 0 &&
+            memcmp(&rotation, &rig.posed_rotation, sizeof(vec3)) == 0) continue;
+        rig.posed_position = position;
+        rig.posed_rotation = rotation;
+
+        affine root = affine().translate(position);
+
+        // Apply Orientation
+        root.rotateY(rotation.y);
+        root.rotateX(rotation.x);
+        root.rotateZ(rotation.z);
+        scene.SetLocal(rig.root, root);
+        object_bounds[rig.object] = object_local[rig.object].Transformed(root);
+        objects_moved = true;
+    }
+
+    for (int k = c.spinner_begin; k < c.spinner_end; ++k) {
+        Spinner& sp = spinners[k];
+        float a = (*sp.column)[fleet.Index(sp.entity)] * sp.rate;
+        if (a == sp.posed) continue;
+        sp.posed = a;
+
+        affine m = sp.base;
+        switch (sp.axis) {
+            case 0: m.rotateX(a); break;
+            case 1: m.rotateY(a); break;
+            case 2: m.rotateZ(a); break;
+        }
+        scene.SetLocal(sp.node, m);
+    }
+
+    for (int k = c.toggle_begin; k < c.toggle_end; ++k) {
+        const Toggle& t = toggles[k];
+        scene.SetVisible(t.node, (fleet.aux_state[fleet.Index(t.entity)] != 0) == t.when);
+    }
+
+    return scene.Update(c.node_begin, c.node_end);
+}
+
+// Refit the BVH if anything moved, then mark the objects in view
+void CullObjects(const mat4& projection_view) {
+    if (objects_moved) {
+        object_bvh.Refit(object_bounds);
+        objects_moved = false;
+    }
+    if (culling_on) {
+        objects_drawn = object_bvh.Cull(ViewFrustum(projection_view), object_visible);
+    } else {
+        object_visible.assign(object_root.size(), 1);
+        objects_drawn = object_root.size();
+    }
+}
+
+// Level for a part 'pixels' tall that was last drawn at level 'lod'
+int SelectLod(float pixels, int lod) {
+    while (lod > 0 && pixels >= lod_pixels[lod - 1] * (1 + lod_hysteresis)) --lod;
+    while (lod < NUM_LODS - 1 && pixels < lod_pixels[lod] * (1 - lod_hysteresis)) ++lod;
+    return lod;
+}
+
+// Height on screen, in pixels, of the bounding sphere of a part
+float ProjectedPixels(int prim, const affine& world) {
+    AABB box = primitive_bounds[prim].Transformed(world);
+    float r = length(box.Extents());
+    float d = length(box.Center() - vec3(eye.x, eye.y, eye.z));
+    if (d <= r) return 1e30; // the camera is inside it
+    return lod_scale * r / d;
+}
+
+// Append the visible parts of one chunk's objects in view to its draw list
+void DrawChunk(const SceneChunk& c, DrawList& list) {
+    for (int o = c.object_begin; o < c.object_end; ++o) {
+        if (!object_visible[o]) continue;
+        int end = o + 1 < (int)object_root.size() ? object_root[o + 1] : scene.Size();
+        for (int n = object_root[o]; n < end; ++n) {
+            if (scene.Primitive(n) == SceneGraph::NoPrimitive || !scene.Shown(n)) continue;
+
+            int prim = scene.Primitive(n);
+            if (prim >= NUM_PRIMITIVES && !models.Ready(prim - NUM_PRIMITIVES)) continue; // still loading
+            int lod = 0;
+            if (prim == PRIM_CYLINDER || prim == PRIM_CONE)
+                lod = node_lod[n] = lod_on ? SelectLod(ProjectedPixels(prim, scene.World(n)), node_lod[n]) : lod_fixed;
+            AddInstance(list, Batch(prim, lod), scene.World(n), scene.Color(n));
+        }
+    }
+}
+
+// Parallel stage: every chunk is posed and updated by whichever worker
+// takes it, then, once the objects in view are known, turned into a draw list
+void BuildDrawLists() {
+    std::atomic<int> updated(0);
+    pool->ParallelFor(chunks.size(), [&](int c, int) {
+        PROFILE_SCOPE("update chunk");
+        updated += UpdateChunk(chunks[c]);
+    });
+    scene.SetUpdated(updated);
+
+    {
+        PROFILE_SCOPE("cull");
+        CullObjects(projection * view_matrix);
+    }
+    lod_scale = window_height / tan(0.5 * fovy * DegreesToRadians);
+
+    pool->ParallelFor(chunks.size(), [](int c, int) {
+        PROFILE_SCOPE("draw chunk");
+        DrawChunk(chunks[c], draw_lists[c]);
+    });
+}
+
+//----------------------------------------------------------------------------
+// Warehouse Fleet
+//----------------------------------------------------------------------------
+
+// Park n aircraft of every model in rows behind the shop shelves
+void SpawnWarehouse(int n) {
+    const int per_row = 100;
+    for (int k = 0; k < n; ++k) {
+        int e = fleet.Index(fleet.Create(1 + k % 8));
+        fleet.position[e] = vec3( (k % per_row - per_row/2) * 4.0, -4.0, -16.0 - (k / per_row) * 4.0 );
+        fleet.rotation[e] = vec3( 0.0, (k * 37) % 360, 0.0 );
+        fleet.propeller_angle[e] = (k * 53) % 360;
+        fleet.propeller_speed[e] = 3.0 + k % 8;
+        fleet.aux_state[e] = (k / 8) % 2;
+    }
+}
+
+// --bench-update: time step()'s propeller sweep over the SoA store against
+// the same loop over the old array-of-structs ObjectState layout
+void BenchEntityUpdate() {
+    struct ObjectState {
+        vec3 position;
+        vec3 rotation;
+        float propeller_angle;
+        float propeller_speed;
+        float aux_angle;
+        bool  aux_state;
+    };
+    const int sizes[3] = { 1000, 100000, 1000000 };
+
+    std::cout << "propeller update (" << ANGEL_SIMD_NAME << "), best of 5, ns/entity" << std::endl;
+    for (int t = 0; t < 3; ++t) {
+        int n = sizes[t];
+        int reps = 100000000 / n;
+
+        EntityStore store;
+        std::vector<ObjectState> aos(n);
+        store.Reserve(n);
+        for (int k = 0; k < n; ++k) {
+            int e = store.Index(store.Create(1 + k % 8));
+            store.propeller_speed[e] = aos[k].propeller_speed = 3.0 + k % 8;
+            aos[k].propeller_angle = 0.0;
+        }
+
+        double best_soa = 1e30, best_aos = 1e30;
+        for (int run = 0; run < 5; ++run) {
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            for (int r = 0; r < reps; ++r) store.SpinPropellers();
+            std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+            for (int r = 0; r < reps; ++r) {
+                for (int k = 0; k < n; ++k) {
+                    aos[k].propeller_angle += aos[k].propeller_speed;
+                    if(aos[k].propeller_angle > 360) aos[k].propeller_angle -= 360;
+                }
+            }
+            std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+            best_soa = std::min(best_soa, std::chrono::duration<double, std::nano>(t1 - t0).count() / (double(reps) * n));
+            best_aos = std::min(best_aos, std::chrono::duration<double, std::nano>(t2 - t1).count() / (double(reps) * n));
+        }
+
+        // Keep both results live so the loops aren't optimized away
+        float check = store.propeller_angle[n-1] + aos[n-1].propeller_angle;
+        std::cout << "  " << n << " entities: SoA " << best_soa << "  AoS " << best_aos
+                  << "  (x" << best_aos / best_soa << ")" << (check < 0 ? " !" : "") << std::endl;
+    }
 }
 
 //----------------------------------------------------------------------------
 // Initialization & Loop
 //----------------------------------------------------------------------------
 
+// Make a variant's program current and look its uniforms up. Uniform values
+// belong to the program, so the ones that never change are set here too.
+void UseVariant(int variant)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    shader_variant = variant;
+    program = shaders.Program( variant );
+    GLState::UseProgram( program );
+
+    ModelLoc = glGetUniformLocation( program, "Model" );
+    ViewLoc = glGetUniformLocation( program, "View" );
+    ProjectionLoc = glGetUniformLocation( program, "Projection" );
+    InstancedLoc = glGetUniformLocation( program, "Instanced" );
+
+    AmbientProductLoc = glGetUniformLocation(program, "AmbientProduct");
+    DiffuseProductLoc = glGetUniformLocation(program, "DiffuseProduct");
+    SpecularProductLoc = glGetUniformLocation(program, "SpecularProduct");
+    ShininessLoc = glGetUniformLocation(program, "Shininess");
+    GLState::Uniform1i( InstancedLoc, instancing_on );
+
+    // Lights from uniform buffer binding 0, the clusters' light lists
+    // through texture buffers
+    glUniformBlockBinding( program, glGetUniformBlockIndex( program, "Lights" ), 0 );
+    GLState::Uniform1i( glGetUniformLocation( program, "ClusterRecords" ), LightGrid::RecordsUnit );
+    GLState::Uniform1i( glGetUniformLocation( program, "ClusterLights" ), LightGrid::IndicesUnit );
+    GLState::Uniform3i( glGetUniformLocation( program, "ClusterCount" ),
+                        LightGrid::TilesX, LightGrid::TilesY, LightGrid::Slices );
+    ClusterTileLoc = glGetUniformLocation( program, "ClusterTile" );
+    ClusterDepthLoc = glGetUniformLocation( program, "ClusterDepth" );
+
+    std::cout << "Shader variant: " << shaders.Name( variant ) << ", switched in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+              << " ms" << std::endl;
+}
+
 void init()
 {
-    generateCube();
-    generateCylinder();
-    generateCone();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Map the geometry from the cache if these generators wrote it,
+    // otherwise generate it and cache it for the next launch
+    MeshCache cache;
+    const MeshVertex* vertices;
+    const GLushort* indices;
+    int vertex_count, index_count;
+    bool cached = cache.Open( mesh_cache_path, GeometryKey() ) && cache.RangeCount() == NUM_BATCHES;
+    if (cached) {
+        std::copy( cache.Ranges(), cache.Ranges() + NUM_BATCHES, batch_range );
+        vertices = cache.Vertices();  vertex_count = cache.VertexCount();
+        indices = cache.Indices();    index_count = cache.IndexCount();
+    } else {
+        generateCube();
+        for (int lod = 0; lod < NUM_LODS; ++lod) {
+            generateCylinder(lod);
+            generateCone(lod);
+        }
+        OptimizeGeometry();
+        MeshCache::Write( mesh_cache_path, GeometryKey(), mesh.Vertices(), mesh.Indices(), batch_range, NUM_BATCHES );
+        vertices = &mesh.Vertices()[0];  vertex_count = mesh.Vertices().size();
+        indices = &mesh.Indices()[0];    index_count = mesh.Indices().size();
+    }
+
+    // The finest level bounds the coarser ones
+    for (int p = 0; p < NUM_PRIMITIVES; ++p)
+        primitive_bounds[p] = VertexBounds( vertices, indices, batch_range[Batch(p, 0)] );
+
+    std::cout << "Geometry: " << vertex_count << " vertices (" << vertex_count*sizeof(MeshVertex)
+              << " bytes), " << index_count << " indices (" << index_count*sizeof(GLushort) << " bytes), "
+              << (cached ? "mapped from " : "generated into ") << mesh_cache_path << " in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+              << " ms" << std::endl;
 
     // Create a vertex array object
     GLuint vao;
     glGenVertexArrays( 1, &vao );
     glBindVertexArray( vao );
 
-    // Create and initialize a buffer object
+    // Create and initialize the vertex and index buffers (the index buffer
+    // binding is part of the VAO), leaving room for the models after the primitives
+    GLsizeiptr vertex_bytes = vertex_count*sizeof(MeshVertex), index_bytes = index_count*sizeof(GLushort);
+    GLsizeiptr vertex_arena = model_paths.empty() ? 0 : model_arena_vertices*sizeof(MeshVertex);
+    GLsizeiptr index_arena = model_paths.empty() ? 0 : model_arena_indices*sizeof(GLushort);
+
     GLuint buffer;
     glGenBuffers( 1, &buffer );
-    glBindBuffer( GL_ARRAY_BUFFER, buffer );
-    glBufferData( GL_ARRAY_BUFFER, points.size()*sizeof(point4) + normals.size()*sizeof(vec3) + colors.size()*sizeof(color4),
-		  NULL, GL_STATIC_DRAW );
-    
-    // Subdata
-    int offset = 0;
-    glBufferSubData( GL_ARRAY_BUFFER, offset, points.size()*sizeof(point4), &points[0] );
-    offset += points.size()*sizeof(point4);
-    glBufferSubData( GL_ARRAY_BUFFER, offset, normals.size()*sizeof(vec3), &normals[0] );
-    offset += normals.size()*sizeof(vec3);
-    glBufferSubData( GL_ARRAY_BUFFER, offset, colors.size()*sizeof(color4), &colors[0] );
-
-    // Load shaders
-    program = InitShader( "vshader.glsl", "fshader.glsl" );
-    glUseProgram( program );
+    GLState::BindBuffer( GL_ARRAY_BUFFER, buffer );
+    glBufferData( GL_ARRAY_BUFFER, vertex_bytes + vertex_arena, NULL, GL_STATIC_DRAW );
+    glBufferSubData( GL_ARRAY_BUFFER, 0, vertex_bytes, vertices );
+
+    GLuint index_buffer;
+    glGenBuffers( 1, &index_buffer );
+    GLState::BindBuffer( GL_ELEMENT_ARRAY_BUFFER, index_buffer );
+    glBufferData( GL_ELEMENT_ARRAY_BUFFER, index_bytes + index_arena, NULL, GL_STATIC_DRAW );
+    glBufferSubData( GL_ELEMENT_ARRAY_BUFFER, 0, index_bytes, indices );
+    cache.Close();
+
+    // Start the model loads; they arrive while the shop is already running
+    if (!model_paths.empty()) {
+        int loaders = std::max(1, std::min(int(model_paths.size()), pool->Threads() - 1));
+        models.Init( buffer, vertex_bytes, vertex_bytes + vertex_arena,
+                     index_buffer, index_bytes, index_bytes + index_arena, loaders );
+        for (size_t m = 0; m < model_paths.size(); ++m) models.Load( model_paths[m] );
+    }
+    primitive_bounds.resize( NUM_PRIMITIVES + models.Models(), AABB(vec3(-0.5), vec3(0.5)) );
+
+    // Shader variants, specialized for the number of lights and built
+    // together; after the first launch they load from the binary cache
+    char defines[64];
+    snprintf( defines, sizeof(defines), "#define NUM_LIGHTS %d\n", light_count );
+    lit_variant = shaders.Add( "vshader.glsl", "fshader.glsl", defines, "lit" );
+    heat_variant = shaders.Add( "vshader.glsl", "fshader.glsl", std::string(defines) + "#define SHOW_CLUSTERS\n",
+                                "cluster heat map" );
+    if (!shaders.Build()) exit( EXIT_FAILURE ); // nothing to draw with
+    light_grid.Init();
+    UseVariant( lit_variant );
 
     // Set up vertex arrays
     GLuint vPosition = glGetAttribLocation( program, "vPosition" );
     glEnableVertexAttribArray( vPosition );
-    glVertexAttribPointer( vPosition, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0) );
+    glVertexAttribPointer( vPosition, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex),
+                           BUFFER_OFFSET(offsetof(MeshVertex, x)) );
 
     GLuint vNormal = glGetAttribLocation( program, "vNormal" );
     glEnableVertexAttribArray( vNormal );
-    glVertexAttribPointer( vNormal, 3, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(points.size()*sizeof(point4)) );
-    
-    // Uniforms
-    ModelLoc = glGetUniformLocation( program, "Model" );
-    ViewLoc = glGetUniformLocation( program, "View" );
-    ProjectionLoc = glGetUniformLocation( program, "Projection" );
-    
-    AmbientProductLoc = glGetUniformLocation(program, "AmbientProduct");
-    DiffuseProductLoc = glGetUniformLocation(program, "DiffuseProduct");
-    SpecularProductLoc = glGetUniformLocation(program, "SpecularProduct");
-    LightPositionLoc = glGetUniformLocation(program, "LightPosition");
-    ShininessLoc = glGetUniformLocation(program, "Shininess");
+    glVertexAttribPointer( vNormal, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(MeshVertex),
+                           BUFFER_OFFSET(offsetof(MeshVertex, normal)) );
+
+
+    // Lights, behind uniform buffer binding 0 and filled every frame
+    PlaceLights( light_count );
+    glGenBuffers( 1, &light_buffer );
+    GLState::BindBuffer( GL_UNIFORM_BUFFER, light_buffer );
+    glBufferData( GL_UNIFORM_BUFFER, light_count*sizeof(GridLight), NULL, GL_DYNAMIC_DRAW );
+    GLState::BindBufferBase( GL_UNIFORM_BUFFER, 0, light_buffer );
+
+    glGenQueries( gpu_query_count, gpu_queries );
+
+    // Per-instance attributes, advanced once per instance instead of per vertex
+    // and streamed through a triple-buffered ring (64 KB per frame to start)
+    instance_ring.Init( GL_ARRAY_BUFFER, 64*1024 );
+    std::cout << "Instance stream: " << (instance_ring.Persistent() ? "persistent mapped" : "orphaning") << std::endl;
+    multi_draw_on = GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+    std::cout << "Batches: " << (multi_draw_on ? "one multi-draw indirect call" : "one instanced call each") << std::endl;
+    const char* model_rows[4] = { "iModel0", "iModel1", "iModel2", "iModel3" };
+    for (int r = 0; r < 4; ++r) {
+        iModelAttr[r] = glGetAttribLocation( program, model_rows[r] );
+        glVertexAttribDivisor( iModelAttr[r], 1 );
+    }
+    iColorAttr = glGetAttribLocation( program, "iColor" );
+    glVertexAttribDivisor( iColorAttr, 1 );
+
+    SetInstancing( instancing_on );
 
     glEnable( GL_DEPTH_TEST );
     glClearColor( 0.5, 0.7, 1.0, 1.0 ); // Sky blue bg
 
     // Init Planes Position
+    fleet.Reserve(8 + fleet_size);
     for(int i=1; i<=8; i++) {
-        planes[i].position = vec3( (i-4.5)*3.0, 0.0, 0.0 );
-        planes[i].aux_state = false;
-        planes[i].propeller_speed = 5.0;
+        planes[i] = fleet.Create(i);
+        int e = fleet.Index(planes[i]);
+        fleet.position[e] = vec3( (i-4.5)*3.0, 0.0, 0.0 );
+        fleet.propeller_speed[e] = 5.0;
     }
+    SpawnWarehouse(fleet_size);
+    BuildScene();
+
+    std::cout << "Startup: " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+              << " ms" << std::endl;
 }
 
-void display( void )
+// Split [0, n) into tasks of 'grain' items and run them on the pool
+void ParallelRanges(int n, int grain, const std::function<void(int, int)>& body) {
+    int tasks = (n + grain - 1) / grain;
+    pool->ParallelFor(tasks, [&](int t, int) {
+        body(t*grain, std::min(n, (t+1)*grain));
+    });
+}
+
+const int entity_grain = 16384; // entities per task, the sweeps are ~0.3 ns each
+
+// One fixed simulation step (sim_clock.StepMs() long)
+void step( void )
 {
-    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+    rotation_global += 0.1;
+    
+    // Update Animations
+    ParallelRanges(fleet.Size(), entity_grain, [](int begin, int end) {
+        PROFILE_SCOPE("spin propellers");
+        fleet.SpinPropellers(begin, end);
+    });
+}
+
+// Milliseconds the frame runs at: GLUT's clock, or the fixed one headless
+int FrameTimeMs() {
+    return headless ? headless_ms : glutGet(GLUT_ELAPSED_TIME);
+}
 
+// Run the steps due since the last frame, pose the render state between the
+// last two of them and build the frame's draw lists
+void update( void )
+{
+    PROFILE_SCOPE("update");
+    int steps = sim_clock.Advance( FrameTimeMs() );
+    for (int i = 0; i < steps; ++i) step();
+
+    float alpha = sim_clock.Alpha();
+    ParallelRanges(fleet.Size(), entity_grain, [alpha](int begin, int end) {
+        PROFILE_SCOPE("pose propellers");
+        fleet.PosePropellers(alpha, begin, end);
+    });
+
+    BuildDrawLists();
+}
+
+void frame_timer( int )
+{
+    frame_pending = false;
+    glutPostRedisplay();
+}
+
+// Queue the next frame. With a cap the GLUT loop sleeps until the frame's
+// deadline instead of spinning in an idle callback
+void schedule_frame( void )
+{
+    if (vsync_on || frame_cap <= 0) {
+        glutPostRedisplay(); // paced by SwapBuffers, or deliberately uncapped
+        return;
+    }
+    if (frame_pending) return; // a redisplay from input doesn't start a second chain
+
+    int now = glutGet( GLUT_ELAPSED_TIME );
+    next_frame_ms += 1000.0 / frame_cap;
+    if (next_frame_ms < now) next_frame_ms = now; // fell behind, don't burst
+    frame_pending = true;
+    glutTimerFunc( (unsigned int)(next_frame_ms - now), frame_timer, 0 );
+}
+
+// Ask the driver to sync SwapBuffers to the display refresh
+bool SetSwapInterval( int interval )
+{
+#if defined(_WIN32)
+    if (WGLEW_EXT_swap_control) return wglSwapIntervalEXT( interval ) != 0;
+#elif !defined(__APPLE__)
+    if (GLXEW_SGI_swap_control) return glXSwapIntervalSGI( interval ) == 0;
+#endif
+    return false;
+}
+
+// Move the lights into eye space for this frame's view, sort them into the
+// clusters and upload both; with the lights off ('9') no cluster lists any,
+// leaving only the ambient term
+void UpdateLights() {
+    PROFILE_SCOPE("lights");
+    eye_lights.resize( light_count );
+    for (int i = 0; i < light_count; ++i) {
+        const Light& l = lights[i];
+        GridLight& e = eye_lights[i];
+        e.position = view_matrix * l.position;
+        e.position.w = l.position.w == 0.0 ? 0.0 : l.range;
+        e.color = l.color;
+        e.spot = l.cone > 0.0 ? vec4( vec3( view_matrix * vec4( l.axis, 0.0 ) ), cos( l.cone * DegreesToRadians ) )
+                              : vec4( 0.0, 0.0, 0.0, -1.0 );
+    }
+    GLState::BindBuffer( GL_UNIFORM_BUFFER, light_buffer );
+    glBufferSubData( GL_UNIFORM_BUFFER, 0, light_count*sizeof(GridLight), &eye_lights[0] );
+
+    light_grid.Build( &eye_lights[0], light_on ? light_count : 0, fovy, aspect, zNear, zFar,
+                      window_width, window_height, *pool );
+    light_grid.Upload();
+    GLState::Uniform2fv( ClusterTileLoc, light_grid.TileSize() );
+    GLState::Uniform2fv( ClusterDepthLoc, light_grid.DepthScale() );
+}
+
+// GPU time of frame 'frame' (as gpu_query_frame counts), one of the last
+// gpu_query_count; -1 if the GPU isn't done with it, unless told to wait
+double GpuTime(int frame, bool wait) {
+    GLuint query = gpu_queries[frame % gpu_query_count];
+    GLint available = wait;
+    if (!wait) glGetQueryObjectiv( query, GL_QUERY_RESULT_AVAILABLE, &available );
+    if (!available) return -1.0;
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v( query, GL_QUERY_RESULT, &ns );
+    return ns * 1e-6;
+}
+
+void AddGpuTime(int frame, double ms) {
+    frame_stats.AddGpu( ms );
+    if (record_first >= 0 && frame >= record_first) gpu_records.push_back( ms );
+}
+
+// Collect the query issued gpu_query_count frames ago, whose slot this
+// frame's draws reuse, if the GPU has finished it. Headless runs wait for
+// it, so no frame goes uncounted; display() calls this before its CPU
+// timings start, so the wait doesn't count as CPU time.
+void CollectGpuTimer() {
+    if (gpu_query_frame >= gpu_query_count) {
+        int frame = gpu_query_frame - gpu_query_count;
+        double ms = GpuTime( frame, headless );
+        if (ms >= 0.0) AddGpuTime( frame, ms );
+    }
+}
+
+// Time this frame's draws
+void BeginGpuTimer() {
+    glBeginQuery( GL_TIME_ELAPSED, gpu_queries[gpu_query_frame % gpu_query_count] );
+}
+
+void EndGpuTimer() {
+    glEndQuery( GL_TIME_ELAPSED );
+    ++gpu_query_frame;
+}
+
+void display( void )
+{
     // Camera
     // Spherical to Cartesian for eye
     // Actually user wants fps style or spherical. Let's stick to what we have in "eye".
     // Or logic to move "eye" based on WASD.
     // For simplicity, let's keep LookAt logic using global 'eye' and 'at'.
+    // Set before update() so the draw lists are culled against this frame's view
     
     view_matrix = LookAt( eye, at, up );
-    glUniformMatrix4fv( ViewLoc, 1, GL_TRUE, view_matrix );
-
     projection = Perspective( fovy, aspect, zNear, zFar );
-    glUniformMatrix4fv( ProjectionLoc, 1, GL_TRUE, projection );
 
-    // Lighting
-    glUniform4fv( LightPositionLoc, 1, light_position );
-    
-    // Draw Environment
-    DrawShop();
+    CollectGpuTimer();
 
-    // Draw Planes
-    for(int i=1; i<=8; i++) {
-        mat4 mt = Translate(planes[i].position);
-        
-        // Apply Orientation
-        mt *= RotateY(planes[i].rotation.y);
-        mt *= RotateX(planes[i].rotation.x);
-        mt *= RotateZ(planes[i].rotation.z);
-        
-        // Select Model
-        switch(i) {
-            case 1: DrawJet(mt, i); break;
-            case 2: DrawPropPlane(mt, i); break;
-            case 3: DrawHelicopter(mt, i); break;
-            case 4: DrawPaperPlane(mt, i); break;
-            case 5: DrawDrone(mt, i); break;
-            case 6: DrawRocket(mt, i); break;
-            case 7: DrawBalloon(mt, i); break;
-            case 8: DrawFighter(mt, i); break;
-        }
+    Profiler::BeginFrame();
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    update();
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+    GLState::ResetCounters();
+
+    {
+        PROFILE_SCOPE("upkeep");
+
+        // Pick up edited shaders; new programs need their uniforms again
+        if (shaders.Poll( FrameTimeMs() )) UseVariant( shader_variant );
+
+        // Next chunk of any model still on its way to the GPU
+        models.Pump();
+    }
+
+    GLState::UniformMatrix4fv( ViewLoc, GL_TRUE, view_matrix );
+    GLState::UniformMatrix4fv( ProjectionLoc, GL_TRUE, projection );
+
+    UpdateLights();
+
+    // Draw Environment and Planes
+    BeginGpuTimer();
+    PROFILE_GPU_BEGIN("draw");
+    SubmitDrawLists();
+    PROFILE_GPU_END();
+    EndGpuTimer();
+
+    if (Profiler::Overlay()) {
+        PROFILE_SCOPE("overlay");
+        Profiler::DrawOverlay( window_width, window_height );
+    }
+
+    if (!headless) {
+        PROFILE_SCOPE("swap");
+        glutSwapBuffers();
+    }
+    Profiler::EndFrame( FrameTimeMs() );
+
+    // Update (simulation + draw-list build) vs render (submission + SwapBuffers)
+    std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+    frame_stats.AddUpdate( std::chrono::duration<double, std::milli>(t1 - t0).count() );
+    frame_stats.AddRender( std::chrono::duration<double, std::milli>(t2 - t1).count() );
+    if (record_first >= 0) {
+        FrameRecord r = { std::chrono::duration<double, std::milli>(t1 - t0).count(),
+                          std::chrono::duration<double, std::milli>(t2 - t1).count(),
+                          draw_calls, triangles_submitted, GLState::Issued() };
+        frame_records.push_back( r );
+    }
+    if (headless) return; // RunHeadless() drives the frames and there's no title
+
+    double fps, update_ms, render_ms, gpu_ms;
+    if (frame_stats.Report( glutGet(GLUT_ELAPSED_TIME), &fps, &update_ms, &render_ms, &gpu_ms )) {
+        char title[256];
+        int n = snprintf( title, sizeof(title), "Toy Airplane Shop - %.0f fps | update %.2f ms | render %.2f ms | gpu %.2f ms | drawn %d, culled %d | %d tris",
+                          fps, update_ms, render_ms, gpu_ms, objects_drawn, int(object_root.size()) - objects_drawn, triangles_submitted );
+        if (n > 0 && n < (int)sizeof(title))
+            n += snprintf( title + n, sizeof(title) - n, " | %d draws, state calls %d, skipped %d",
+                           draw_calls, GLState::Issued(), GLState::Skipped() );
+        if (models.Pending() > 0 && n > 0 && n < (int)sizeof(title))
+            snprintf( title + n, sizeof(title) - n, " | loading %d models", models.Pending() );
+        glutSetWindowTitle( title );
     }
 
-    glutSwapBuffers();
+    schedule_frame();
 }
 
 void keyboard( unsigned char key, int x, int y )
@@ -532,31 +1591,44 @@ void keyboard( unsigned char key, int x, int y )
             case 'd': eye += right*step; at += right*step; break;
             case 'q': eye.y += step; at.y += step; break;
             case 'e': eye.y -= step; at.y -= step; break;
-            case '9': light_on = !light_on; 
-                      glUniform4fv( AmbientProductLoc, 1, light_on ? light_ambient : color4(0,0,0,1) );
+            case '9': light_on = !light_on; break; // UpdateLights() darkens them
+            case 'h': UseVariant( shader_variant == lit_variant ? heat_variant : lit_variant ); break;
+            case 'm': SetInstancing(!instancing_on);
+                      std::cout << "Instancing: " << (instancing_on ? "on" : "off") << std::endl;
                       break;
+            case 'c': culling_on = !culling_on;
+                      std::cout << "Culling: " << (culling_on ? "on" : "off") << std::endl;
+                      break;
+            case 'l': lod_on = !lod_on;
+                      std::cout << "Level of detail: " << (lod_on ? "on" : "off") << std::endl;
+                      break;
+            case 'g': GLState::SetEnabled(!GLState::Enabled());
+                      std::cout << "State cache: " << (GLState::Enabled() ? "on" : "off") << std::endl;
+                      break;
+            case 'p': Profiler::SetOverlay(!Profiler::Overlay()); break;
+            case 't': Profiler::WriteTrace(trace_path.empty() ? "trace.json" : trace_path); break;
         }
     } else {
         // Plane Control
         // W/S: Forward/Back (Local Z)
         // A/D: Yaw
-        ObjectState& b = planes[selected_object];
+        int b = fleet.Index(planes[selected_object]);
         float move_speed = 0.2;
         float rot_speed = 2.0;
         
         switch(key) {
-            case 'w': b.position.z -= move_speed; break;
-            case 's': b.position.z += move_speed; break;
-            case 'a': b.rotation.y += rot_speed; break;
-            case 'd': b.rotation.y -= rot_speed; break;
-            case 'q': b.position.y += move_speed; break;
-            case 'e': b.position.y -= move_speed; break;
-            case 'r': b.rotation.x -= rot_speed; break;
-            case 'f': b.rotation.x += rot_speed; break;
-            case 'u': b.propeller_speed += 1.0; break;
-            case 'j': b.propeller_speed -= 1.0; break;
-            case 'i': b.aux_state = !b.aux_state; break;
-            case ' ': if (selected_object == 6) b.position.y += 0.5; break; // Rocket launch
+            case 'w': fleet.position[b].z -= move_speed; break;
+            case 's': fleet.position[b].z += move_speed; break;
+            case 'a': fleet.rotation[b].y += rot_speed; break;
+            case 'd': fleet.rotation[b].y -= rot_speed; break;
+            case 'q': fleet.position[b].y += move_speed; break;
+            case 'e': fleet.position[b].y -= move_speed; break;
+            case 'r': fleet.rotation[b].x -= rot_speed; break;
+            case 'f': fleet.rotation[b].x += rot_speed; break;
+            case 'u': fleet.propeller_speed[b] += 1.0; break;
+            case 'j': fleet.propeller_speed[b] -= 1.0; break;
+            case 'i': fleet.aux_state[b] = !fleet.aux_state[b]; break;
+            case ' ': if (selected_object == 6) fleet.position[b].y += 0.5; break; // Rocket launch
         }
     }
 
@@ -570,27 +1642,296 @@ void keyboard( unsigned char key, int x, int y )
     glutPostRedisplay();
 }
 
-void idle( void )
-{
-    rotation_global += 0.1;
-    
-    // Update Animations
-    for(int i=1; i<=8; i++) {
-        planes[i].propeller_angle += planes[i].propeller_speed;
-        if(planes[i].propeller_angle > 360) planes[i].propeller_angle -= 360;
-    }
-    
-    glutPostRedisplay();
-}
-
 void reshape( int width, int height )
 {
     glViewport( 0, 0, width, height );
+    window_width = width;
+    window_height = height;
     aspect = GLfloat(width)/height;
 }
 
+// Put the camera and the scripted aircraft where the timeline has them
+void ApplyTimeline(double seconds) {
+    vec3 a, b;
+    if (timeline.Has(Timeline::Camera)) {
+        timeline.Sample(Timeline::Camera, seconds, &a, &b);
+        eye = vec4(a, 1.0);
+        at = vec4(b, 1.0);
+    }
+    for (int n = 1; n < Timeline::Tracks; ++n) {
+        if (!timeline.Has(n)) continue;
+        int e = fleet.Index(planes[n]);
+        timeline.Sample(n, seconds, &fleet.position[e], &fleet.rotation[e]);
+    }
+}
+
+// Make the offscreen target, then the scene in it; false without a context
+bool StartHeadless() {
+    if (!offscreen.Init( headless_width, headless_height )) return false;
+    init();
+    reshape( headless_width, headless_height );
+
+    // Models arrive on their own time; wait for all of them so the first
+    // frame is the same every run
+    while (models.Pending() > 0) {
+        models.Pump();
+        std::this_thread::sleep_for( std::chrono::milliseconds(1) );
+    }
+    sim_clock.Reset( 0 );
+    return true;
+}
+
+// Frame f of a headless run, at its time on the fixed clock
+void HeadlessFrame(int f) {
+    headless_ms = int(f * 1000.0 / capture_fps + 0.5);
+    ApplyTimeline( double(f) / capture_fps );
+    display();
+}
+
+// Render the frames offscreen on the fixed clock and write them out; the
+// exit status for main()
+int RunHeadless() {
+    if (!timeline_path.empty()) {
+        std::string error;
+        if (!timeline.Load( timeline_path.c_str(), error )) {
+            std::cerr << "Timeline: " << timeline_path << ": " << error << std::endl;
+            return 1;
+        }
+    }
+    int frames = capture_frames;
+    if (frames <= 0) frames = int(timeline.Length() * capture_fps) + 1;
+
+    if (!StartHeadless()) return 1;
+    if (!capture_path.empty() && !capture.Init( headless_width, headless_height )) return 1;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int f = 0; f < frames; ++f) {
+        HeadlessFrame( f );
+        if (!capture_path.empty() && !capture.Read( f )) return 1;
+    }
+    if (!capture_path.empty() && !capture.Finish()) return 1;
+    glFinish();
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Headless: " << frames << " frames of " << headless_width << "x" << headless_height
+              << " in " << ms << " ms (" << ms / frames << " ms each)";
+    if (!capture_path.empty())
+        std::cout << ", " << capture.Written() << " written to " << capture_path
+                  << ", readback waited " << capture.StallMs() << " ms";
+    std::cout << std::endl;
+
+    capture.Release();
+    if (!trace_path.empty() && !Profiler::WriteTrace( trace_path )) return 1;
+    return 0;
+}
+
+// Nearest-rank percentiles and the mean of a series
+struct Spread {
+    double min, median, p95, p99, mean;
+};
+
+Spread Summarize(std::vector<double> v) {
+    Spread s = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+    if (v.empty()) return s;
+    std::sort(v.begin(), v.end());
+    auto rank = [&](double p) { return v[std::max(size_t(1), size_t(ceil(p * v.size()))) - 1]; };
+    s.min = v.front();
+    s.median = rank(0.50);
+    s.p95 = rank(0.95);
+    s.p99 = rank(0.99);
+    for (double x : v) s.mean += x;
+    s.mean /= v.size();
+    return s;
+}
+
+std::string SpreadJson(const Spread& s) {
+    char text[160];
+    snprintf(text, sizeof(text), "{\"min\": %.3f, \"median\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"mean\": %.3f}",
+             s.min, s.median, s.p95, s.p99, s.mean);
+    return text;
+}
+
+const BenchScene* FindBenchScene(const std::string& name) {
+    for (const BenchScene& s : bench_scenes)
+        if (name == s.name) return &s;
+    return NULL;
+}
+
+// One scene, in this process: warm up, record, and print a table row and
+// a JSON object for RunBench() to collect
+int RunBenchScene(const BenchScene& scene) {
+    fleet_size = scene.fleet;
+    light_count = scene.lights;
+    int frames = capture_frames > 0 ? capture_frames : bench_frames;
+    double last = double(bench_warmup + frames - 1) / capture_fps;
+    timeline.Clear();
+    for (int k = 0; k < 2; ++k)
+        timeline.Add(Timeline::Camera, k * last, scene.eye[k], scene.at[k]);
+
+    if (!StartHeadless()) return 1;
+    for (int f = 0; f < bench_warmup + frames; ++f) {
+        if (f == bench_warmup) record_first = gpu_query_frame;
+        HeadlessFrame(f);
+    }
+    for (int f = std::max(record_first, gpu_query_frame - gpu_query_count); f < gpu_query_frame; ++f)
+        AddGpuTime(f, GpuTime(f, true));
+
+    std::vector<double> cpu, update, render;
+    double draws = 0.0, triangles = 0.0, state_calls = 0.0;
+    for (const FrameRecord& r : frame_records) {
+        cpu.push_back(r.update_ms + r.render_ms);
+        update.push_back(r.update_ms);
+        render.push_back(r.render_ms);
+        draws += r.draws;
+        triangles += r.triangles;
+        state_calls += r.state_calls;
+    }
+    size_t n = std::max(size_t(1), frame_records.size());
+    Spread c = Summarize(cpu), g = Summarize(gpu_records);
+
+    std::string renderer = (const char*)glGetString(GL_RENDERER);
+    for (char& ch : renderer)
+        if (ch == '"' || ch == '\\' || (unsigned char)ch < ' ') ch = ' ';
+
+    printf("bench-row %-11s %8.2f %8.2f %8.2f %8.2f  %8.2f %8.2f %8.2f %8.2f  %6.0f %10.0f\n", scene.name,
+           c.min, c.median, c.p95, c.p99, g.min, g.median, g.p95, g.p99, draws / n, triangles / n);
+    printf("bench-json {\"name\": \"%s\", \"fleet\": %d, \"lights\": %d, \"frames\": %d, \"renderer\": \"%s\", "
+           "\"cpu_ms\": %s, \"update_ms\": %s, \"render_ms\": %s, \"gpu_ms\": %s, "
+           "\"draw_calls\": %.1f, \"triangles\": %.0f, \"state_calls\": %.1f}\n",
+           scene.name, scene.fleet, scene.lights, int(frame_records.size()), renderer.c_str(),
+           SpreadJson(c).c_str(), SpreadJson(Summarize(update)).c_str(), SpreadJson(Summarize(render)).c_str(),
+           SpreadJson(g).c_str(), draws / n, triangles / n, state_calls / n);
+    fflush(stdout);
+    return 0;
+}
+
+// Every scene, each in a child process running this binary; nonzero if any failed
+int RunBench(const char* self) {
+    int frames = capture_frames > 0 ? capture_frames : bench_frames;
+    char options[160];
+    snprintf(options, sizeof(options), " --size %dx%d --frames %d --capture-fps %d --threads %d",
+             headless_width, headless_height, frames, capture_fps, thread_count);
+
+    printf("Bench: %dx%d, %d frames after %d warmup at %d fps\n",
+           headless_width, headless_height, frames, bench_warmup, capture_fps);
+    printf("%-11s %35s  %35s  %6s %10s\n", "", "CPU ms: min / median / p95 / p99",
+           "GPU ms: min / median / p95 / p99", "draws", "triangles");
+    fflush(stdout);
+
+    std::vector<std::string> results;
+    int failed = 0;
+    for (const BenchScene& s : bench_scenes) {
+        std::string command = std::string("\"") + self + "\" --bench-scene " + s.name + options;
+        FILE* child = popen(command.c_str(), "r");
+        std::string json;
+        char line[4096];
+        while (child && fgets(line, sizeof(line), child)) {
+            if (strncmp(line, "bench-row ", 10) == 0) {
+                fputs(line + 10, stdout);
+                fflush(stdout);
+            } else if (strncmp(line, "bench-json ", 11) == 0) {
+                json = line + 11;
+                while (!json.empty() && (json.back() == '\n' || json.back() == '\r')) json.pop_back();
+            }
+        }
+        if (!child || pclose(child) != 0 || json.empty()) {
+            printf("%-11s failed\n", s.name);
+            ++failed;
+            continue;
+        }
+        results.push_back(json);
+    }
+
+    if (!bench_json.empty()) {
+        FILE* f = fopen(bench_json.c_str(), "w");
+        if (!f) {
+            std::cerr << "Bench: can't write " << bench_json << std::endl;
+            return 1;
+        }
+        fprintf(f, "{\n  \"width\": %d, \"height\": %d, \"frames\": %d, \"warmup\": %d, \"fps\": %d,\n  \"scenes\": [\n",
+                headless_width, headless_height, frames, bench_warmup, capture_fps);
+        for (size_t i = 0; i < results.size(); ++i)
+            fprintf(f, "    %s%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+        fprintf(f, "  ]\n}\n");
+        if (fclose(f) != 0) {
+            std::cerr << "Bench: can't write " << bench_json << std::endl;
+            return 1;
+        }
+        std::cout << "Bench: wrote " << bench_json << std::endl;
+    }
+    return failed ? 1 : 0;
+}
+
 int main( int argc, char **argv )
 {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--fleet") == 0 && i+1 < argc) {
+            fleet_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fps") == 0 && i+1 < argc) {
+            frame_cap = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+            thread_count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--lights") == 0 && i+1 < argc) {
+            light_count = std::max(1, std::min(MAX_LIGHTS, atoi(argv[++i])));
+        } else if (strcmp(argv[i], "--model") == 0 && i+1 < argc) {
+            // Each model is a batch of its own, and the sort key has room for so many
+            if (NUM_BATCHES + int(model_paths.size()) >= RenderQueue::MaxBatches) {
+                std::cerr << "--model: at most " << RenderQueue::MaxBatches - NUM_BATCHES
+                          << " models" << std::endl;
+                return 1;
+            }
+            model_paths.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "--vsync") == 0) {
+            vsync_on = true;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[i], "--size") == 0 && i+1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &headless_width, &headless_height) != 2 ||
+                headless_width <= 0 || headless_height <= 0) {
+                std::cerr << "--size takes WIDTHxHEIGHT" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--frames") == 0 && i+1 < argc) {
+            capture_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--capture") == 0 && i+1 < argc) {
+            capture_path = argv[++i];
+        } else if (strcmp(argv[i], "--capture-fps") == 0 && i+1 < argc) {
+            capture_fps = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--timeline") == 0 && i+1 < argc) {
+            timeline_path = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i+1 < argc) {
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            bench = true;
+        } else if (strcmp(argv[i], "--bench-scene") == 0 && i+1 < argc) {
+            bench_scene = argv[++i];
+            headless = true;
+        } else if (strcmp(argv[i], "--bench-json") == 0 && i+1 < argc) {
+            bench_json = argv[++i];
+        } else if (strcmp(argv[i], "--bench-update") == 0) {
+            BenchEntityUpdate();
+            return 0;
+        }
+    }
+
+    if (bench) return RunBench(argv[0]);
+    const BenchScene* scene = NULL;
+    if (!bench_scene.empty() && !(scene = FindBenchScene(bench_scene))) {
+        std::cerr << "--bench-scene takes one of:";
+        for (const BenchScene& s : bench_scenes) std::cerr << " " << s.name;
+        std::cerr << std::endl;
+        return 1;
+    }
+
+    // Before anything is printed, in case the frames are to go to stdout
+    if (headless && !capture_path.empty() && !capture.Open( capture_path )) return 1;
+
+    pool = new TaskPool( thread_count );
+    std::cout << "Worker threads: " << pool->Threads() << std::endl;
+
+    if (scene) return RunBenchScene(*scene);
+    if (headless) return RunHeadless();
+
     glutInit( &argc, argv );
     glutInitDisplayMode( GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH );
     glutInitWindowSize( 1024, 768 );
@@ -602,10 +1943,16 @@ int main( int argc, char **argv )
 
     init();
 
+    if (vsync_on && !SetSwapInterval( 1 )) {
+        std::cout << "Vsync unavailable, falling back to the frame cap" << std::endl;
+        vsync_on = false;
+    }
+    sim_clock.Reset( glutGet(GLUT_ELAPSED_TIME) );
+    next_frame_ms = glutGet( GLUT_ELAPSED_TIME );
+
     glutDisplayFunc( display );
     glutKeyboardFunc( keyboard );
     glutReshapeFunc( reshape );
-    glutIdleFunc( idle );
 
     glutMainLoop();
     return 0;
@@ -8,6 +8,23 @@
 #define __MAT_H__
 
 #include "vec.h"
+#include <cstddef>
+
+//  SIMD kernel selection, fixed at compile time from the target ISA.
+//    Define ANGEL_NO_SIMD to force the scalar code.
+#if !defined(ANGEL_NO_SIMD) && defined(__AVX__)
+#  include <immintrin.h>
+#  define ANGEL_SIMD_AVX
+#  define ANGEL_SIMD_SSE
+#  define ANGEL_SIMD_NAME "AVX"
+#elif !defined(ANGEL_NO_SIMD) && ( defined(__SSE2__) || defined(_M_X64) || \
+	( defined(_M_IX86_FP) && _M_IX86_FP >= 2 ) )
+#  include <emmintrin.h>
+#  define ANGEL_SIMD_SSE
+#  define ANGEL_SIMD_NAME "SSE"
+#else
+#  define ANGEL_SIMD_NAME "scalar"
+#endif
 
 namespace Angel {
 
@@ -25,21 +42,14 @@ public:
     //  --- Constructors and Destructors ---
     //
 
-    mat2( const GLfloat d = GLfloat(1.0) )  // Create a diagional matrix
-	{ _m[0].x = d;  _m[1].y = d;   }
+    constexpr mat2( const GLfloat d = GLfloat(1.0) )  // Create a diagional matrix
+	: _m{ vec2( d, 0.0 ), vec2( 0.0, d ) } {}
 
-    mat2( const vec2& a, const vec2& b )
-	{ _m[0] = a;  _m[1] = b;  }
+    constexpr mat2( const vec2& a, const vec2& b )
+	: _m{ a, b } {}
 
-    mat2( GLfloat m00, GLfloat m10, GLfloat m01, GLfloat m11 )
-	{ _m[0] = vec2( m00, m01 ); _m[1] = vec2( m10, m11 ); }
-
-    mat2( const mat2& m ) {
-	if ( *this != m ) {
-	    _m[0] = m._m[0];
-	    _m[1] = m._m[1];
-	} 
-    }
+    constexpr mat2( GLfloat m00, GLfloat m10, GLfloat m01, GLfloat m11 )
+	: _m{ vec2( m00, m01 ), vec2( m10, m11 ) } {}
 
     //
     //  --- Indexing Operator ---
@@ -104,6 +114,9 @@ public:
 	return *this;
     }
 
+    mat2& operator *= ( const mat2& m )
+	{ return *this = *this * m; }
+
     mat2& operator *= ( const GLfloat s ) {
 	_m[0] *= s;  _m[1] *= s;   
 	return *this;
@@ -168,28 +181,18 @@ public:
     //  --- Constructors and Destructors ---
     //
 
-    mat3( const GLfloat d = GLfloat(1.0) )  // Create a diagional matrix
-	{ _m[0].x = d;  _m[1].y = d;  _m[2].z = d;   }
+    constexpr mat3( const GLfloat d = GLfloat(1.0) )  // Create a diagional matrix
+	: _m{ vec3( d, 0.0, 0.0 ), vec3( 0.0, d, 0.0 ), vec3( 0.0, 0.0, d ) } {}
 
-    mat3( const vec3& a, const vec3& b, const vec3& c )
-	{ _m[0] = a;  _m[1] = b;  _m[2] = c;  }
+    constexpr mat3( const vec3& a, const vec3& b, const vec3& c )
+	: _m{ a, b, c } {}
 
-    mat3( GLfloat m00, GLfloat m10, GLfloat m20,
-	  GLfloat m01, GLfloat m11, GLfloat m21,
-	  GLfloat m02, GLfloat m12, GLfloat m22 ) 
-	{
-	    _m[0] = vec3( m00, m01, m02 );
-	    _m[1] = vec3( m10, m11, m12 );
-	    _m[2] = vec3( m20, m21, m22 );
-	}
-
-    mat3( const mat3& m ) {
-	if ( *this != m ) {
-	    _m[0] = m._m[0];
-	    _m[1] = m._m[1];
-	    _m[2] = m._m[2];
-	} 
-    }
+    constexpr mat3( GLfloat m00, GLfloat m10, GLfloat m20,
+		    GLfloat m01, GLfloat m11, GLfloat m21,
+		    GLfloat m02, GLfloat m12, GLfloat m22 )
+	: _m{ vec3( m00, m01, m02 ),
+	      vec3( m10, m11, m12 ),
+	      vec3( m20, m21, m22 ) } {}
 
     //
     //  --- Indexing Operator ---
@@ -254,6 +257,9 @@ public:
 	return *this;
     }
 
+    mat3& operator *= ( const mat3& m )
+	{ return *this = *this * m; }
+
     mat3& operator *= ( const GLfloat s ) {
 	_m[0] *= s;  _m[1] *= s;  _m[2] *= s; 
 	return *this;
@@ -306,6 +312,267 @@ public:
 	{ return static_cast<GLfloat*>( &_m[0].x ); }
 };
 
+//----------------------------------------------------------------------------
+//
+//  4x4 kernels on row-major GLfloat[16] storage
+//
+//    The SIMD versions accumulate in the same order as the scalar ones
+//    (starting from zero, k = 0..3), so results are bit-identical as long
+//    as the compiler doesn't contract the scalar loops into FMAs.
+//    The result must not alias either operand.
+//
+
+inline
+void Mat4MulScalar( GLfloat* r, const GLfloat* a, const GLfloat* b )
+{
+    for ( int i = 0; i < 4; ++i ) {
+	for ( int j = 0; j < 4; ++j ) {
+	    GLfloat s = GLfloat(0.0);
+	    for ( int k = 0; k < 4; ++k ) {
+		s += a[4*i+k] * b[4*k+j];
+	    }
+	    r[4*i+j] = s;
+	}
+    }
+}
+
+inline
+void Mat4MulVec4Scalar( GLfloat* r, const GLfloat* m, const GLfloat* v )
+{
+    for ( int i = 0; i < 4; ++i ) {
+	r[i] = m[4*i+0]*v[0] + m[4*i+1]*v[1] + m[4*i+2]*v[2] + m[4*i+3]*v[3];
+    }
+}
+
+inline
+void TransformPointsScalar( const GLfloat* m, const GLfloat* in, GLfloat* out,
+			    size_t n )
+{
+    for ( size_t p = 0; p < n; ++p ) {
+	// A copy, since Mat4MulVec4Scalar's result can't alias its operand
+	GLfloat v[4] = { in[4*p+0], in[4*p+1], in[4*p+2], in[4*p+3] };
+	Mat4MulVec4Scalar( out + 4*p, m, v );
+    }
+}
+
+#ifdef ANGEL_SIMD_SSE
+
+//  Columns of m, so that m * v = c0*v.x + c1*v.y + c2*v.z + c3*v.w
+inline
+void Mat4ColumnsSSE( const GLfloat* m, __m128& c0, __m128& c1,
+		     __m128& c2, __m128& c3 )
+{
+    c0 = _mm_loadu_ps( m + 0 );
+    c1 = _mm_loadu_ps( m + 4 );
+    c2 = _mm_loadu_ps( m + 8 );
+    c3 = _mm_loadu_ps( m + 12 );
+    _MM_TRANSPOSE4_PS( c0, c1, c2, c3 );
+}
+
+#endif // ANGEL_SIMD_SSE
+
+inline
+void Mat4Mul( GLfloat* r, const GLfloat* a, const GLfloat* b )
+{
+#if defined(ANGEL_SIMD_SSE)
+    // One row per iteration; 256-bit two-row variants were slower here
+    // (store-forwarding stalls on chained products), so AVX builds use
+    // the same VEX-encoded 128-bit code.
+    __m128 b0 = _mm_loadu_ps( b + 0 );
+    __m128 b1 = _mm_loadu_ps( b + 4 );
+    __m128 b2 = _mm_loadu_ps( b + 8 );
+    __m128 b3 = _mm_loadu_ps( b + 12 );
+
+    for ( int i = 0; i < 4; ++i ) {
+	const GLfloat* ar = a + 4*i;
+	__m128 s = _mm_setzero_ps();
+	s = _mm_add_ps( s, _mm_mul_ps( _mm_set1_ps( ar[0] ), b0 ) );
+	s = _mm_add_ps( s, _mm_mul_ps( _mm_set1_ps( ar[1] ), b1 ) );
+	s = _mm_add_ps( s, _mm_mul_ps( _mm_set1_ps( ar[2] ), b2 ) );
+	s = _mm_add_ps( s, _mm_mul_ps( _mm_set1_ps( ar[3] ), b3 ) );
+	_mm_storeu_ps( r + 4*i, s );
+    }
+#else
+    Mat4MulScalar( r, a, b );
+#endif
+}
+
+inline
+void Mat4MulVec4( GLfloat* r, const GLfloat* m, const GLfloat* v )
+{
+#if defined(ANGEL_SIMD_SSE)
+    __m128 c0, c1, c2, c3;
+    Mat4ColumnsSSE( m, c0, c1, c2, c3 );
+
+    __m128 s = _mm_mul_ps( c0, _mm_set1_ps( v[0] ) );
+    s = _mm_add_ps( s, _mm_mul_ps( c1, _mm_set1_ps( v[1] ) ) );
+    s = _mm_add_ps( s, _mm_mul_ps( c2, _mm_set1_ps( v[2] ) ) );
+    s = _mm_add_ps( s, _mm_mul_ps( c3, _mm_set1_ps( v[3] ) ) );
+    _mm_storeu_ps( r, s );
+#else
+    Mat4MulVec4Scalar( r, m, v );
+#endif
+}
+
+//  out[p] = m * in[p] for n homogeneous points; in and out may be the same array
+inline
+void TransformPoints( const GLfloat* m, const GLfloat* in, GLfloat* out,
+		      size_t n )
+{
+#if defined(ANGEL_SIMD_SSE)
+    __m128 c0, c1, c2, c3;
+    Mat4ColumnsSSE( m, c0, c1, c2, c3 );
+    size_t p = 0;
+
+#  if defined(ANGEL_SIMD_AVX)
+    // Two points per iteration, one per 128-bit lane
+    __m256 d0 = _mm256_set_m128( c0, c0 );
+    __m256 d1 = _mm256_set_m128( c1, c1 );
+    __m256 d2 = _mm256_set_m128( c2, c2 );
+    __m256 d3 = _mm256_set_m128( c3, c3 );
+
+    for ( ; p + 2 <= n; p += 2 ) {
+	__m256 v = _mm256_loadu_ps( in + 4*p );
+	__m256 s = _mm256_mul_ps( d0, _mm256_permute_ps( v, 0x00 ) );
+	s = _mm256_add_ps( s, _mm256_mul_ps( d1, _mm256_permute_ps( v, 0x55 ) ) );
+	s = _mm256_add_ps( s, _mm256_mul_ps( d2, _mm256_permute_ps( v, 0xAA ) ) );
+	s = _mm256_add_ps( s, _mm256_mul_ps( d3, _mm256_permute_ps( v, 0xFF ) ) );
+	_mm256_storeu_ps( out + 4*p, s );
+    }
+#  endif
+
+    for ( ; p < n; ++p ) {
+	__m128 v = _mm_loadu_ps( in + 4*p );
+	__m128 s = _mm_mul_ps( c0, _mm_shuffle_ps( v, v, 0x00 ) );
+	s = _mm_add_ps( s, _mm_mul_ps( c1, _mm_shuffle_ps( v, v, 0x55 ) ) );
+	s = _mm_add_ps( s, _mm_mul_ps( c2, _mm_shuffle_ps( v, v, 0xAA ) ) );
+	s = _mm_add_ps( s, _mm_mul_ps( c3, _mm_shuffle_ps( v, v, 0xFF ) ) );
+	_mm_storeu_ps( out + 4*p, s );
+    }
+#else
+    TransformPointsScalar( m, in, out, n );
+#endif
+}
+
+//----------------------------------------------------------------------------
+//
+//  In-place post-multiplication of the first n rows of a row-major matrix
+//    by Translate(), Scale() and RotateX/Y/Z() (n = 3 for affine).
+//
+
+#ifdef ANGEL_SIMD_SSE
+
+//  row = row*cc + swizzle(row)*ss, the shape of every axis rotation
+template <int Swizzle>
+inline
+void RotateRowsSSE( GLfloat* m, int n, __m128 cc, __m128 ss )
+{
+    for ( int i = 0; i < n; ++i ) {
+	__m128 r = _mm_loadu_ps( m + 4*i );
+	__m128 t = _mm_shuffle_ps( r, r, Swizzle );
+	_mm_storeu_ps( m + 4*i, _mm_add_ps( _mm_mul_ps( r, cc ),
+					    _mm_mul_ps( t, ss ) ) );
+    }
+}
+
+#endif // ANGEL_SIMD_SSE
+
+inline
+void TranslateRows( GLfloat* m, int n, GLfloat x, GLfloat y, GLfloat z )
+{
+#if defined(ANGEL_SIMD_SSE)
+    // Only the last column changes: c3 = c0*x + c1*y + c2*z + c3
+    __m128 c0 = _mm_loadu_ps( m + 0 );
+    __m128 c1 = _mm_loadu_ps( m + 4 );
+    __m128 c2 = _mm_loadu_ps( m + 8 );
+    __m128 c3 = n > 3 ? _mm_loadu_ps( m + 12 ) : _mm_set_ps( 1.0f, 0.0f, 0.0f, 0.0f );
+    _MM_TRANSPOSE4_PS( c0, c1, c2, c3 );
+
+    __m128 s = _mm_mul_ps( c0, _mm_set1_ps( x ) );
+    s = _mm_add_ps( s, _mm_mul_ps( c1, _mm_set1_ps( y ) ) );
+    s = _mm_add_ps( s, _mm_mul_ps( c2, _mm_set1_ps( z ) ) );
+    c3 = _mm_add_ps( s, c3 );
+
+    _MM_TRANSPOSE4_PS( c0, c1, c2, c3 );
+    _mm_storeu_ps( m + 0, c0 );
+    _mm_storeu_ps( m + 4, c1 );
+    _mm_storeu_ps( m + 8, c2 );
+    if ( n > 3 ) { _mm_storeu_ps( m + 12, c3 ); }
+#else
+    for ( int i = 0; i < n; ++i ) {
+	GLfloat* r = m + 4*i;
+	r[3] = r[0]*x + r[1]*y + r[2]*z + r[3];
+    }
+#endif
+}
+
+inline
+void ScaleRows( GLfloat* m, int n, GLfloat x, GLfloat y, GLfloat z )
+{
+#if defined(ANGEL_SIMD_SSE)
+    __m128 f = _mm_set_ps( 1.0f, z, y, x );
+    for ( int i = 0; i < n; ++i ) {
+	_mm_storeu_ps( m + 4*i, _mm_mul_ps( _mm_loadu_ps( m + 4*i ), f ) );
+    }
+#else
+    for ( int i = 0; i < n; ++i ) {
+	GLfloat* r = m + 4*i;
+	r[0] *= x;  r[1] *= y;  r[2] *= z;
+    }
+#endif
+}
+
+//  (x, y, z, w) -> (x, y*c + z*s, z*c - y*s, w)
+inline
+void RotateRowsX( GLfloat* m, int n, GLfloat c, GLfloat s )
+{
+#if defined(ANGEL_SIMD_SSE)
+    RotateRowsSSE<_MM_SHUFFLE( 3, 1, 2, 0 )>( m, n, _mm_set_ps( 1.0f, c, c, 1.0f ),
+					      _mm_set_ps( 0.0f, -s, s, 0.0f ) );
+#else
+    for ( int i = 0; i < n; ++i ) {
+	GLfloat* r = m + 4*i;
+	GLfloat y = r[1];
+	r[1] = y*c + r[2]*s;
+	r[2] = r[2]*c + y*-s;
+    }
+#endif
+}
+
+//  (x, y, z, w) -> (x*c - z*s, y, z*c + x*s, w)
+inline
+void RotateRowsY( GLfloat* m, int n, GLfloat c, GLfloat s )
+{
+#if defined(ANGEL_SIMD_SSE)
+    RotateRowsSSE<_MM_SHUFFLE( 3, 0, 1, 2 )>( m, n, _mm_set_ps( 1.0f, c, 1.0f, c ),
+					      _mm_set_ps( 0.0f, s, 0.0f, -s ) );
+#else
+    for ( int i = 0; i < n; ++i ) {
+	GLfloat* r = m + 4*i;
+	GLfloat x = r[0];
+	r[0] = x*c + r[2]*-s;
+	r[2] = r[2]*c + x*s;
+    }
+#endif
+}
+
+//  (x, y, z, w) -> (x*c + y*s, y*c - x*s, z, w)
+inline
+void RotateRowsZ( GLfloat* m, int n, GLfloat c, GLfloat s )
+{
+#if defined(ANGEL_SIMD_SSE)
+    RotateRowsSSE<_MM_SHUFFLE( 3, 2, 0, 1 )>( m, n, _mm_set_ps( 1.0f, 1.0f, c, c ),
+					      _mm_set_ps( 0.0f, 0.0f, -s, s ) );
+#else
+    for ( int i = 0; i < n; ++i ) {
+	GLfloat* r = m + 4*i;
+	GLfloat x = r[0];
+	r[0] = x*c + r[1]*s;
+	r[1] = r[1]*c + x*-s;
+    }
+#endif
+}
+
 //----------------------------------------------------------------------------
 //
 //  mat4 - 4D square matrix
@@ -320,38 +587,28 @@ public:
     //  --- Constructors and Destructors ---
     //
 
-    mat4( const GLfloat d = GLfloat(1.0) )  // Create a diagional matrix
-	{ _m[0].x = d;  _m[1].y = d;  _m[2].z = d;  _m[3].w = d; }
-
-    mat4( const vec4& a, const vec4& b, const vec4& c, const vec4& d )
-	{ _m[0] = a;  _m[1] = b;  _m[2] = c;  _m[3] = d; }
+    constexpr mat4( const GLfloat d = GLfloat(1.0) )  // Create a diagional matrix
+	: _m{ vec4( d, 0.0, 0.0, 0.0 ), vec4( 0.0, d, 0.0, 0.0 ),
+	      vec4( 0.0, 0.0, d, 0.0 ), vec4( 0.0, 0.0, 0.0, d ) } {}
 
-    mat4( GLfloat m00, GLfloat m10, GLfloat m20, GLfloat m30,
-	  GLfloat m01, GLfloat m11, GLfloat m21, GLfloat m31,
-	  GLfloat m02, GLfloat m12, GLfloat m22, GLfloat m32,
-	  GLfloat m03, GLfloat m13, GLfloat m23, GLfloat m33 )
-	{
-	    _m[0] = vec4( m00, m01, m02, m03 );
-	    _m[1] = vec4( m10, m11, m12, m13 );
-	    _m[2] = vec4( m20, m21, m22, m23 );
-	    _m[3] = vec4( m30, m31, m32, m33 );
-	}
+    constexpr mat4( const vec4& a, const vec4& b, const vec4& c, const vec4& d )
+	: _m{ a, b, c, d } {}
 
-    mat4( const mat4& m ) {
-	if ( *this != m ) {
-	    _m[0] = m._m[0];
-	    _m[1] = m._m[1];
-	    _m[2] = m._m[2];
-	    _m[3] = m._m[3];
-	} 
-    }
+    constexpr mat4( GLfloat m00, GLfloat m10, GLfloat m20, GLfloat m30,
+		    GLfloat m01, GLfloat m11, GLfloat m21, GLfloat m31,
+		    GLfloat m02, GLfloat m12, GLfloat m22, GLfloat m32,
+		    GLfloat m03, GLfloat m13, GLfloat m23, GLfloat m33 )
+	: _m{ vec4( m00, m01, m02, m03 ),
+	      vec4( m10, m11, m12, m13 ),
+	      vec4( m20, m21, m22, m23 ),
+	      vec4( m30, m31, m32, m33 ) } {}
 
     //
     //  --- Indexing Operator ---
     //
 
     vec4& operator [] ( int i ) { return _m[i]; }
-    const vec4& operator [] ( int i ) const { return _m[i]; }
+    constexpr const vec4& operator [] ( int i ) const { return _m[i]; }
 
     //
     //  --- (non-modifying) Arithematic Operators ---
@@ -383,15 +640,7 @@ public:
 	
     mat4 operator * ( const mat4& m ) const {
 	mat4  a( 0.0 );
-
-	for ( int i = 0; i < 4; ++i ) {
-	    for ( int j = 0; j < 4; ++j ) {
-		for ( int k = 0; k < 4; ++k ) {
-		    a[i][j] += _m[i][k] * m[k][j];
-		}
-	    }
-	}
-
+	Mat4Mul( a, *this, m );
 	return a;
     }
 
@@ -409,6 +658,9 @@ public:
 	return *this;
     }
 
+    mat4& operator *= ( const mat4& m )
+	{ return *this = *this * m; }
+
     mat4& operator *= ( const GLfloat s ) {
 	_m[0] *= s;  _m[1] *= s;  _m[2] *= s;  _m[3] *= s;
 	return *this;
@@ -425,16 +677,49 @@ public:
 	return *this *= r;
     }
 
+    //
+    //  --- In-place Transformations ---
+    //
+    //    Each call post-multiplies, e.g. m.rotateX(t) is m = m * RotateX(t),
+    //    but only touches the columns the transform affects instead of
+    //    building the temporary matrix and doing a full 4x4 product.
+    //
+
+    mat4& translate( const GLfloat x, const GLfloat y, const GLfloat z )
+	{ TranslateRows( *this, 4, x, y, z );  return *this; }
+
+    mat4& translate( const vec3& v )
+	{ return translate( v.x, v.y, v.z ); }
+
+    mat4& scale( const GLfloat x, const GLfloat y, const GLfloat z )
+	{ ScaleRows( *this, 4, x, y, z );  return *this; }
+
+    mat4& rotateX( const GLfloat theta ) {
+	GLfloat angle = DegreesToRadians * theta;
+	RotateRowsX( *this, 4, cos(angle), sin(angle) );
+	return *this;
+    }
+
+    mat4& rotateY( const GLfloat theta ) {
+	GLfloat angle = DegreesToRadians * theta;
+	RotateRowsY( *this, 4, cos(angle), sin(angle) );
+	return *this;
+    }
+
+    mat4& rotateZ( const GLfloat theta ) {
+	GLfloat angle = DegreesToRadians * theta;
+	RotateRowsZ( *this, 4, cos(angle), sin(angle) );
+	return *this;
+    }
+
     //
     //  --- Matrix / Vector operators ---
     //
 
     vec4 operator * ( const vec4& v ) const {  // m * v
-	return vec4( _m[0][0]*v.x + _m[0][1]*v.y + _m[0][2]*v.z + _m[0][3]*v.w,
-		     _m[1][0]*v.x + _m[1][1]*v.y + _m[1][2]*v.z + _m[1][3]*v.w,
-		     _m[2][0]*v.x + _m[2][1]*v.y + _m[2][2]*v.z + _m[2][3]*v.w,
-		     _m[3][0]*v.x + _m[3][1]*v.y + _m[3][2]*v.z + _m[3][3]*v.w
-	    );
+	vec4  r;
+	Mat4MulVec4( r, *this, v );
+	return r;
     }
 
     //
@@ -464,55 +749,210 @@ public:
 	{ return static_cast<GLfloat*>( &_m[0].x ); }
 };
 
+//----------------------------------------------------------------------------
+//
+//  affine - 3x4 affine transform (a mat4 whose last row is 0 0 0 1)
+//
+//    Only the top three rows are stored, so composing two transforms is a
+//    3x3 product plus the translation column instead of a full 4x4 product.
+//
+
+class affine {
+
+    vec4  _m[3];
+
+public:
+    //
+    //  --- Constructors and Destructors ---
+    //
+
+    constexpr affine( const GLfloat d = GLfloat(1.0) )  // Create a diagional matrix
+	: _m{ vec4( d, 0.0, 0.0, 0.0 ), vec4( 0.0, d, 0.0, 0.0 ),
+	      vec4( 0.0, 0.0, d, 0.0 ) } {}
+
+    constexpr affine( const vec4& a, const vec4& b, const vec4& c )
+	: _m{ a, b, c } {}
+
+    explicit constexpr affine( const mat4& m )  // drops the last row of m
+	: _m{ m[0], m[1], m[2] } {}
+
+    //
+    //  --- Indexing Operator ---
+    //
+
+    vec4& operator [] ( int i ) { return _m[i]; }
+    const vec4& operator [] ( int i ) const { return _m[i]; }
+
+    //
+    //  --- Composition ---
+    //
+
+    affine operator * ( const affine& m ) const {
+	affine  a;
+#if defined(ANGEL_SIMD_SSE)
+	__m128 b0 = _mm_loadu_ps( m._m[0] );
+	__m128 b1 = _mm_loadu_ps( m._m[1] );
+	__m128 b2 = _mm_loadu_ps( m._m[2] );
+	__m128 w  = _mm_castsi128_ps( _mm_set_epi32( -1, 0, 0, 0 ) );
+
+	for ( int i = 0; i < 3; ++i ) {
+	    __m128 ar = _mm_loadu_ps( _m[i] );
+	    __m128 s = _mm_mul_ps( _mm_shuffle_ps( ar, ar, 0x00 ), b0 );
+	    s = _mm_add_ps( s, _mm_mul_ps( _mm_shuffle_ps( ar, ar, 0x55 ), b1 ) );
+	    s = _mm_add_ps( s, _mm_mul_ps( _mm_shuffle_ps( ar, ar, 0xAA ), b2 ) );
+	    s = _mm_add_ps( s, _mm_and_ps( ar, w ) );  // + (0, 0, 0, translation)
+	    _mm_storeu_ps( a._m[i], s );
+	}
+#else
+	for ( int i = 0; i < 3; ++i ) {
+	    const vec4& r = _m[i];
+	    a._m[i] = r.x*m._m[0] + r.y*m._m[1] + r.z*m._m[2];
+	    a._m[i].w += r.w;
+	}
+#endif
+	return a;
+    }
+
+    affine& operator *= ( const affine& m )
+	{ return *this = *this * m; }
+
+    //
+    //  --- In-place Transformations (see mat4) ---
+    //
+
+    affine& translate( const GLfloat x, const GLfloat y, const GLfloat z )
+	{ TranslateRows( &_m[0].x, 3, x, y, z );  return *this; }
+
+    affine& translate( const vec3& v )
+	{ return translate( v.x, v.y, v.z ); }
+
+    affine& scale( const GLfloat x, const GLfloat y, const GLfloat z )
+	{ ScaleRows( &_m[0].x, 3, x, y, z );  return *this; }
+
+    affine& rotateX( const GLfloat theta ) {
+	GLfloat angle = DegreesToRadians * theta;
+	RotateRowsX( &_m[0].x, 3, cos(angle), sin(angle) );
+	return *this;
+    }
+
+    affine& rotateY( const GLfloat theta ) {
+	GLfloat angle = DegreesToRadians * theta;
+	RotateRowsY( &_m[0].x, 3, cos(angle), sin(angle) );
+	return *this;
+    }
+
+    affine& rotateZ( const GLfloat theta ) {
+	GLfloat angle = DegreesToRadians * theta;
+	RotateRowsZ( &_m[0].x, 3, cos(angle), sin(angle) );
+	return *this;
+    }
+
+    //
+    //  --- Matrix / Vector operators ---
+    //
+
+    vec4 operator * ( const vec4& v ) const {  // m * v, w is passed through
+	return vec4( dot( _m[0], v ), dot( _m[1], v ), dot( _m[2], v ), v.w );
+    }
+
+    //
+    //  --- Insertion and Extraction Operators ---
+    //
+
+    friend std::ostream& operator << ( std::ostream& os, const affine& m ) {
+	return os << std::endl 
+		  << m[0] << std::endl
+		  << m[1] << std::endl
+		  << m[2] << std::endl;
+    }
+
+    //
+    //  --- Conversion Operators ---
+    //
+
+    operator mat4 () const
+	{ return mat4( _m[0], _m[1], _m[2], vec4( 0.0, 0.0, 0.0, 1.0 ) ); }
+};
+
+//----------------------------------------------------------------------------
+//
+//  Layout guarantees (see vec.h)
+//
+
+static_assert( sizeof(mat2) == 4*sizeof(GLfloat), "mat2 must be packed" );
+static_assert( sizeof(mat3) == 9*sizeof(GLfloat), "mat3 must be packed" );
+static_assert( sizeof(mat4) == 16*sizeof(GLfloat), "mat4 must be packed" );
+static_assert( sizeof(affine) == 12*sizeof(GLfloat), "affine must be packed" );
+static_assert( alignof(mat4) == 16 && alignof(affine) == 16,
+	       "mat4/affine rows must be 16-byte aligned" );
+
+static_assert( std::is_trivially_copyable<mat2>::value, "mat2 must be trivially copyable" );
+static_assert( std::is_trivially_copyable<mat3>::value, "mat3 must be trivially copyable" );
+static_assert( std::is_trivially_copyable<mat4>::value, "mat4 must be trivially copyable" );
+static_assert( std::is_trivially_copyable<affine>::value, "affine must be trivially copyable" );
+
+//----------------------------------------------------------------------------
+//
+//  Batch transform of n points by one matrix
+//
+
+inline
+void TransformPoints( const mat4& m, const vec4* in, vec4* out, size_t n )
+{
+    TransformPoints( m, &in[0].x, &out[0].x, n );
+}
+
 //----------------------------------------------------------------------------
 //
 //  Transformation Matrix Generators
 //
+//    Rows are built whole rather than poking elements of an identity
+//    matrix, which would leave scalar stores for the SIMD kernels to
+//    reload as vectors (a store-forwarding stall).  Translate() goes
+//    through the in-place kernel for the same reason: its last column
+//    mixes constants and runtime values within a row.
+//
 
 inline
 mat4 RotateX( const GLfloat theta )
 {
     GLfloat angle = DegreesToRadians * theta;
+    GLfloat c = cos(angle), s = sin(angle);
 
-    mat4 c;
-    c[2][2] = c[1][1] = cos(angle);
-    c[2][1] = sin(angle);
-    c[1][2] = -c[2][1];
-    return c;
+    return mat4( vec4( 1.0, 0.0, 0.0, 0.0 ),
+		 vec4( 0.0,   c,  -s, 0.0 ),
+		 vec4( 0.0,   s,   c, 0.0 ),
+		 vec4( 0.0, 0.0, 0.0, 1.0 ) );
 }
 
 inline
 mat4 RotateY( const GLfloat theta )
 {
     GLfloat angle = DegreesToRadians * theta;
+    GLfloat c = cos(angle), s = sin(angle);
 
-    mat4 c;
-    c[2][2] = c[0][0] = cos(angle);
-    c[0][2] = sin(angle);
-    c[2][0] = -c[0][2];
-    return c;
+    return mat4( vec4(   c, 0.0,   s, 0.0 ),
+		 vec4( 0.0, 1.0, 0.0, 0.0 ),
+		 vec4(  -s, 0.0,   c, 0.0 ),
+		 vec4( 0.0, 0.0, 0.0, 1.0 ) );
 }
 
 inline
 mat4 RotateZ( const GLfloat theta )
 {
     GLfloat angle = DegreesToRadians * theta;
+    GLfloat c = cos(angle), s = sin(angle);
 
-    mat4 c;
-    c[0][0] = c[1][1] = cos(angle);
-    c[1][0] = sin(angle);
-    c[0][1] = -c[1][0];
-    return c;
+    return mat4( vec4(   c,  -s, 0.0, 0.0 ),
+		 vec4(   s,   c, 0.0, 0.0 ),
+		 vec4( 0.0, 0.0, 1.0, 0.0 ),
+		 vec4( 0.0, 0.0, 0.0, 1.0 ) );
 }
 
 inline
 mat4 Translate( const GLfloat x, const GLfloat y, const GLfloat z )
 {
-    mat4 c;
-    c[0][3] = x;
-    c[1][3] = y;
-    c[2][3] = z;
-    return c;
+    return mat4().translate( x, y, z );
 }
 
 inline
@@ -527,17 +967,16 @@ mat4 Translate( const vec4& v )
     return Translate( v.x, v.y, v.z );
 }
 
-inline
+constexpr
 mat4 Scale( const GLfloat x, const GLfloat y, const GLfloat z )
 {
-    mat4 c;
-    c[0][0] = x;
-    c[1][1] = y;
-    c[2][2] = z;
-    return c;
+    return mat4( vec4(   x, 0.0, 0.0, 0.0 ),
+		 vec4( 0.0,   y, 0.0, 0.0 ),
+		 vec4( 0.0, 0.0,   z, 0.0 ),
+		 vec4( 0.0, 0.0, 0.0, 1.0 ) );
 }
 
-inline
+constexpr
 mat4 Scale( const vec3& v )
 {
     return Scale( v.x, v.y, v.z );
@@ -622,15 +1061,6 @@ mat4 LookAt( const vec4& eye, const vec4& at, const vec4& up )
 
 //----------------------------------------------------------------------------
 
-inline
-mat4 InitShader( const char* vertexShaderFile,
-		 const char* fragmentShaderFile )
-{
-    // Implementation can be added here or in a separate file (e.g. InitShader.cpp)
-    // For now we will rely on Angel::InitShader declared in Angel.h and implemented in the main file or separately
-    return mat4(1.0); // Dummy return if misused
-}
-
 }  // namespace Angel
 
 #endif // __MAT_H__
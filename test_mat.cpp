@@ -0,0 +1,106 @@
+// test_mat: checks the SIMD mat4 kernels in mat.h (Mat4Mul, Mat4MulVec4,
+// TransformPoints) against the scalar reference ones, bit for bit, with no
+// window or GL context; the GL headers only supply GLfloat. Build and run
+// it once per instruction set:
+//
+//     g++ -std=c++17 -O2 test_mat.cpp -o test_mat && ./test_mat
+//     g++ -std=c++17 -O2 -mavx test_mat.cpp -o test_mat && ./test_mat
+//     g++ -std=c++17 -O2 -DANGEL_NO_SIMD test_mat.cpp -o test_mat && ./test_mat
+//
+// It prints each failure and exits 1 if there was one.
+//
+// The kernels add the products in the scalar loops' order, so they match
+// exactly unless the compiler contracts the scalar loops into FMAs. GCC
+// does that in its GNU dialects (the default -std=gnu++) when FMA is
+// enabled; those builds are compared within rounding instead.
+
+#include "Angel.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#if defined(__FMA__) && !defined(__STRICT_ANSI__) && !defined(_MSC_VER)
+#  define TEST_MAT_CONTRACTED
+#endif
+
+int failures = 0;
+
+void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+unsigned seed = 12345;
+
+float Random(float lo, float hi) {
+    seed = seed * 1664525u + 1013904223u;
+    return lo + (hi - lo) * float(seed >> 8) / float(1 << 24);
+}
+
+// Random floats over several magnitudes, so the additions round
+void Fill(GLfloat* v, size_t n) {
+    static const float scales[] = { 1e-3f, 1.0f, 37.0f, 1e4f };
+    for (size_t i = 0; i < n; ++i) v[i] = Random(-1, 1) * scales[i % 4];
+}
+
+bool Same(const GLfloat* a, const GLfloat* b, size_t n) {
+#ifdef TEST_MAT_CONTRACTED
+    for (size_t i = 0; i < n; ++i)
+        if (fabsf(a[i] - b[i]) > 1e-5f * (1.0f + fabsf(b[i]))) return false;
+    return true;
+#else
+    return memcmp(a, b, n * sizeof(GLfloat)) == 0;
+#endif
+}
+
+int main() {
+    const int trials = 10000;
+    bool mul = true, mulvec = true;
+    for (int t = 0; t < trials; ++t) {
+        GLfloat a[16], b[16], v[4], simd[16], scalar[16];
+        Fill(a, 16);
+        Fill(b, 16);
+        Fill(v, 4);
+        Mat4Mul(simd, a, b);
+        Mat4MulScalar(scalar, a, b);
+        mul = mul && Same(simd, scalar, 16);
+        Mat4MulVec4(simd, a, v);
+        Mat4MulVec4Scalar(scalar, a, v);
+        mulvec = mulvec && Same(simd, scalar, 4);
+    }
+    Check(mul, "Mat4Mul matches Mat4MulScalar");
+    Check(mulvec, "Mat4MulVec4 matches Mat4MulVec4Scalar");
+
+    // Every count up to 37, so the AVX two-at-a-time loop leaves a tail
+    bool points = true, inplace = true, inplace_scalar = true;
+    for (size_t n = 0; n <= 37; ++n) {
+        GLfloat m[16];
+        Fill(m, 16);
+        std::vector<GLfloat> in(4*n + 1), simd(4*n + 1), scalar(4*n + 1);
+        Fill(&in[0], 4*n);
+        TransformPoints(m, &in[0], &simd[0], n);
+        TransformPointsScalar(m, &in[0], &scalar[0], n);
+        points = points && Same(&simd[0], &scalar[0], 4*n);
+
+        std::vector<GLfloat> work(in);
+        TransformPoints(m, &work[0], &work[0], n);
+        inplace = inplace && Same(&work[0], &scalar[0], 4*n);
+        work = in;
+        TransformPointsScalar(m, &work[0], &work[0], n);
+        inplace_scalar = inplace_scalar && Same(&work[0], &scalar[0], 4*n);
+    }
+    Check(points, "TransformPoints matches TransformPointsScalar");
+    Check(inplace, "TransformPoints in place");
+    Check(inplace_scalar, "TransformPointsScalar in place");
+
+#ifdef TEST_MAT_CONTRACTED
+    printf("test_mat (%s, FMA contraction): %s\n", ANGEL_SIMD_NAME,
+           failures ? "failed" : "within rounding of the scalar kernels");
+#else
+    printf("test_mat (%s): %s\n", ANGEL_SIMD_NAME,
+           failures ? "failed" : "bit-identical to the scalar kernels");
+#endif
+    return failures ? 1 : 0;
+}
@@ -7,10 +7,22 @@
 #ifndef __VEC_H__
 #define __VEC_H__
 
+#include <cmath>
 #include <iostream>
+#include <type_traits>
 
 namespace Angel {
 
+//  Defined constant for when numbers are too small to be used in the
+//    denominator of a division operation.  This is only used if the
+//    DEBUG macro is defined.
+const GLfloat  DivideByZeroTolerance = GLfloat(1.0e-07);
+
+//  Degrees-to-radians constant 
+const GLfloat  DegreesToRadians = M_PI / 180.0;
+
+struct vec4;
+
 //////////////////////////////////////////////////////////////////////////////
 //
 //  vec2 - 2D vector
@@ -26,14 +38,12 @@ struct vec2 {
     //  --- Constructors and Destructors ---
     //
 
-    vec2( GLfloat s = GLfloat(0.0) ) :
+    constexpr vec2( GLfloat s = GLfloat(0.0) ) :
 	x(s), y(s) {}
 
-    vec2( GLfloat x, GLfloat y ) :
+    constexpr vec2( GLfloat x, GLfloat y ) :
 	x(x), y(y) {}
 
-    vec2( const vec2& v ) { x = v.x;  y = v.y;  }
-
     //
     //  --- Indexing Operator ---
     //
@@ -142,15 +152,16 @@ struct vec3 {
     //  --- Constructors and Destructors ---
     //
 
-    vec3( GLfloat s = GLfloat(0.0) ) :
+    constexpr vec3( GLfloat s = GLfloat(0.0) ) :
 	x(s), y(s), z(s) {}
 
-    vec3( GLfloat x, GLfloat y, GLfloat z ) :
+    constexpr vec3( GLfloat x, GLfloat y, GLfloat z ) :
 	x(x), y(y), z(z) {}
 
-    vec3( const vec3& v ) { x = v.x;  y = v.y;  z = v.z; }
+    constexpr vec3( const vec2& v, const GLfloat f ) :
+	x(v.x), y(v.y), z(f) {}
 
-    vec3( const vec2& v, const GLfloat f ) { x = v.x;  y = v.y;  z = f; }
+    constexpr vec3( const vec4& v );  // drops w, defined after vec4
 
     //
     //  --- Indexing Operator ---
@@ -250,7 +261,7 @@ struct vec3 {
 //
 //////////////////////////////////////////////////////////////////////////////
 
-struct vec4 {
+struct alignas(16) vec4 {
 
     GLfloat  x;
     GLfloat  y;
@@ -261,19 +272,17 @@ struct vec4 {
     //  --- Constructors and Destructors ---
     //
 
-    vec4( GLfloat s = GLfloat(0.0) ) :
+    constexpr vec4( GLfloat s = GLfloat(0.0) ) :
 	x(s), y(s), z(s), w(s) {}
 
-    vec4( GLfloat x, GLfloat y, GLfloat z, GLfloat w ) :
+    constexpr vec4( GLfloat x, GLfloat y, GLfloat z, GLfloat w ) :
 	x(x), y(y), z(z), w(w) {}
 
-    vec4( const vec4& v ) { x = v.x;  y = v.y;  z = v.z;  w = v.w; }
+    constexpr vec4( const vec3& v, const GLfloat w = 1.0 ) :
+	x(v.x), y(v.y), z(v.z), w(w) {}
 
-    vec4( const vec3& v, const GLfloat w = 1.0 ) : w(w)
-	{ x = v.x;  y = v.y;  z = v.z; }
-
-    vec4( const vec2& v, const GLfloat z, const GLfloat w ) : z(z), w(w)
-	{ x = v.x;  y = v.y; }
+    constexpr vec4( const vec2& v, const GLfloat z, const GLfloat w ) :
+	x(v.x), y(v.y), z(z), w(w) {}
 
     //
     //  --- Indexing Operator ---
@@ -367,6 +376,27 @@ struct vec4 {
 	{ return static_cast<GLfloat*>( &x ); }
 };
 
+constexpr inline
+vec3::vec3( const vec4& v ) : x(v.x), y(v.y), z(v.z) {}
+
+//----------------------------------------------------------------------------
+//
+//  Layout guarantees
+//
+//    The vectors are uploaded to GL as raw float arrays and copied around
+//    in bulk (std::vector, instance buffers), so they must stay tightly
+//    packed and trivially copyable.
+//
+
+static_assert( sizeof(vec2) == 2*sizeof(GLfloat), "vec2 must be packed" );
+static_assert( sizeof(vec3) == 3*sizeof(GLfloat), "vec3 must be packed" );
+static_assert( sizeof(vec4) == 4*sizeof(GLfloat), "vec4 must be packed" );
+static_assert( alignof(vec4) == 16, "vec4 must be 16-byte aligned" );
+
+static_assert( std::is_trivially_copyable<vec2>::value, "vec2 must be trivially copyable" );
+static_assert( std::is_trivially_copyable<vec3>::value, "vec3 must be trivially copyable" );
+static_assert( std::is_trivially_copyable<vec4>::value, "vec4 must be trivially copyable" );
+
 //----------------------------------------------------------------------------
 //
 //  Non-class vec3 Methods
@@ -1,13 +1,27 @@
-#version 120
+#version 330
 
-attribute vec4 vPosition;
-attribute vec3 vNormal;
+// Attribute locations are fixed so every program built from these shaders
+// works with the one vertex array object
+layout(location = 0) in vec4 vPosition;
+layout(location = 1) in vec3 vNormal;
 
-varying vec4 color;
+// Per-instance Model matrix rows and color (instanced path only)
+layout(location = 2) in vec4 iModel0;
+layout(location = 3) in vec4 iModel1;
+layout(location = 4) in vec4 iModel2;
+layout(location = 5) in vec4 iModel3;
+layout(location = 6) in vec4 iColor;
+
+// Eye-space position and normal, lit per fragment
+out vec3 fPosition;
+out vec3 fNormal;
+
+// Material, constant across a part
+flat out vec4 ambientProduct, diffuseProduct, specularProduct;
+flat out float shininess;
 
 // Lighting properties
 uniform vec4 AmbientProduct, DiffuseProduct, SpecularProduct;
-uniform vec4 LightPosition;
 uniform float Shininess;
 
 // Matrix transformations
@@ -15,43 +29,32 @@ uniform mat4 Model;
 uniform mat4 View;
 uniform mat4 Projection;
 
+// Read Model and material from instance attributes instead of uniforms
+uniform bool Instanced;
+
 void main()
 {
-    // Transform vertex position into eye coordinates
-    vec3 pos = (View * Model * vPosition).xyz;
-
-    // Light source position in eye coordinates 
-    // (Assuming LightPosition is already in World or View space, 
-    //  but here we treat it as if it needs to be transformed if it was fixed in world)
-    // Simple case: LightPosition passed in View Space or World Space? 
-    // Usually fixed in World. Let's assume LightPosition is in World Space.
-    vec3 L;
-    
-    // Check if w is 0 (directional light) or 1 (point light)
-    if(LightPosition.w == 0.0) L = normalize( (View * LightPosition).xyz );
-    else L = normalize( (View * LightPosition).xyz - pos );
-
-    vec3 E = normalize( -pos );
-    vec3 H = normalize( L + E );
-
-    // Transform vertex normal into eye coordinates
-    vec3 N = normalize( (View * Model * vec4(vNormal, 0.0)).xyz );
-
-    // Compute terms in the illumination equation
-    vec4 ambient = AmbientProduct;
-
-    float Kd = max( dot(L, N), 0.0 );
-    vec4  diffuse = Kd * DiffuseProduct;
-
-    float Ks = pow( max(dot(N, H), 0.0), Shininess );
-    vec4  specular = Ks * SpecularProduct;
-    
-    if( dot(L, N) < 0.0 ) {
-	specular = vec4(0.0, 0.0, 0.0, 1.0);
-    } 
-
-    color = ambient + diffuse + specular;
-    color.a = 1.0;
-
-    gl_Position = Projection * View * Model * vPosition;
+    mat4 M = Model;
+    ambientProduct = AmbientProduct;
+    diffuseProduct = DiffuseProduct;
+    specularProduct = SpecularProduct;
+    shininess = Shininess;
+
+    if (Instanced) {
+	// Rows arrive as columns, transpose back (same as GL_TRUE on upload)
+	M = transpose( mat4(iModel0, iModel1, iModel2, iModel3) );
+	ambientProduct = iColor * 0.2;
+	diffuseProduct = iColor;
+	specularProduct = vec4(1.0, 1.0, 1.0, 1.0);
+	shininess = 50.0;
+    }
+
+    mat4 modelView = View * M;
+    vec4 pos = modelView * vPosition;
+    fPosition = pos.xyz;
+
+    // Parts are scaled unevenly, so normals need the inverse transpose
+    fNormal = transpose( inverse( mat3(modelView) ) ) * vNormal;
+
+    gl_Position = Projection * pos;
 }